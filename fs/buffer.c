@@ -0,0 +1,523 @@
+#include <block.h>
+#include <memory.h>
+#include <kmalloc.h>
+#include <kernel.h>
+#include <mutex.h>
+#include <hash.h>
+#include <ktime.h>
+#include <stdio.h>
+#include <debug.h>
+#include <error.h>
+#include <assert.h>
+#include <fs.h>
+
+#define MODULE "block"
+#define MODULE_DEBUG 0
+
+#define BCACHE_BITS 8
+#define BCACHE_SIZE (1 << BCACHE_BITS)
+
+static struct list_node block_devices;
+static struct list_node bcache[BCACHE_SIZE];
+/* least recently released at the tail */
+static struct list_node bcache_lru;
+static u32 nr_buffers;
+static struct mutex bcache_lock;
+
+static inline struct list_node *bcache_bucket(struct block_device *bdev,
+					      u32 block)
+{
+	return &bcache[hash_32(block ^ (u32)bdev, BCACHE_BITS)];
+}
+
+int register_block_device(struct block_device *bdev)
+{
+	list_init(&bdev->queue);
+	bdev->next_block = 0;
+	bdev->ra_window = 0;
+	memset(&bdev->stat, 0, sizeof(bdev->stat));
+
+	list_insert_tail(&block_devices, &bdev->node);
+	pr_info(bdev->name, ": ", dec(bdev->nr_blocks), " blocks");
+	return 0;
+}
+
+struct block_device *find_block_device(const char *name)
+{
+	struct block_device *bdev;
+	struct list_node *node;
+
+	for (node = block_devices.next; node != &block_devices;
+	     node = node->next) {
+		bdev = container_of(node, struct block_device, node);
+		if (!strcmp(bdev->name, name))
+			return bdev;
+	}
+
+	return NULL;
+}
+
+/* bcache_lock held */
+static void __brelse(struct buffer_head *bh)
+{
+	assert(bh->count > 0);
+
+	if (--bh->count == 0)
+		list_insert_head(&bcache_lru, &bh->lru_node);
+}
+
+/* the queue takes a reference until the request is done */
+static int blk_queue(struct buffer_head *bh, bool write)
+{
+	struct block_device *bdev = bh->bdev;
+	struct request *req;
+	struct list_node *node;
+
+	bh->count++;
+
+	for (node = bdev->queue.next; node != &bdev->queue; node = node->next) {
+		req = container_of(node, struct request, node);
+		if (req->write != write || req->nr >= BLOCK_REQ_MAX)
+			continue;
+
+		if (bh->block == req->block + req->nr) {
+			list_insert_tail(&req->bh_list, &bh->req_node);
+		} else if (bh->block + 1 == req->block) {
+			list_insert_head(&req->bh_list, &bh->req_node);
+			req->block--;
+		} else {
+			continue;
+		}
+
+		req->nr++;
+		bdev->stat.merged++;
+		return 0;
+	}
+
+	req = kmalloc(sizeof(*req));
+	if (!req) {
+		__brelse(bh);
+		return -ENOMEM;
+	}
+
+	req->write = write;
+	req->block = bh->block;
+	req->nr = 1;
+	list_init(&req->bh_list);
+	list_insert_tail(&req->bh_list, &bh->req_node);
+	list_insert_tail(&bdev->queue, &req->node);
+	bdev->stat.requests++;
+	return 0;
+}
+
+/* hand every queued request to the driver and wait for it */
+static int blk_run_queue(struct block_device *bdev)
+{
+	struct buffer_head *bh;
+	struct request *req;
+	u64 start, ns;
+	int err, ret = 0;
+
+	while (!list_empty(&bdev->queue)) {
+		req = container_of(list_next(&bdev->queue), struct request,
+				   node);
+		list_remove(&req->node);
+
+		start = ktime_ns();
+		err = bdev->ops->transfer(bdev, req);
+		ns = ktime_ns() - start;
+
+		if (req->write) {
+			bdev->stat.write_blocks += req->nr;
+			bdev->stat.write_ns += ns;
+		} else {
+			bdev->stat.read_blocks += req->nr;
+			bdev->stat.read_ns += ns;
+		}
+
+		if (err) {
+			pr_err(bdev->name, ": ", req->write ? "write" : "read",
+			       " of ", dec(req->nr), " blocks at ",
+			       dec(req->block), " failed ", dec(err));
+			ret = err;
+		}
+
+		while (!list_empty(&req->bh_list)) {
+			bh = container_of(list_next(&req->bh_list),
+					  struct buffer_head, req_node);
+			list_remove(&bh->req_node);
+
+			if (!err && req->write)
+				bh->flags &= ~BH_DIRTY;
+			else if (!err)
+				bh->flags |= BH_UPTODATE;
+			__brelse(bh);
+		}
+
+		kfree(req);
+	}
+
+	return ret;
+}
+
+static struct buffer_head *bcache_find(struct block_device *bdev, u32 block)
+{
+	struct list_node *node, *head = bcache_bucket(bdev, block);
+	struct buffer_head *bh;
+
+	for (node = head->next; node != head; node = node->next) {
+		bh = container_of(node, struct buffer_head, hash_node);
+		if (bh->bdev == bdev && bh->block == block)
+			return bh;
+	}
+
+	return NULL;
+}
+
+/* a new buffer while there is room, otherwise the least recently used */
+static struct buffer_head *bcache_alloc(void)
+{
+	struct buffer_head *bh;
+
+	if (nr_buffers < NR_BUFFERS) {
+		bh = kmalloc(sizeof(*bh));
+		if (!bh)
+			return NULL;
+
+		bh->page = alloc_page(GFP_NORMAL);
+		if (!bh->page) {
+			kfree(bh);
+			return NULL;
+		}
+
+		bh->data = (void *)page_to_virt(bh->page);
+		list_init(&bh->hash_node);
+		nr_buffers++;
+		return bh;
+	}
+
+	while (!list_empty(&bcache_lru)) {
+		bh = container_of(list_tail(&bcache_lru), struct buffer_head,
+				  lru_node);
+
+		if (bh->flags & BH_DIRTY) {
+			/* the writeback keeps it off the lru until it is done */
+			list_remove(&bh->lru_node);
+			if (blk_queue(bh, true) || blk_run_queue(bh->bdev)) {
+				/* cannot be written, keep it as the newest */
+				return NULL;
+			}
+			continue;
+		}
+
+		list_remove(&bh->lru_node);
+		list_remove(&bh->hash_node);
+		return bh;
+	}
+
+	return NULL;
+}
+
+/* bcache_lock held, the buffer of @block with a reference, maybe not read */
+static struct buffer_head *bcache_get(struct block_device *bdev, u32 block)
+{
+	struct buffer_head *bh;
+
+	bh = bcache_find(bdev, block);
+	if (bh) {
+		if (bh->count++ == 0)
+			list_remove(&bh->lru_node);
+		return bh;
+	}
+
+	bh = bcache_alloc();
+	if (!bh)
+		return NULL;
+
+	bh->bdev = bdev;
+	bh->block = block;
+	bh->flags = 0;
+	bh->count = 1;
+	list_insert_head(bcache_bucket(bdev, block), &bh->hash_node);
+	return bh;
+}
+
+/* bcache_lock held, queue up to the window after @block if not cached */
+static void blk_readahead(struct block_device *bdev, u32 block)
+{
+	struct buffer_head *bh;
+	u32 i;
+
+	if (block == bdev->next_block)
+		bdev->ra_window = bdev->ra_window ?
+					  min(bdev->ra_window * 2, BLOCK_RA_MAX) :
+					  BLOCK_RA_MIN;
+	else
+		bdev->ra_window = 0;
+
+	for (i = 1; i <= bdev->ra_window && block + i < bdev->nr_blocks; i++) {
+		bh = bcache_get(bdev, block + i);
+		if (!bh)
+			break;
+
+		/* the rest was read ahead before, or someone is filling it */
+		if ((bh->flags & BH_UPTODATE) || bh->count > 1) {
+			__brelse(bh);
+			break;
+		}
+
+		blk_queue(bh, false);
+		__brelse(bh);
+		bdev->stat.readahead++;
+	}
+}
+
+/*
+ * bread - the buffer of @block read from @bdev, NULL on errors. the
+ * caller holds it until brelse().
+ */
+struct buffer_head *bread(struct block_device *bdev, u32 block)
+{
+	struct buffer_head *bh;
+
+	if (block >= bdev->nr_blocks)
+		return NULL;
+
+	mutex_lock(&bcache_lock);
+
+	bh = bcache_get(bdev, block);
+	if (!bh)
+		goto out;
+
+	if (bh->flags & BH_UPTODATE) {
+		bdev->stat.hits++;
+	} else {
+		bdev->stat.misses++;
+		if (blk_queue(bh, false)) {
+			__brelse(bh);
+			bh = NULL;
+			goto out;
+		}
+
+		blk_readahead(bdev, block);
+		blk_run_queue(bdev);
+
+		if (!(bh->flags & BH_UPTODATE)) {
+			__brelse(bh);
+			bh = NULL;
+		}
+	}
+
+	bdev->next_block = block + 1;
+
+out:
+	mutex_unlock(&bcache_lock);
+	return bh;
+}
+
+/* the buffer of @block without reading it, for a caller overwriting it */
+struct buffer_head *bget(struct block_device *bdev, u32 block)
+{
+	struct buffer_head *bh;
+
+	if (block >= bdev->nr_blocks)
+		return NULL;
+
+	mutex_lock(&bcache_lock);
+	bh = bcache_get(bdev, block);
+	mutex_unlock(&bcache_lock);
+
+	return bh;
+}
+
+void brelse(struct buffer_head *bh)
+{
+	if (!bh)
+		return;
+
+	mutex_lock(&bcache_lock);
+	__brelse(bh);
+	mutex_unlock(&bcache_lock);
+}
+
+/* the whole block is valid now and written back on sync or eviction */
+void mark_buffer_dirty(struct buffer_head *bh)
+{
+	mutex_lock(&bcache_lock);
+	bh->flags |= BH_UPTODATE | BH_DIRTY;
+	mutex_unlock(&bcache_lock);
+}
+
+/* bcache_lock held, insertion sort so the queue merges runs of blocks */
+static int sync_blockdev_locked(struct block_device *bdev)
+{
+	struct buffer_head **dirty, *bh;
+	struct list_node *node;
+	int i, j, n = 0, ret = 0;
+
+	dirty = kmalloc(NR_BUFFERS * sizeof(*dirty));
+	if (!dirty)
+		return -ENOMEM;
+
+	for (i = 0; i < BCACHE_SIZE; i++) {
+		for (node = bcache[i].next; node != &bcache[i];
+		     node = node->next) {
+			bh = container_of(node, struct buffer_head, hash_node);
+			if (bh->bdev != bdev || !(bh->flags & BH_DIRTY))
+				continue;
+
+			for (j = n; j > 0 && dirty[j - 1]->block > bh->block; j--)
+				dirty[j] = dirty[j - 1];
+			dirty[j] = bh;
+			n++;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		bh = dirty[i];
+		if (bh->count++ == 0)
+			list_remove(&bh->lru_node);
+
+		ret = blk_queue(bh, true);
+		__brelse(bh);
+		if (ret)
+			break;
+	}
+
+	kfree(dirty);
+
+	i = blk_run_queue(bdev);
+	return i ? i : ret;
+}
+
+int sync_blockdev(struct block_device *bdev)
+{
+	int ret;
+
+	mutex_lock(&bcache_lock);
+	ret = sync_blockdev_locked(bdev);
+	mutex_unlock(&bcache_lock);
+
+	return ret;
+}
+
+/* write back and drop every buffer of @bdev nobody holds */
+int invalidate_blockdev(struct block_device *bdev)
+{
+	struct buffer_head *bh;
+	struct list_node *node, *next;
+	int ret;
+
+	mutex_lock(&bcache_lock);
+
+	ret = sync_blockdev_locked(bdev);
+	if (ret)
+		goto out;
+
+	for (node = bcache_lru.next; node != &bcache_lru; node = next) {
+		next = node->next;
+		bh = container_of(node, struct buffer_head, lru_node);
+		if (bh->bdev != bdev)
+			continue;
+
+		list_remove(&bh->lru_node);
+		list_remove(&bh->hash_node);
+		free_pages(bh->page);
+		kfree(bh);
+		nr_buffers--;
+	}
+
+	bdev->next_block = 0;
+	bdev->ra_window = 0;
+
+out:
+	mutex_unlock(&bcache_lock);
+	return ret;
+}
+
+int sync_all_blockdevs(void)
+{
+	struct list_node *node;
+	int err, ret = 0;
+
+	for (node = block_devices.next; node != &block_devices;
+	     node = node->next) {
+		err = sync_blockdev(container_of(node, struct block_device,
+						 node));
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+}
+
+/* KB per second of @blocks moved in @ns */
+static u32 block_kbps(u32 blocks, u64 ns)
+{
+	u64 kb = (u64)blocks * (BLOCK_SIZE / 1024) * 1000000;
+
+	do_div(ns, 1000);
+	if (!ns || ns > 0xffffffff)
+		return 0;
+
+	do_div(kb, (u32)ns);
+	return kb;
+}
+
+static u32 block_hit_rate(struct block_stat *st)
+{
+	u64 pct = st->hits * 100ull;
+
+	if (!st->hits)
+		return 0;
+
+	do_div(pct, st->hits + st->misses);
+	return pct;
+}
+
+/* counters only, read without bcache_lock as cat cannot sleep */
+static int block_stat_read(struct file *file, string *s)
+{
+	struct block_device *bdev;
+	struct block_stat *st;
+	struct list_node *node;
+
+	ksappend(s, "buffers:", dec(nr_buffers), "/", dec(NR_BUFFERS), "\n");
+
+	for (node = block_devices.next; node != &block_devices;
+	     node = node->next) {
+		bdev = container_of(node, struct block_device, node);
+		st = &bdev->stat;
+
+		ksappend(s, bdev->name, " blocks:", dec(bdev->nr_blocks),
+			 " hits:", dec(st->hits), " misses:", dec(st->misses),
+			 " hit_rate:", dec(block_hit_rate(st)), "%",
+			 " readahead:", dec(st->readahead), " requests:",
+			 dec(st->requests), " merged:", dec(st->merged), "\n");
+		ksappend(s, "  read:", dec(st->read_blocks), " blocks ",
+			 dec(block_kbps(st->read_blocks, st->read_ns)),
+			 " KB/s write:", dec(st->write_blocks), " blocks ",
+			 dec(block_kbps(st->write_blocks, st->write_ns)),
+			 " KB/s\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations block_stat_fops = {
+	.read = block_stat_read,
+};
+
+int block_init_late(void)
+{
+	struct file *file;
+	int i;
+
+	list_init(&block_devices);
+	list_init(&bcache_lru);
+	for (i = 0; i < BCACHE_SIZE; i++)
+		list_init(&bcache[i]);
+	mutex_init(&bcache_lock);
+
+	return create_file("block", &block_stat_fops, sys, NULL, &file);
+}
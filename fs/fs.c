@@ -2,40 +2,274 @@
 #include <fs.h>
 #include <kernel.h>
 #include <stdio.h>
+#include <hash.h>
+#include <stdlib.h>
+#include <error.h>
 
 struct directory *root;
 struct directory *bin;
 struct directory *proc;
 struct directory *sys;
+struct directory *tmp;
+
+/*
+ * serialises changes to the file and directory lists of every directory,
+ * lookups walk them under rcu_read_lock() only
+ */
+spinlock_t fs_lock;
+
+/*
+ * the name cache, files and directories hashed on (parent, name) so a
+ * lookup does not walk the whole directory. changed under fs_lock
+ * together with the directory lists, walked under rcu_read_lock().
+ */
+#define DCACHE_BITS 10
+#define DCACHE_SIZE (1 << DCACHE_BITS)
+
+static struct list_node file_hash[DCACHE_SIZE];
+static struct list_node dir_hash[DCACHE_SIZE];
+
+static inline struct list_node *dcache_bucket(struct list_node *table,
+					      struct directory *parent,
+					      u32 hash)
+{
+	return &table[hash_32(hash ^ (u32)parent, DCACHE_BITS)];
+}
 
-struct file *dir_find_file(struct directory *dir, const char *name)
+/* @name is not terminated after @len bytes, a path component */
+static inline bool dcache_name_eq(const char *entry, const char *name,
+				  size_t len)
 {
+	return !strncmp(entry, name, len) && entry[len] == '\0';
+}
+
+static struct file *__dcache_find_file(struct directory *parent,
+				       const char *name, size_t len, u32 hash)
+{
+	struct list_node *node, *head = dcache_bucket(file_hash, parent, hash);
 	struct file *file;
-	struct list_node *node, *head = &dir->file_list;
 
-	for (node = head->next; node != head; node = node->next) {
-		file = container_of(node, struct file, node);
-		if (!strcmp(name, file->name))
+	list_for_each_rcu(node, head) {
+		file = container_of(node, struct file, hash_node);
+		if (file->hash == hash && file->parent == parent &&
+		    dcache_name_eq(file->name, name, len))
 			return file;
 	}
 
 	return NULL;
 }
 
-struct directory *dir_find_dir(struct directory *dir, const char *name)
+static struct directory *__dcache_find_dir(struct directory *parent,
+					   const char *name, size_t len,
+					   u32 hash)
 {
-	struct directory *d;
-	struct list_node *node, *head = &dir->dir_list;
+	struct list_node *node, *head = dcache_bucket(dir_hash, parent, hash);
+	struct directory *dir;
 
-	for (node = head->next; node != head; node = node->next) {
-		d = container_of(node, struct directory, node);
-		if (!strcmp(name, d->name))
-			return d;
+	list_for_each_rcu(node, head) {
+		dir = container_of(node, struct directory, hash_node);
+		if (dir->hash == hash && dir->parent == parent &&
+		    dcache_name_eq(dir->name, name, len))
+			return dir;
 	}
 
 	return NULL;
 }
 
+/*
+ * fs_lock held, whether @parent has an entry @name. creating checks here
+ * before it inserts, so of two racing creates only one succeeds.
+ */
+static bool dcache_name_taken(struct directory *parent, const char *name,
+			      u32 hash)
+{
+	size_t len = strlen(name);
+
+	return __dcache_find_dir(parent, name, len, hash) ||
+	       __dcache_find_file(parent, name, len, hash);
+}
+
+/* on a miss the file system of @parent may instantiate the entry */
+static void __dcache_lookup(struct directory *parent, const char *name,
+			    size_t len, u32 hash, struct directory **dir,
+			    struct file **file)
+{
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		*dir = __dcache_find_dir(parent, name, len, hash);
+		*file = *dir ? NULL : __dcache_find_file(parent, name, len, hash);
+		if (*dir || *file)
+			return;
+
+		if (pass || !parent->dops || !parent->dops->lookup ||
+		    parent->dops->lookup(parent, name, len))
+			return;
+	}
+}
+
+/* fs_lock held, unhash @dir and everything below it */
+static void dcache_remove_dir(struct directory *dir)
+{
+	struct list_node *node;
+
+	list_for_each_rcu(node, &dir->file_list)
+		list_remove_rcu(&container_of(node, struct file, node)->hash_node);
+
+	list_for_each_rcu(node, &dir->dir_list)
+		dcache_remove_dir(container_of(node, struct directory, node));
+
+	list_remove_rcu(&dir->hash_node);
+}
+
+/*
+ * the returned file stays valid only as long as the caller is in a read
+ * side section, unless it is never removed like the files in bin
+ */
+struct file *dir_find_file(struct directory *dir, const char *name)
+{
+	struct directory *d;
+	struct file *found;
+	size_t len = strlen(name);
+
+	rcu_read_lock();
+	__dcache_lookup(dir, name, len, name_hash(name, len), &d, &found);
+	rcu_read_unlock();
+
+	return found;
+}
+
+struct directory *dir_find_dir(struct directory *dir, const char *name)
+{
+	struct directory *found;
+	struct file *f;
+	size_t len = strlen(name);
+
+	rcu_read_lock();
+	__dcache_lookup(dir, name, len, name_hash(name, len), &found, &f);
+	rcu_read_unlock();
+
+	return found;
+}
+
+/*
+ * path_lookup - resolve @path, absolute or relative to @cwd, one component
+ * at a time through the name cache. "." and ".." are understood and
+ * repeated slashes ignored. on success one of @dir and @file is set and
+ * the other is NULL, valid as long as dir_find_file() results are.
+ */
+int path_lookup(const char *path, struct directory *cwd,
+		struct directory **dir, struct file **file)
+{
+	struct directory *d = *path == '/' ? root : cwd, *next;
+	struct file *f = NULL;
+	const char *end;
+	size_t len;
+	u32 hash;
+	int ret = 0;
+
+	*dir = NULL;
+	*file = NULL;
+
+	rcu_read_lock();
+
+	while (*path != '\0') {
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+
+		/* only the last component may be a file */
+		if (f) {
+			ret = -ENOTDIR;
+			goto out;
+		}
+
+		end = strfind(path, '/');
+		len = end - path;
+
+		if (len == 2 && path[0] == '.' && path[1] == '.') {
+			if (d->parent)
+				d = d->parent;
+		} else if (len != 1 || path[0] != '.') {
+			hash = name_hash(path, len);
+			__dcache_lookup(d, path, len, hash, &next, &f);
+			if (next) {
+				d = next;
+			} else if (!f) {
+				ret = -ENOENT;
+				goto out;
+			}
+		}
+
+		path = end;
+	}
+
+	if (f)
+		*file = f;
+	else
+		*dir = d;
+
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * path_lookup_parent - the directory @path is in and its last component,
+ * which is not looked up, in @name
+ */
+int path_lookup_parent(const char *path, struct directory *cwd,
+		       struct directory **dir, const char **name)
+{
+	const char *slash = NULL, *p;
+	struct file *file;
+	char *prefix;
+	int ret;
+
+	for (p = path; *p != '\0'; p++) {
+		if (*p == '/')
+			slash = p;
+	}
+
+	*name = slash ? slash + 1 : path;
+	if (**name == '\0')
+		return -EINVAL;
+
+	if (!slash) {
+		*dir = cwd;
+		return 0;
+	}
+
+	if (slash == path) {
+		*dir = root;
+		return 0;
+	}
+
+	prefix = kmalloc(slash - path + 1);
+	if (!prefix)
+		return -ENOMEM;
+
+	memcpy(prefix, path, slash - path);
+	prefix[slash - path] = '\0';
+
+	ret = path_lookup(prefix, cwd, dir, &file);
+	kfree(prefix);
+	if (!ret && !*dir)
+		ret = -ENOTDIR;
+
+	return ret;
+}
+
+/* before listing @dir, rcu_read_lock() held */
+int vfs_populate(struct directory *dir)
+{
+	if (!dir->dops || !dir->dops->populate)
+		return 0;
+
+	return dir->dops->populate(dir);
+}
+
 int create_file(const char *name, struct file_operations *fops,
 		struct directory *parent, void *priv, struct file **file)
 {
@@ -49,20 +283,153 @@ int create_file(const char *name, struct file_operations *fops,
 	f->name = name;
 	f->fops = fops;
 	f->priv = priv;
+	f->hash = name_hash(name, strlen(name));
+	spinlock_init(&f->read_lock);
+	f->read_cache = NULL;
+	f->read_off = 0;
+
+	spin_lock(&fs_lock);
+	if (dcache_name_taken(parent, name, f->hash)) {
+		spin_unlock(&fs_lock);
+		kfree(f);
+		return -EEXIST;
+	}
 
-	list_insert(&parent->file_list, &f->node);
+	list_insert_rcu(&parent->file_list, &f->node);
+	list_insert_rcu(dcache_bucket(file_hash, parent, f->hash),
+			&f->hash_node);
+	spin_unlock(&fs_lock);
 
 	*file = f;
 	return 0;
 }
 
-int remove_file(struct file *file)
+static void free_file(struct file *file)
 {
-	list_remove(&file->node);
+	if (file->read_cache)
+		ksfree(file->read_cache);
 	kfree(file);
+}
+
+static void free_file_rcu(struct rcu_head *head)
+{
+	free_file(container_of(head, struct file, rcu));
+}
+
+int remove_file(struct file *file)
+{
+	spin_lock(&fs_lock);
+	list_remove_rcu(&file->node);
+	list_remove_rcu(&file->hash_node);
+	spin_unlock(&fs_lock);
+
+	call_rcu(&file->rcu, free_file_rcu);
 	return 0;
 }
 
+/*
+ * a read at 0, or anywhere but where the last one ended, renders the file
+ * anew; reading on from there copies from that text, so a file read front
+ * to back in pieces is rendered once. the read at the end drops the text.
+ */
+static int vfs_read_string(struct file *file, char *buf, size_t len, u32 off)
+{
+	string *s;
+	int ret = 0;
+
+	spin_lock(&file->read_lock);
+
+	s = file->read_cache;
+	if (!s || !off || off != file->read_off) {
+		if (s)
+			ksfree(s);
+		file->read_cache = NULL;
+
+		s = ksalloc();
+		if (!s) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		ret = file->fops->read(file, s);
+		if (ret) {
+			ksfree(s);
+			goto out;
+		}
+
+		file->read_cache = s;
+	}
+
+	if (off < s->length) {
+		ret = min(len, s->length - off);
+		memcpy(buf, s->str + off, ret);
+	}
+
+	file->read_off = off + ret;
+	if (!ret) {
+		ksfree(s);
+		file->read_cache = NULL;
+	}
+
+out:
+	spin_unlock(&file->read_lock);
+	return ret;
+}
+
+/*
+ * vfs_read - copy up to @len bytes at @off of @file into @buf, returns
+ * how many or a negative errno, 0 at the end of the file
+ */
+int vfs_read(struct file *file, char *buf, size_t len, u32 off)
+{
+	if (file->fops->pread)
+		return file->fops->pread(file, buf, len, off);
+
+	if (file->fops->read)
+		return vfs_read_string(file, buf, len, off);
+
+	return -EINVAL;
+}
+
+int vfs_write(struct file *file, const char *buf, size_t len, u32 off)
+{
+	if (!file->fops->pwrite)
+		return -EINVAL;
+
+	return file->fops->pwrite(file, buf, len, off);
+}
+
+int vfs_truncate(struct file *file, u32 size)
+{
+	if (!file->fops->truncate)
+		return -EINVAL;
+
+	return file->fops->truncate(file, size);
+}
+
+/* a regular file in a directory that stores data, @name is copied */
+int vfs_create(struct directory *dir, const char *name, struct file **file)
+{
+	if (!dir->dops || !dir->dops->create)
+		return -EINVAL;
+
+	/* lets the file system instantiate the name, create_file() decides */
+	if (dir_find_file(dir, name) || dir_find_dir(dir, name))
+		return -EEXIST;
+
+	return dir->dops->create(dir, name, file);
+}
+
+int vfs_unlink(struct file *file)
+{
+	struct directory *dir = file->parent;
+
+	if (!dir->dops || !dir->dops->unlink)
+		return -EINVAL;
+
+	return dir->dops->unlink(file);
+}
+
 int create_directory(const char *name, struct directory *parent,
 		     struct directory **dir)
 {
@@ -74,39 +441,74 @@ int create_directory(const char *name, struct directory *parent,
 
 	d->name = name;
 	d->parent = parent;
+	d->sb = parent ? parent->sb : NULL;
+	d->dops = NULL;
+	d->hash = name_hash(name, strlen(name));
 
 	list_init(&d->file_list);
 	list_init(&d->dir_list);
-
-	if (parent)
-		list_insert(&parent->dir_list, &d->node);
+	/* the root is not looked up by name */
+	list_init(&d->hash_node);
+
+	if (parent) {
+		spin_lock(&fs_lock);
+		if (dcache_name_taken(parent, name, d->hash)) {
+			spin_unlock(&fs_lock);
+			kfree(d);
+			return -EEXIST;
+		}
+
+		list_insert_rcu(&parent->dir_list, &d->node);
+		list_insert_rcu(dcache_bucket(dir_hash, parent, d->hash),
+				&d->hash_node);
+		spin_unlock(&fs_lock);
+	}
 
 	*dir = d;
 	return 0;
 }
 
-int remove_directory(struct directory *dir)
+/* nothing can reach @dir any more, free it with all its content */
+static void free_directory(struct directory *dir)
 {
+	struct list_node *head;
 	struct file *file;
 	struct directory *d;
-	struct list_node *node, *head;
 
-	/* remove all sub file */
 	head = &dir->file_list;
-	for (node = head->next; node != head; node = node->next) {
-		file = container_of(node, struct file, node);
-		remove_file(file);
+	while (!list_empty(head)) {
+		file = container_of(list_next(head), struct file, node);
+		list_remove(&file->node);
+		free_file(file);
 	}
 
-	/* remove all sub directory */
 	head = &dir->dir_list;
-	for (node = head->next; node != head; node = node->next) {
-		d = container_of(node, struct directory, node);
-		remove_directory(d);
+	while (!list_empty(head)) {
+		d = container_of(list_next(head), struct directory, node);
+		list_remove(&d->node);
+		free_directory(d);
 	}
 
-	list_remove(&dir->node);
 	kfree(dir);
+}
+
+static void free_directory_rcu(struct rcu_head *head)
+{
+	free_directory(container_of(head, struct directory, rcu));
+}
+
+/*
+ * unlinking the top directory from its parent is enough, readers may still
+ * walk below it. the name cache reaches every entry, all of them leave it.
+ */
+int remove_directory(struct directory *dir)
+{
+	spin_lock(&fs_lock);
+	list_remove_rcu(&dir->node);
+	dcache_remove_dir(dir);
+	spin_unlock(&fs_lock);
+
+	call_rcu(&dir->rcu, free_directory_rcu);
 	return 0;
 }
 
@@ -132,41 +534,284 @@ int binfs_remove_file(const char *name)
 	return remove_file(file);
 }
 
-int procfs_create_dir(const char *name, struct directory **dir)
+/* the mount table, changed under fs_lock */
+struct mount {
+	struct super_block *sb;
+	/* a copy, the mount point's name points into it */
+	char *path;
+	/* the mount point was created by the mount and goes with it */
+	bool owned;
+	struct list_node node;
+};
+
+static struct list_node file_systems;
+static struct list_node mounts;
+static struct file *mounts_file;
+
+/* their files are created by the rest of the kernel, nothing to set up */
+static struct file_system_type binfs_type = { .name = "binfs" };
+static struct file_system_type sysfs_type = { .name = "sysfs" };
+
+int register_filesystem(struct file_system_type *fs)
+{
+	spin_lock(&fs_lock);
+	list_insert_tail(&file_systems, &fs->node);
+	spin_unlock(&fs_lock);
+	return 0;
+}
+
+static struct file_system_type *find_filesystem(const char *name)
+{
+	struct file_system_type *fs, *found = NULL;
+	struct list_node *node;
+
+	spin_lock(&fs_lock);
+	for (node = file_systems.next; node != &file_systems;
+	     node = node->next) {
+		fs = container_of(node, struct file_system_type, node);
+		if (!strcmp(fs->name, name)) {
+			found = fs;
+			break;
+		}
+	}
+	spin_unlock(&fs_lock);
+
+	return found;
+}
+
+static inline bool is_mount_point(struct directory *dir)
 {
-	return create_directory(name, proc, dir);
+	return dir->sb && dir->sb->root == dir;
 }
 
-int procfs_remove_dir(const char *name)
+/* the mount point at @path, created if its parent exists */
+static int mount_point(struct mount *m, struct directory **dir)
 {
+	struct directory *parent;
+	struct file *file;
+	const char *name;
+	int ret;
+
+	ret = path_lookup(m->path, root, dir, &file);
+	if (ret == -ENOENT) {
+		ret = path_lookup_parent(m->path, root, &parent, &name);
+		if (ret)
+			return ret;
+
+		m->owned = true;
+		return create_directory(name, parent, dir);
+	}
+
+	if (ret)
+		return ret;
+
+	if (file)
+		return -ENOTDIR;
+
+	if (*dir == root || is_mount_point(*dir) ||
+	    !list_empty(&(*dir)->file_list) || !list_empty(&(*dir)->dir_list))
+		return -EBUSY;
+
+	return 0;
+}
+
+/*
+ * vfs_mount - mount a file system of @type at the absolute @path, an empty
+ * directory or a new one in an existing directory
+ */
+int vfs_mount(const char *type, const char *path, struct directory **mnt)
+{
+	struct file_system_type *fs;
+	struct super_block *sb;
 	struct directory *dir;
+	struct mount *m;
+	size_t len = strlen(path);
+	int ret = -ENOMEM;
 
-	dir = dir_find_dir(proc, name);
-	if (!dir)
-		return -ENOENT;
+	fs = find_filesystem(type);
+	if (!fs)
+		return -ENODEV;
+
+	if (*path != '/')
+		return -EINVAL;
+
+	m = kmalloc(sizeof(*m));
+	if (!m)
+		return -ENOMEM;
+
+	m->path = kmalloc(len + 1);
+	if (!m->path)
+		goto err_free_mount;
+	memcpy(m->path, path, len + 1);
+	m->owned = false;
+
+	sb = kmalloc(sizeof(*sb));
+	if (!sb)
+		goto err_free_path;
+
+	ret = mount_point(m, &dir);
+	if (ret)
+		goto err_free_sb;
+
+	sb->type = fs;
+	sb->root = dir;
+	sb->priv = NULL;
+	dir->sb = sb;
+	m->sb = sb;
+
+	if (fs->mount) {
+		ret = fs->mount(sb);
+		if (ret)
+			goto err_put_dir;
+	}
+
+	spin_lock(&fs_lock);
+	list_insert_tail(&mounts, &m->node);
+	spin_unlock(&fs_lock);
 
-	return remove_directory(dir);
+	if (mnt)
+		*mnt = dir;
+	return 0;
+
+err_put_dir:
+	if (m->owned) {
+		remove_directory(dir);
+		synchronize_rcu();
+	} else {
+		dir->sb = dir->parent->sb;
+	}
+err_free_sb:
+	kfree(sb);
+err_free_path:
+	kfree(m->path);
+err_free_mount:
+	kfree(m);
+	return ret;
 }
 
-int fs_init(void)
+/* whether @dir is @top or below it */
+bool dir_is_below(struct directory *dir, struct directory *top)
 {
+	for (; dir; dir = dir->parent) {
+		if (dir == top)
+			return true;
+	}
+
+	return false;
+}
+
+/* only mounts that made their mount point, the ones at boot stay */
+int vfs_umount(const char *path)
+{
+	struct mount *m = NULL, *other;
+	struct directory *dir;
+	struct list_node *node;
+	struct file *file;
 	int ret;
 
+	ret = path_lookup(path, root, &dir, &file);
+	if (ret)
+		return ret;
+
+	if (!dir || !is_mount_point(dir))
+		return -EINVAL;
+
+	if (dir_is_below(current_dir, dir))
+		return -EBUSY;
+
+	spin_lock(&fs_lock);
+	for (node = mounts.next; node != &mounts; node = node->next) {
+		other = container_of(node, struct mount, node);
+		if (other->sb->root == dir)
+			m = other;
+		else if (dir_is_below(other->sb->root, dir))
+			ret = -EBUSY;
+	}
+
+	if (!ret && m && !m->owned)
+		ret = -EBUSY;
+	if (!ret && m)
+		list_remove(&m->node);
+	spin_unlock(&fs_lock);
+
+	if (ret || !m)
+		return ret ? ret : -EINVAL;
+
+	if (m->sb->type->kill_sb)
+		m->sb->type->kill_sb(m->sb);
+
+	remove_directory(dir);
+	/* the name of the mount point is in m->path */
+	synchronize_rcu();
+
+	kfree(m->sb);
+	kfree(m->path);
+	kfree(m);
+	return 0;
+}
+
+static int mounts_read(struct file *file, string *s)
+{
+	struct mount *m;
+	struct list_node *node;
+
+	spin_lock(&fs_lock);
+	for (node = mounts.next; node != &mounts; node = node->next) {
+		m = container_of(node, struct mount, node);
+		ksappend(s, m->sb->type->name, " ", m->path, "\n");
+	}
+	spin_unlock(&fs_lock);
+
+	return 0;
+}
+
+static struct file_operations mounts_fops = {
+	.read = mounts_read,
+};
+
+int fs_init(void)
+{
+	int ret, i;
+
+	spinlock_init(&fs_lock);
+	list_init(&file_systems);
+	list_init(&mounts);
+
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		list_init(&file_hash[i]);
+		list_init(&dir_hash[i]);
+	}
+
 	ret = create_directory("/", NULL, &root);
 	if (ret)
 		return ret;
 
-	ret = create_directory("bin", root, &bin);
+	register_filesystem(&binfs_type);
+	register_filesystem(&sysfs_type);
+
+	ret = procfs_init();
 	if (ret)
 		return ret;
 
-	ret = create_directory("proc", root, &proc);
+	ret = ramfs_init();
 	if (ret)
 		return ret;
 
-	ret = create_directory("sys", root, &sys);
+	ret = vfs_mount("binfs", "/bin", &bin);
 	if (ret)
 		return ret;
 
-	return 0;
+	ret = vfs_mount("procfs", "/proc", &proc);
+	if (ret)
+		return ret;
+
+	ret = vfs_mount("sysfs", "/sys", &sys);
+	if (ret)
+		return ret;
+
+	ret = vfs_mount("ramfs", "/tmp", &tmp);
+	if (ret)
+		return ret;
+
+	return create_file("mounts", &mounts_fops, sys, NULL, &mounts_file);
 }
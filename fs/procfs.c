@@ -0,0 +1,348 @@
+#include <fs.h>
+#include <schedule.h>
+#include <kmalloc.h>
+#include <memory.h>
+#include <kernel.h>
+#include <stdlib.h>
+#include <error.h>
+#include <rcu.h>
+#include <ktime.h>
+
+/*
+ * procfs - a directory per thread, made when it is first looked up or
+ * listed instead of when the thread is created
+ *
+ * the files of a thread directory find the thread by tid on every read,
+ * so a directory outliving its thread only reads -ENOENT. directories of
+ * exited threads are dropped on the next lookup or listing of the root.
+ */
+#define PROCFS_NAME_LEN 12
+
+struct procfs_thread {
+	u32 tid;
+	char name[PROCFS_NAME_LEN];
+	struct directory *dir;
+	/* in procfs_sb->threads */
+	struct list_node node;
+	struct rcu_head rcu;
+};
+
+struct procfs_sb {
+	/* the thread directories, lookups of the root race on it */
+	spinlock_t lock;
+	struct list_node threads;
+	struct rcu_head rcu;
+};
+
+/* rcu_read_lock() held by the reader */
+static struct thread *procfs_thread(struct file *file)
+{
+	struct procfs_thread *pt = file->priv;
+
+	return find_thread(pt->tid);
+}
+
+static int procfs_state_read(struct file *file, string *s)
+{
+	struct thread *t;
+
+	rcu_read_lock();
+	t = procfs_thread(file);
+	if (t)
+		ksappend_str(s, thread_state_name(t->state));
+	rcu_read_unlock();
+
+	return t ? 0 : -ENOENT;
+}
+
+static int procfs_cpu_read(struct file *file, string *s)
+{
+	struct thread *t;
+
+	rcu_read_lock();
+	t = procfs_thread(file);
+	if (t)
+		ksappend_int(s, t->cpu);
+	rcu_read_unlock();
+
+	return t ? 0 : -ENOENT;
+}
+
+/* in us */
+static int procfs_runtime_read(struct file *file, string *s)
+{
+	struct thread *t;
+
+	rcu_read_lock();
+	t = procfs_thread(file);
+	if (t)
+		ksappend_int(s, ktime_to_us(thread_runtime(t)));
+	rcu_read_unlock();
+
+	return t ? 0 : -ENOENT;
+}
+
+/* the deepest use and the size, in bytes */
+static int procfs_stack_read(struct file *file, string *s)
+{
+	struct thread *t;
+
+	rcu_read_lock();
+	t = procfs_thread(file);
+	if (t) {
+		ksappend_int(s, thread_stack_used(t));
+		ksappend_str(s, "/");
+		ksappend_int(s, KERNEL_STACK_SIZE);
+	}
+	rcu_read_unlock();
+
+	return t ? 0 : -ENOENT;
+}
+
+static struct file_operations procfs_state_fops = {
+	.read = procfs_state_read,
+};
+
+static struct file_operations procfs_cpu_fops = {
+	.read = procfs_cpu_read,
+};
+
+static struct file_operations procfs_runtime_fops = {
+	.read = procfs_runtime_read,
+};
+
+static struct file_operations procfs_stack_fops = {
+	.read = procfs_stack_read,
+};
+
+static int procfs_thread_files(struct procfs_thread *pt)
+{
+	struct file *file;
+	int ret;
+
+	ret = create_file("state", &procfs_state_fops, pt->dir, pt, &file);
+	if (ret)
+		return ret;
+
+	ret = create_file("cpu", &procfs_cpu_fops, pt->dir, pt, &file);
+	if (ret)
+		return ret;
+
+	ret = create_file("runtime", &procfs_runtime_fops, pt->dir, pt, &file);
+	if (ret)
+		return ret;
+
+	return create_file("stack", &procfs_stack_fops, pt->dir, pt, &file);
+}
+
+static void procfs_free_thread_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct procfs_thread, rcu));
+}
+
+/* psb->lock held, the files go with the directory after a grace period */
+static void procfs_drop_thread(struct procfs_thread *pt)
+{
+	list_remove(&pt->node);
+	remove_directory(pt->dir);
+	call_rcu(&pt->rcu, procfs_free_thread_rcu);
+}
+
+/* psb->lock held */
+static struct procfs_thread *procfs_find_thread(struct procfs_sb *psb,
+						u32 tid)
+{
+	struct list_node *node;
+	struct procfs_thread *pt;
+
+	for (node = psb->threads.next; node != &psb->threads;
+	     node = node->next) {
+		pt = container_of(node, struct procfs_thread, node);
+		if (pt->tid == tid)
+			return pt;
+	}
+
+	return NULL;
+}
+
+/* psb->lock held, the directory of @t in @root unless it is there */
+static int procfs_add_thread(struct procfs_sb *psb, struct directory *root,
+			     struct thread *t)
+{
+	struct procfs_thread *pt;
+	string *s;
+	int ret;
+
+	if (procfs_find_thread(psb, t->tid))
+		return 0;
+
+	pt = kmalloc(sizeof(*pt));
+	if (!pt)
+		return -ENOMEM;
+
+	s = ksalloc();
+	if (!s) {
+		kfree(pt);
+		return -ENOMEM;
+	}
+
+	ksappend_int(s, t->tid);
+	memcpy(pt->name, s->str, min(s->length + 1, (size_t)PROCFS_NAME_LEN));
+	ksfree(s);
+	pt->tid = t->tid;
+
+	ret = create_directory(pt->name, root, &pt->dir);
+	if (ret) {
+		kfree(pt);
+		return ret;
+	}
+
+	list_insert_tail(&psb->threads, &pt->node);
+
+	ret = procfs_thread_files(pt);
+	if (ret)
+		procfs_drop_thread(pt);
+
+	return ret;
+}
+
+/*
+ * psb->lock held, rcu_read_lock() held. the directory the shell is in
+ * stays, reading -ENOENT, until it leaves.
+ */
+static void procfs_prune(struct procfs_sb *psb)
+{
+	struct list_node *node, *next;
+	struct procfs_thread *pt;
+
+	for (node = psb->threads.next; node != &psb->threads; node = next) {
+		next = node->next;
+		pt = container_of(node, struct procfs_thread, node);
+		if (!find_thread(pt->tid) && !dir_is_below(current_dir, pt->dir))
+			procfs_drop_thread(pt);
+	}
+}
+
+/* @name of @len bytes as a tid, -ENOENT if it is not a number */
+static int procfs_parse_tid(const char *name, size_t len, u32 *tid)
+{
+	size_t i;
+
+	if (!len || len >= PROCFS_NAME_LEN)
+		return -ENOENT;
+
+	*tid = 0;
+	for (i = 0; i < len; i++) {
+		if (name[i] < '0' || name[i] > '9')
+			return -ENOENT;
+		*tid = *tid * 10 + name[i] - '0';
+	}
+
+	return 0;
+}
+
+static int procfs_lookup(struct directory *dir, const char *name, size_t len)
+{
+	struct procfs_sb *psb = dir->sb->priv;
+	struct thread *t;
+	u32 tid;
+	int ret;
+
+	/* thread directories are complete when they are made */
+	if (dir != dir->sb->root)
+		return -ENOENT;
+
+	ret = procfs_parse_tid(name, len, &tid);
+	if (ret)
+		return ret;
+
+	t = find_thread(tid);
+	if (!t)
+		return -ENOENT;
+
+	spin_lock(&psb->lock);
+	procfs_prune(psb);
+	ret = procfs_add_thread(psb, dir, t);
+	spin_unlock(&psb->lock);
+
+	return ret;
+}
+
+struct procfs_walk {
+	struct procfs_sb *psb;
+	struct directory *root;
+};
+
+static int procfs_walk_thread(struct thread *t, void *arg)
+{
+	struct procfs_walk *w = arg;
+
+	return procfs_add_thread(w->psb, w->root, t);
+}
+
+/* the threads lookup resolves, all of them */
+static int procfs_populate(struct directory *dir)
+{
+	struct procfs_walk w = { .psb = dir->sb->priv, .root = dir };
+	int ret;
+
+	if (dir != dir->sb->root)
+		return 0;
+
+	spin_lock(&w.psb->lock);
+	procfs_prune(w.psb);
+	ret = for_each_thread(procfs_walk_thread, &w);
+	spin_unlock(&w.psb->lock);
+
+	return ret;
+}
+
+static struct dir_operations procfs_dir_ops = {
+	.lookup = procfs_lookup,
+	.populate = procfs_populate,
+};
+
+static int procfs_mount(struct super_block *sb)
+{
+	struct procfs_sb *psb;
+
+	psb = kmalloc(sizeof(*psb));
+	if (!psb)
+		return -ENOMEM;
+
+	spinlock_init(&psb->lock);
+	list_init(&psb->threads);
+
+	sb->priv = psb;
+	sb->root->dops = &procfs_dir_ops;
+	return 0;
+}
+
+static void procfs_free_sb_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct procfs_sb, rcu));
+}
+
+static void procfs_kill_sb(struct super_block *sb)
+{
+	struct procfs_sb *psb = sb->priv;
+
+	spin_lock(&psb->lock);
+	while (!list_empty(&psb->threads))
+		procfs_drop_thread(container_of(list_next(&psb->threads),
+						struct procfs_thread, node));
+	spin_unlock(&psb->lock);
+
+	call_rcu(&psb->rcu, procfs_free_sb_rcu);
+}
+
+static struct file_system_type procfs_type = {
+	.name = "procfs",
+	.mount = procfs_mount,
+	.kill_sb = procfs_kill_sb,
+};
+
+int procfs_init(void)
+{
+	return register_filesystem(&procfs_type);
+}
@@ -0,0 +1,280 @@
+#include <fs.h>
+#include <memory.h>
+#include <kmalloc.h>
+#include <kernel.h>
+#include <stdlib.h>
+#include <error.h>
+
+/*
+ * ramfs - regular files kept in pages
+ *
+ * page i of a file holds its bytes [i * PAGE_SIZE, (i + 1) * PAGE_SIZE)
+ * and is allocated on the first write to it, missing pages read as zeros.
+ * the page array only grows, truncate frees the pages after the end.
+ */
+#define RAMFS_MAX_SIZE (64 * 1024 * 1024)
+#define RAMFS_MIN_SLOTS 8
+
+struct ramfs_inode {
+	/* the pages and size, readers copy out under it too */
+	spinlock_t lock;
+	u32 size;
+	struct page **pages;
+	u32 nr_slots;
+	char *name;
+	struct rcu_head rcu;
+};
+
+static inline void *ramfs_page(struct ramfs_inode *inode, u32 index)
+{
+	if (index >= inode->nr_slots || !inode->pages[index])
+		return NULL;
+
+	return (void *)page_to_virt(inode->pages[index]);
+}
+
+static int ramfs_pread(struct file *file, char *buf, size_t len, u32 off)
+{
+	struct ramfs_inode *inode = file->priv;
+	u32 copied = 0, n, in_page;
+	void *page;
+
+	spin_lock(&inode->lock);
+
+	if (off >= inode->size) {
+		spin_unlock(&inode->lock);
+		return 0;
+	}
+
+	len = min(len, inode->size - off);
+	while (copied < len) {
+		in_page = (off + copied) & (PAGE_SIZE - 1);
+		n = min(len - copied, PAGE_SIZE - in_page);
+
+		page = ramfs_page(inode, (off + copied) >> PAGE_SHIFT);
+		if (page)
+			memcpy(buf + copied, page + in_page, n);
+		else
+			memset(buf + copied, 0, n);
+
+		copied += n;
+	}
+
+	spin_unlock(&inode->lock);
+	return copied;
+}
+
+/* lock held, room for the pages of a file of @size bytes */
+static int ramfs_grow_slots(struct ramfs_inode *inode, u32 size)
+{
+	u32 need = round_up(size, PAGE_SIZE) >> PAGE_SHIFT;
+	u32 nr = max(inode->nr_slots, RAMFS_MIN_SLOTS);
+	struct page **pages;
+
+	if (need <= inode->nr_slots)
+		return 0;
+
+	while (nr < need)
+		nr *= 2;
+
+	pages = kmalloc(nr * sizeof(*pages));
+	if (!pages)
+		return -ENOMEM;
+
+	memset(pages, 0, nr * sizeof(*pages));
+	if (inode->pages) {
+		memcpy(pages, inode->pages, inode->nr_slots * sizeof(*pages));
+		kfree(inode->pages);
+	}
+
+	inode->pages = pages;
+	inode->nr_slots = nr;
+	return 0;
+}
+
+static int ramfs_pwrite(struct file *file, const char *buf, size_t len,
+			u32 off)
+{
+	struct ramfs_inode *inode = file->priv;
+	u32 copied = 0, n, in_page, index;
+	struct page *page;
+	int ret;
+
+	if (off > RAMFS_MAX_SIZE || len > RAMFS_MAX_SIZE - off)
+		return -EFBIG;
+
+	spin_lock(&inode->lock);
+
+	ret = ramfs_grow_slots(inode, off + len);
+	if (ret)
+		goto out;
+
+	while (copied < len) {
+		index = (off + copied) >> PAGE_SHIFT;
+		in_page = (off + copied) & (PAGE_SIZE - 1);
+		n = min(len - copied, PAGE_SIZE - in_page);
+
+		page = inode->pages[index];
+		if (!page) {
+			page = alloc_page(GFP_NORMAL);
+			if (!page) {
+				ret = -ENOMEM;
+				break;
+			}
+
+			/* whatever the write does not cover reads as zeros */
+			if (n != PAGE_SIZE)
+				memset((void *)page_to_virt(page), 0, PAGE_SIZE);
+			inode->pages[index] = page;
+		}
+
+		memcpy((void *)page_to_virt(page) + in_page, buf + copied, n);
+		copied += n;
+	}
+
+	if (copied && off + copied > inode->size)
+		inode->size = off + copied;
+
+out:
+	spin_unlock(&inode->lock);
+	return copied ? copied : ret;
+}
+
+static int ramfs_truncate(struct file *file, u32 size)
+{
+	struct ramfs_inode *inode = file->priv;
+	u32 index, in_page;
+	void *page;
+	int ret = 0;
+
+	if (size > RAMFS_MAX_SIZE)
+		return -EFBIG;
+
+	spin_lock(&inode->lock);
+
+	if (size >= inode->size) {
+		ret = ramfs_grow_slots(inode, size);
+		if (!ret)
+			inode->size = size;
+		goto out;
+	}
+
+	/* bytes after the end would show up again if the file grows */
+	in_page = size & (PAGE_SIZE - 1);
+	page = ramfs_page(inode, size >> PAGE_SHIFT);
+	if (in_page && page)
+		memset(page + in_page, 0, PAGE_SIZE - in_page);
+
+	for (index = round_up(size, PAGE_SIZE) >> PAGE_SHIFT;
+	     index < inode->nr_slots; index++) {
+		if (inode->pages[index]) {
+			free_pages(inode->pages[index]);
+			inode->pages[index] = NULL;
+		}
+	}
+
+	inode->size = size;
+
+out:
+	spin_unlock(&inode->lock);
+	return ret;
+}
+
+static struct file_operations ramfs_file_fops = {
+	.pread = ramfs_pread,
+	.pwrite = ramfs_pwrite,
+	.truncate = ramfs_truncate,
+};
+
+static void ramfs_free_inode(struct ramfs_inode *inode)
+{
+	u32 i;
+
+	for (i = 0; i < inode->nr_slots; i++) {
+		if (inode->pages[i])
+			free_pages(inode->pages[i]);
+	}
+
+	kfree(inode->pages);
+	kfree(inode->name);
+	kfree(inode);
+}
+
+static void ramfs_free_inode_rcu(struct rcu_head *head)
+{
+	ramfs_free_inode(container_of(head, struct ramfs_inode, rcu));
+}
+
+static int ramfs_create(struct directory *dir, const char *name,
+			struct file **file)
+{
+	struct ramfs_inode *inode;
+	size_t len = strlen(name);
+	int ret;
+
+	inode = kmalloc(sizeof(*inode));
+	if (!inode)
+		return -ENOMEM;
+
+	inode->name = kmalloc(len + 1);
+	if (!inode->name) {
+		kfree(inode);
+		return -ENOMEM;
+	}
+
+	memcpy(inode->name, name, len + 1);
+	spinlock_init(&inode->lock);
+	inode->size = 0;
+	inode->pages = NULL;
+	inode->nr_slots = 0;
+
+	ret = create_file(inode->name, &ramfs_file_fops, dir, inode, file);
+	if (ret)
+		ramfs_free_inode(inode);
+
+	return ret;
+}
+
+/* readers found the file under rcu_read_lock(), the pages wait for them */
+static int ramfs_unlink(struct file *file)
+{
+	struct ramfs_inode *inode = file->priv;
+
+	remove_file(file);
+	call_rcu(&inode->rcu, ramfs_free_inode_rcu);
+	return 0;
+}
+
+static struct dir_operations ramfs_dir_ops = {
+	.create = ramfs_create,
+	.unlink = ramfs_unlink,
+};
+
+static int ramfs_mount(struct super_block *sb)
+{
+	sb->root->dops = &ramfs_dir_ops;
+	return 0;
+}
+
+/* the files of the root, ramfs has no subdirectories */
+static void ramfs_kill_sb(struct super_block *sb)
+{
+	struct list_node *node, *next;
+	struct list_node *head = &sb->root->file_list;
+
+	for (node = head->next; node != head; node = next) {
+		next = node->next;
+		ramfs_unlink(container_of(node, struct file, node));
+	}
+}
+
+static struct file_system_type ramfs_type = {
+	.name = "ramfs",
+	.mount = ramfs_mount,
+	.kill_sb = ramfs_kill_sb,
+};
+
+int ramfs_init(void)
+{
+	return register_filesystem(&ramfs_type);
+}
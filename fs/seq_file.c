@@ -0,0 +1,116 @@
+#include <seq_file.h>
+#include <fs.h>
+#include <kmalloc.h>
+#include <stdlib.h>
+#include <error.h>
+#include <kernel.h>
+
+int seq_read(struct file *file, char *buf, size_t len, u32 off)
+{
+	struct seq_file *m = file->priv;
+	u32 pos, skip, copied = 0, n;
+	int ret = 0;
+	void *v;
+
+	spin_lock(&m->lock);
+
+	/* any other offset is found by rendering from the first record */
+	if (off == m->off) {
+		pos = m->index;
+		skip = m->skip;
+	} else {
+		pos = 0;
+		skip = off;
+	}
+
+	v = m->op->start(m, &pos);
+	while (v && copied < len) {
+		m->s->length = 0;
+		m->s->str[0] = 0;
+
+		ret = m->op->show(m, v);
+		if (ret)
+			break;
+
+		if (skip < m->s->length) {
+			n = min(len - copied, m->s->length - skip);
+			memcpy(buf + copied, m->s->str + skip, n);
+			copied += n;
+			skip += n;
+
+			/* @buf is full in the middle of this record */
+			if (skip < m->s->length)
+				break;
+		}
+
+		skip -= m->s->length;
+		v = m->op->next(m, v, &pos);
+	}
+	m->op->stop(m, v);
+
+	if (!ret) {
+		m->off = off + copied;
+		m->index = pos;
+		m->skip = skip;
+	}
+
+	spin_unlock(&m->lock);
+	return ret ? ret : copied;
+}
+
+static struct file_operations seq_file_fops = {
+	.pread = seq_read,
+};
+
+/* the file's priv is the seq_file, @priv is left in m->priv */
+int seq_create_file(const char *name, const struct seq_operations *op,
+		    struct directory *parent, void *priv, struct file **file)
+{
+	struct seq_file *m;
+	int ret;
+
+	m = kmalloc(sizeof(*m));
+	if (!m)
+		return -ENOMEM;
+
+	m->s = ksalloc();
+	if (!m->s) {
+		ret = -ENOMEM;
+		goto err_free_seq;
+	}
+
+	m->op = op;
+	m->priv = priv;
+	m->flags = 0;
+	m->off = m->index = m->skip = 0;
+	spinlock_init(&m->lock);
+
+	ret = create_file(name, &seq_file_fops, parent, m, file);
+	if (ret)
+		goto err_free_string;
+
+	return 0;
+
+err_free_string:
+	ksfree(m->s);
+err_free_seq:
+	kfree(m);
+	return ret;
+}
+
+static void free_seq_file_rcu(struct rcu_head *head)
+{
+	struct seq_file *m = container_of(head, struct seq_file, rcu);
+
+	ksfree(m->s);
+	kfree(m);
+}
+
+int seq_remove_file(struct file *file)
+{
+	struct seq_file *m = file->priv;
+
+	remove_file(file);
+	call_rcu(&m->rcu, free_seq_file_rcu);
+	return 0;
+}
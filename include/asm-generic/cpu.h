@@ -1,5 +1,8 @@
 #pragma once
 
+/* the most cpus brought up, see include/smp.h */
+#define MAX_CPU 8
+
 /* Control Register flags */
 #define CR0_PE 0x00000001 // Protection Enable
 #define CR0_MP 0x00000002 // Monitor coProcessor
@@ -13,6 +16,19 @@
 #define CR0_CD 0x40000000 // Cache Disable
 #define CR0_PG 0x80000000 // Paging
 
+#define CR4_OSFXSR 0x00000200 // fxsave/fxrstor and sse enabled
+#define CR4_OSXMMEXCPT 0x00000400 // unmasked sse exceptions raise #XM
+
+/* cpuid leaf 1 edx */
+#define CPUID_FPU (1 << 0)
+#define CPUID_TSC (1 << 4)
+#define CPUID_CX8 (1 << 8)
+#define CPUID_CMOV (1 << 15)
+#define CPUID_MMX (1 << 23)
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
 /* Eflags register */
 #define FL_IF 0x00000200 // Interrupt Flag
 
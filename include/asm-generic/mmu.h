@@ -1,5 +1,7 @@
 #pragma once
 
+#include <asm-generic/cpu.h>
+
 /* Application segment type bits */
 #define STA_X 0x8 // Executable segment
 #define STA_E 0x4 // Expand down (non-executable segments)
@@ -28,7 +30,8 @@
 #define SEG_UTEXT 3 /* user text segment */
 #define SEG_UDATA 4 /* user data segment */
 #define SEG_TSS   5 /* task segment */
-#define SEG_MAX   6
+#define SEG_PERCPU 6 /* per-cpu area segments, one for each of MAX_CPU */
+#define SEG_MAX   (SEG_PERCPU + MAX_CPU)
 
 /* global descrptor numbers */
 #define GD_KTEXT ((SEG_KTEXT) << 3) /* kernel text */
@@ -36,6 +39,7 @@
 #define GD_UTEXT ((SEG_UTEXT) << 3) /* user text */
 #define GD_UDATA ((SEG_UDATA) << 3) /* user data */
 #define GD_TSS   ((SEG_TSS) << 3)   /* task segment selector */
+#define GD_PERCPU(cpu) ((SEG_PERCPU + (cpu)) << 3) /* %fs of a cpu */
 
 #define DPL_KERNEL (0)
 #define DPL_USER   (3)
@@ -44,6 +48,7 @@
 #define KERNEL_DS ((GD_KDATA) | DPL_KERNEL)
 #define USER_CS   ((GD_UTEXT) | DPL_USER)
 #define USER_DS   ((GD_UDATA) | DPL_USER)
+#define PERCPU_DS(cpu) ((GD_PERCPU(cpu)) | DPL_KERNEL)
 
 /* Normal segment */
 #define SEG_NULLASM                                                            \
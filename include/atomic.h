@@ -1,8 +1,38 @@
 #pragma once
 
 #include <types.h>
+#include <x86.h>
 
-/* Atomic operations that C can't guarantee us. Useful for resource counting etc.. */
+/*
+ * Atomic operations that C can't guarantee us. Useful for resource counting etc..
+ *
+ * every read-modify-write below carries the lock prefix and so is atomic
+ * against the other cpus and a full memory barrier on x86. the _relaxed,
+ * _acquire and _release variants name the ordering a caller relies on,
+ * here they all map to the same fully ordered instruction.
+ */
+#define LOCK_PREFIX "lock; "
+
+/* a single access the compiler may neither tear, merge nor repeat */
+#define READ_ONCE(x) (*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)                                \
+	do {                                              \
+		*(volatile typeof(x) *)&(x) = (val);      \
+	} while (0)
+
+/* plain loads are acquire and plain stores release on x86 */
+#define smp_load_acquire(p)                               \
+	({                                                \
+		typeof(*(p)) __v = READ_ONCE(*(p));       \
+		barrier();                                \
+		__v;                                      \
+	})
+
+#define smp_store_release(p, v)                           \
+	do {                                              \
+		barrier();                                \
+		WRITE_ONCE(*(p), v);                      \
+	} while (0)
 
 typedef struct {
 	volatile int counter;
@@ -62,7 +92,10 @@ static inline void atomic_set(atomic_t *v, int i)
  * */
 static inline void atomic_add(atomic_t *v, int i)
 {
-	asm volatile("addl %1, %0" : "+m"(v->counter) : "ir"(i));
+	asm volatile(LOCK_PREFIX "addl %1, %0"
+		     : "+m"(v->counter)
+		     : "ir"(i)
+		     : "memory");
 }
 
 /* *
@@ -74,7 +107,10 @@ static inline void atomic_add(atomic_t *v, int i)
  * */
 static inline void atomic_sub(atomic_t *v, int i)
 {
-	asm volatile("subl %1, %0" : "+m"(v->counter) : "ir"(i));
+	asm volatile(LOCK_PREFIX "subl %1, %0"
+		     : "+m"(v->counter)
+		     : "ir"(i)
+		     : "memory");
 }
 
 /* *
@@ -88,7 +124,7 @@ static inline void atomic_sub(atomic_t *v, int i)
 static inline bool atomic_sub_test_zero(atomic_t *v, int i)
 {
 	unsigned char c;
-	asm volatile("subl %2, %0; sete %1"
+	asm volatile(LOCK_PREFIX "subl %2, %0; sete %1"
 		     : "+m"(v->counter), "=qm"(c)
 		     : "ir"(i)
 		     : "memory");
@@ -103,7 +139,7 @@ static inline bool atomic_sub_test_zero(atomic_t *v, int i)
  * */
 static inline void atomic_inc(atomic_t *v)
 {
-	asm volatile("incl %0" : "+m"(v->counter));
+	asm volatile(LOCK_PREFIX "incl %0" : "+m"(v->counter) : : "memory");
 }
 
 /* *
@@ -114,7 +150,7 @@ static inline void atomic_inc(atomic_t *v)
  * */
 static inline void atomic_dec(atomic_t *v)
 {
-	asm volatile("decl %0" : "+m"(v->counter));
+	asm volatile(LOCK_PREFIX "decl %0" : "+m"(v->counter) : : "memory");
 }
 
 /* *
@@ -127,7 +163,8 @@ static inline void atomic_dec(atomic_t *v)
 static inline bool atomic_inc_test_zero(atomic_t *v)
 {
 	unsigned char c;
-	asm volatile("incl %0; sete %1" : "+m"(v->counter), "=qm"(c)::"memory");
+	asm volatile(LOCK_PREFIX "incl %0; sete %1"
+		     : "+m"(v->counter), "=qm"(c)::"memory");
 	return c != 0;
 }
 
@@ -141,7 +178,8 @@ static inline bool atomic_inc_test_zero(atomic_t *v)
 static inline bool atomic_dec_test_zero(atomic_t *v)
 {
 	unsigned char c;
-	asm volatile("decl %0; sete %1" : "+m"(v->counter), "=qm"(c)::"memory");
+	asm volatile(LOCK_PREFIX "decl %0; sete %1"
+		     : "+m"(v->counter), "=qm"(c)::"memory");
 	return c != 0;
 }
 
@@ -156,7 +194,8 @@ static inline bool atomic_dec_test_zero(atomic_t *v)
 static inline int atomic_add_return(atomic_t *v, int i)
 {
 	int __i = i;
-	asm volatile("xaddl %0, %1" : "+r"(i), "+m"(v->counter)::"memory");
+	asm volatile(LOCK_PREFIX "xaddl %0, %1"
+		     : "+r"(i), "+m"(v->counter)::"memory");
 	return i + __i;
 }
 
@@ -172,6 +211,131 @@ static inline int atomic_sub_return(atomic_t *v, int i)
 	return atomic_add_return(v, -i);
 }
 
+static inline int atomic_inc_return(atomic_t *v)
+{
+	return atomic_add_return(v, 1);
+}
+
+static inline int atomic_dec_return(atomic_t *v)
+{
+	return atomic_add_return(v, -1);
+}
+
+/* *
+ * xadd - add @inc to the int at @ptr and return the old value
+ * xchg - store @val to the int or pointer at @ptr and return the old value
+ *
+ * xchg with a memory operand is locked without the prefix.
+ * */
+static inline int __xadd(volatile int *ptr, int inc)
+{
+	asm volatile(LOCK_PREFIX "xaddl %0, %1"
+		     : "+r"(inc), "+m"(*ptr)
+		     :
+		     : "memory");
+	return inc;
+}
+
+#define xadd(ptr, inc) __xadd((volatile int *)(ptr), inc)
+
+static inline int __xchg(volatile int *ptr, int val)
+{
+	asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+	return val;
+}
+
+#define xchg(ptr, val) \
+	({ (typeof(*(ptr)))__xchg((volatile int *)(ptr), (int)(val)); })
+
+/* *
+ * atomic_fetch_add - add integer and return the old value
+ * @v:  pointer of type atomic_t
+ * @i:  integer value to add
+ * */
+static inline int atomic_fetch_add(atomic_t *v, int i)
+{
+	return xadd(&v->counter, i);
+}
+
+static inline int atomic_fetch_sub(atomic_t *v, int i)
+{
+	return xadd(&v->counter, -i);
+}
+
+/* *
+ * atomic_xchg - set atomic variable and return the old value
+ * @v:  pointer of type atomic_t
+ * @i:  required value
+ * */
+static inline int atomic_xchg(atomic_t *v, int i)
+{
+	return xchg(&v->counter, i);
+}
+
+/* *
+ * atomic_cmpxchg - set @v to @new if it is @old
+ * @v:  pointer of type atomic_t
+ *
+ * returns the value @v had before, the exchange happened if that is @old.
+ * */
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	return __cmpxchg(&v->counter, old, new);
+}
+
+/* *
+ * atomic_try_cmpxchg - atomic_cmpxchg() for retry loops
+ * @v:   pointer of type atomic_t
+ * @old: the expected value, updated to the current one on failure
+ *
+ *	old = atomic_read(v);
+ *	do {
+ *		new = f(old);
+ *	} while (!atomic_try_cmpxchg(v, &old, new));
+ * */
+static inline bool atomic_try_cmpxchg(atomic_t *v, int *old, int new)
+{
+	int ret = __cmpxchg(&v->counter, *old, new);
+
+	if (ret == *old)
+		return true;
+
+	*old = ret;
+	return false;
+}
+
+/* *
+ * atomic_read_acquire - later accesses are not moved before this read
+ * atomic_set_release - earlier accesses are not moved after this write
+ * */
+static inline int atomic_read_acquire(const atomic_t *v)
+{
+	return smp_load_acquire(&v->counter);
+}
+
+static inline void atomic_set_release(atomic_t *v, int i)
+{
+	smp_store_release(&v->counter, i);
+}
+
+#define atomic_add_return_relaxed atomic_add_return
+#define atomic_add_return_acquire atomic_add_return
+#define atomic_add_return_release atomic_add_return
+#define atomic_fetch_add_relaxed atomic_fetch_add
+#define atomic_fetch_add_acquire atomic_fetch_add
+#define atomic_fetch_add_release atomic_fetch_add
+#define atomic_fetch_sub_relaxed atomic_fetch_sub
+#define atomic_fetch_sub_acquire atomic_fetch_sub
+#define atomic_fetch_sub_release atomic_fetch_sub
+#define atomic_xchg_relaxed atomic_xchg
+#define atomic_xchg_acquire atomic_xchg
+#define atomic_xchg_release atomic_xchg
+#define atomic_cmpxchg_relaxed atomic_cmpxchg
+#define atomic_cmpxchg_acquire atomic_cmpxchg
+#define atomic_cmpxchg_release atomic_cmpxchg
+#define atomic_read_relaxed atomic_read
+#define atomic_set_relaxed atomic_set
+
 static inline void set_bit(int nr, volatile void *addr)
 	__attribute__((always_inline));
 static inline void clear_bit(int nr, volatile void *addr)
@@ -197,7 +361,10 @@ static inline bool test_bit(int nr, volatile void *addr)
  * */
 static inline void set_bit(int nr, volatile void *addr)
 {
-	asm volatile("btsl %1, %0" : "=m"(*(volatile long *)addr) : "Ir"(nr));
+	asm volatile(LOCK_PREFIX "btsl %1, %0"
+		     : "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
 }
 
 /* *
@@ -207,7 +374,10 @@ static inline void set_bit(int nr, volatile void *addr)
  * */
 static inline void clear_bit(int nr, volatile void *addr)
 {
-	asm volatile("btrl %1, %0" : "=m"(*(volatile long *)addr) : "Ir"(nr));
+	asm volatile(LOCK_PREFIX "btrl %1, %0"
+		     : "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
 }
 
 /* *
@@ -217,7 +387,10 @@ static inline void clear_bit(int nr, volatile void *addr)
  * */
 static inline void change_bit(int nr, volatile void *addr)
 {
-	asm volatile("btcl %1, %0" : "=m"(*(volatile long *)addr) : "Ir"(nr));
+	asm volatile(LOCK_PREFIX "btcl %1, %0"
+		     : "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
 }
 
 /* *
@@ -228,7 +401,7 @@ static inline void change_bit(int nr, volatile void *addr)
 static inline bool test_and_set_bit(int nr, volatile void *addr)
 {
 	int oldbit;
-	asm volatile("btsl %2, %1; sbbl %0, %0"
+	asm volatile(LOCK_PREFIX "btsl %2, %1; sbbl %0, %0"
 		     : "=r"(oldbit), "=m"(*(volatile long *)addr)
 		     : "Ir"(nr)
 		     : "memory");
@@ -243,7 +416,7 @@ static inline bool test_and_set_bit(int nr, volatile void *addr)
 static inline bool test_and_clear_bit(int nr, volatile void *addr)
 {
 	int oldbit;
-	asm volatile("btrl %2, %1; sbbl %0, %0"
+	asm volatile(LOCK_PREFIX "btrl %2, %1; sbbl %0, %0"
 		     : "=r"(oldbit), "=m"(*(volatile long *)addr)
 		     : "Ir"(nr)
 		     : "memory");
@@ -258,7 +431,7 @@ static inline bool test_and_clear_bit(int nr, volatile void *addr)
 static inline bool test_and_change_bit(int nr, volatile void *addr)
 {
 	int oldbit;
-	asm volatile("btcl %2, %1; sbbl %0, %0"
+	asm volatile(LOCK_PREFIX "btcl %2, %1; sbbl %0, %0"
 		     : "=r"(oldbit), "=m"(*(volatile long *)addr)
 		     : "Ir"(nr)
 		     : "memory");
@@ -279,6 +452,38 @@ static inline bool test_bit(int nr, volatile void *addr)
 	return oldbit != 0;
 }
 
+/* *
+ * __set_bit, __clear_bit, __test_and_set_bit - non atomic versions
+ *
+ * for bitmaps only ever changed by one cpu, e.g. per-cpu ones. a single
+ * instruction each, so still safe against irqs on that cpu.
+ * */
+static inline void __set_bit(int nr, volatile void *addr)
+{
+	asm volatile("btsl %1, %0"
+		     : "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
+}
+
+static inline void __clear_bit(int nr, volatile void *addr)
+{
+	asm volatile("btrl %1, %0"
+		     : "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
+}
+
+static inline bool __test_and_set_bit(int nr, volatile void *addr)
+{
+	int oldbit;
+	asm volatile("btsl %2, %1; sbbl %0, %0"
+		     : "=r"(oldbit), "+m"(*(volatile long *)addr)
+		     : "Ir"(nr)
+		     : "memory");
+	return oldbit != 0;
+}
+
 static inline int __cmpxchg(volatile int *ptr, int old, int new)
 {
 	int ret;
@@ -290,3 +495,92 @@ static inline int __cmpxchg(volatile int *ptr, int old, int new)
 }
 
 #define cmpxchg(ptr, old, new) __cmpxchg((volatile int *)ptr, old, new)
+
+/*
+ * atomic64_t - every access goes through cmpxchg8b, a plain 64 bit load
+ * or store is two instructions on i386 and may tear
+ */
+typedef struct {
+	volatile u64 counter;
+} __attribute__((aligned(8))) atomic64_t;
+
+static inline u64 __cmpxchg64(volatile u64 *ptr, u64 old, u64 new)
+{
+	u64 prev;
+	asm volatile(LOCK_PREFIX "cmpxchg8b %1"
+		     : "=A"(prev), "+m"(*ptr)
+		     : "b"((u32)new), "c"((u32)(new >> 32)), "0"(old)
+		     : "memory");
+	return prev;
+}
+
+#define cmpxchg64(ptr, old, new) __cmpxchg64((volatile u64 *)(ptr), old, new)
+
+/* a failing compare returns the current value without changing it */
+static inline u64 atomic64_read(const atomic64_t *v)
+{
+	return __cmpxchg64((volatile u64 *)&v->counter, 0, 0);
+}
+
+static inline u64 atomic64_cmpxchg(atomic64_t *v, u64 old, u64 new)
+{
+	return __cmpxchg64(&v->counter, old, new);
+}
+
+static inline u64 atomic64_xchg(atomic64_t *v, u64 new)
+{
+	u64 old = v->counter, prev;
+
+	while ((prev = __cmpxchg64(&v->counter, old, new)) != old)
+		old = prev;
+
+	return old;
+}
+
+static inline void atomic64_set(atomic64_t *v, u64 i)
+{
+	atomic64_xchg(v, i);
+}
+
+static inline u64 atomic64_fetch_add(atomic64_t *v, s64 i)
+{
+	u64 old = v->counter, prev;
+
+	while ((prev = __cmpxchg64(&v->counter, old, old + i)) != old)
+		old = prev;
+
+	return old;
+}
+
+static inline u64 atomic64_add_return(atomic64_t *v, s64 i)
+{
+	return atomic64_fetch_add(v, i) + i;
+}
+
+static inline void atomic64_add(atomic64_t *v, s64 i)
+{
+	atomic64_fetch_add(v, i);
+}
+
+static inline void atomic64_sub(atomic64_t *v, s64 i)
+{
+	atomic64_fetch_add(v, -i);
+}
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+	atomic64_fetch_add(v, 1);
+}
+
+static inline void atomic64_dec(atomic64_t *v)
+{
+	atomic64_fetch_add(v, -1);
+}
+
+#define atomic64_read_relaxed atomic64_read
+#define atomic64_fetch_add_relaxed atomic64_fetch_add
+#define atomic64_fetch_add_acquire atomic64_fetch_add
+#define atomic64_fetch_add_release atomic64_fetch_add
+#define atomic64_cmpxchg_relaxed atomic64_cmpxchg
+#define atomic64_cmpxchg_acquire atomic64_cmpxchg
+#define atomic64_cmpxchg_release atomic64_cmpxchg
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <types.h>
+#include <list.h>
+
+/*
+ * block devices and the buffer cache
+ *
+ * a buffer holds one BLOCK_SIZE block of a device in a page, found by
+ * (device, block) in a hash table. buffers nobody holds sit on an lru
+ * list and the least recently used is reused once NR_BUFFERS exist,
+ * written back first if dirty.
+ *
+ * reads and writebacks queue requests on the device; a block next to
+ * either end of a queued request in the same direction is merged into
+ * it, so the driver moves runs of blocks with a single command. bread()
+ * of the block after the previous one reads ahead a window that doubles
+ * up to BLOCK_RA_MAX blocks while the access stays sequential.
+ *
+ * the cache, the queues and the transfers are serialised by one mutex,
+ * so buffers are only used from threads.
+ */
+#define SECTOR_SIZE 512
+#define BLOCK_SIZE 4096
+#define BLOCK_SECTORS (BLOCK_SIZE / SECTOR_SIZE)
+
+#define NR_BUFFERS 1024
+#define BLOCK_RA_MIN 4
+#define BLOCK_RA_MAX 32
+/* blocks one request may grow to, what a driver must accept */
+#define BLOCK_REQ_MAX 32
+
+#define BH_UPTODATE (1 << 0)
+#define BH_DIRTY (1 << 1)
+
+struct block_device;
+
+struct buffer_head {
+	struct block_device *bdev;
+	u32 block;
+	u32 flags;
+	int count;
+	void *data;
+	struct page *page;
+
+	struct list_node hash_node;
+	/* on the lru list while count is 0 */
+	struct list_node lru_node;
+	/* in the queued request, until it is done */
+	struct list_node req_node;
+};
+
+/* blocks [block, block + nr) in order on bh_list */
+struct request {
+	bool write;
+	u32 block;
+	u32 nr;
+	struct list_node bh_list;
+	struct list_node node;
+};
+
+struct block_device_operations {
+	/* move the blocks of @req, may sleep, 0 or a negative errno */
+	int (*transfer)(struct block_device *bdev, struct request *req);
+};
+
+struct block_stat {
+	u32 hits;
+	u32 misses;
+	u32 readahead;
+	u32 requests;
+	u32 merged;
+	u32 read_blocks;
+	u32 write_blocks;
+	u64 read_ns;
+	u64 write_ns;
+};
+
+struct block_device {
+	const char *name;
+	/* in BLOCK_SIZE blocks */
+	u32 nr_blocks;
+	const struct block_device_operations *ops;
+	void *priv;
+
+	/* requests not yet given to the driver */
+	struct list_node queue;
+
+	/* the block after the last bread() and the readahead window */
+	u32 next_block;
+	u32 ra_window;
+
+	struct block_stat stat;
+	struct list_node node;
+};
+
+int register_block_device(struct block_device *bdev);
+struct block_device *find_block_device(const char *name);
+
+struct buffer_head *bread(struct block_device *bdev, u32 block);
+struct buffer_head *bget(struct block_device *bdev, u32 block);
+void brelse(struct buffer_head *bh);
+void mark_buffer_dirty(struct buffer_head *bh);
+
+int sync_blockdev(struct block_device *bdev);
+int invalidate_blockdev(struct block_device *bdev);
+int sync_all_blockdevs(void);
+
+int block_init_late(void);
+int ata_init_late(void);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <wait.h>
+
+/* completion - wait for an event to happen, e.g. another cpu coming up */
+struct completion {
+	u32 done;
+	struct wait_queue_head wait;
+};
+
+void init_completion(struct completion *x);
+void complete(struct completion *x);
+void complete_all(struct completion *x);
+bool try_wait_for_completion(struct completion *x);
+void wait_for_completion(struct completion *x);
+long wait_for_completion_timeout(struct completion *x, long timeout);
@@ -3,35 +3,93 @@
 #include <types.h>
 #include <stdio.h>
 #include <string.h>
+#include <printk.h>
+
+/*
+ * pr_* above LOG_LEVEL_MAX compile to nothing. every other call site puts
+ * a struct log_site in .data.log_sites and evaluates its arguments, the
+ * dec() and hex() among them, only while its level is at or below the
+ * level of its module. a module starts at LOG_INFO, or at LOG_DEBUG with
+ * MODULE_DEBUG or DEBUG_ENABLE_ALL. /sys/loglevel reads the levels and
+ * takes "<module> <level>" or "all <level>".
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_DEBUG
+#endif
 
-#define DEBUG_ENABLE
 #define DEBUG_ENABLE_ALL 0
 
-#define pr_info(...) printk_debug(MODULE, "info ", __VA_ARGS__, "\n")
-#define pr_err(...) printk_debug(MODULE, "error", __VA_ARGS__, "\n")
+#define LOG_SITE_SECTION ".data.log_sites"
+
+struct log_site {
+	const char *module;
+	u8 level;
+	/* changed at run time for all the sites of the module */
+	u8 module_level;
+	u16 pad;
+};
+
+extern struct log_site __log_sites_start[], __log_sites_end[];
+
+#define LOG_MODULE_LEVEL \
+	((DEBUG_ENABLE_ALL || MODULE_DEBUG) ? LOG_DEBUG : LOG_INFO)
+
+static inline bool log_site_enabled(struct log_site *site)
+{
+	return site->level <= *(volatile u8 *)&site->module_level;
+}
+
+#define __pr_log(_level, ...)                                              \
+	do {                                                               \
+		static struct log_site __log_site                          \
+			__attribute__((section(LOG_SITE_SECTION), used,    \
+				       aligned(4))) = {                    \
+				.module = MODULE,                          \
+				.level = _level,                           \
+				.module_level = LOG_MODULE_LEVEL,          \
+			};                                                 \
+		if (log_site_enabled(&__log_site))                         \
+			printk_debug(MODULE, _level, __VA_ARGS__, "\n");   \
+	} while (0)
 
-#ifdef DEBUG_ENABLE
-#define pr_debug(...)                                                     \
-	do {                                                              \
-		if (DEBUG_ENABLE_ALL || MODULE_DEBUG) {                   \
-			printk_debug(MODULE, "debug", __VA_ARGS__, "\n"); \
-		}                                                         \
+/* type checked, then dropped by the compiler */
+#define __pr_none(_level, ...)                                             \
+	do {                                                               \
+		if (0)                                                     \
+			printk_debug(MODULE, _level, __VA_ARGS__, "\n");   \
 	} while (0)
+
+#if LOG_LEVEL_MAX >= LOG_ERR
+#define pr_err(...) __pr_log(LOG_ERR, __VA_ARGS__)
+#else
+#define pr_err(...) __pr_none(LOG_ERR, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_INFO
+#define pr_info(...) __pr_log(LOG_INFO, __VA_ARGS__)
+#else
+#define pr_info(...) __pr_none(LOG_INFO, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_DEBUG
+#define pr_debug(...) __pr_log(LOG_DEBUG, __VA_ARGS__)
 #else
-#define pr_debug(...)
+#define pr_debug(...) __pr_none(LOG_DEBUG, __VA_ARGS__)
 #endif
 
 void dump_stack(void);
 void dump_trapstack(uint32_t ebp, uint32_t eip);
-void dmesg(void);
 void debug_init(void);
+int debug_init_late(void);
 
 #define BUG_ON(_expr, ...)                                              \
 	do {                                                            \
 		if (!(_expr)) {                                         \
-			pr_err("bug on ", __FILE__, ":", __LINE__, ":", \
-			       ##__VA_ARGS__);                          \
+			printk_debug(MODULE, LOG_CRIT, "bug on ",       \
+				     __FILE__, ":", dec(__LINE__), ":", \
+				     ##__VA_ARGS__, "\n");              \
 			dump_stack();                                   \
+			console_flush();                                \
 			halt();                                         \
 		}                                                       \
 	} while (0)
@@ -39,8 +97,9 @@ void debug_init(void);
 #define WARN_ON(_expr, ...)                                                 \
 	do {                                                                \
 		if ((_expr)) {                                              \
-			pr_err("warning on ", __FILE__, ":", __LINE__, ":", \
-			       ##__VA_ARGS__);                              \
+			printk_debug(MODULE, LOG_WARNING, "warning on ",    \
+				     __FILE__, ":", dec(__LINE__), ":",     \
+				     ##__VA_ARGS__, "\n");                  \
 			dump_stack();                                       \
 		}                                                           \
 	} while (0)
@@ -1,7 +1,13 @@
 #pragma once
 
 #define ENOENT 2
+#define EIO 5
 #define ENOMEM 12
+#define EBUSY 16
+#define EEXIST 17
 #define ENODEV 19
+#define ENOTDIR 20
 #define EINVAL 22
+#define EFBIG 27
 #define ENOSPC 28
+#define ETIMEDOUT 110
@@ -17,3 +17,76 @@ int fifo_out(struct fifo *fifo, void *data, unsigned int size);
 int fifo_out_peek(struct fifo *fifo, void *data, unsigned int size);
 int fifo_skip(struct fifo *fifo, unsigned int size);
 
+
+/*
+ * lock-free rings of fixed size elements
+ *
+ * the slot count is a power of two and head/tail are free running
+ * counters masked on access, so every slot is usable and wrapping costs
+ * no division. each side's index lives on its own cache line.
+ *
+ * spsc_ring: one producer and one consumer, no locked instruction at all
+ * mpmc_ring: any number of both, slots are claimed with cmpxchg on head
+ *            and published in claim order through tail
+ *
+ * _bulk moves all @n elements or none, _burst as many as possible; both
+ * return the number moved. reserve/commit and peek/consume hand out
+ * contiguous slots in place, which may be fewer than asked for at the
+ * end of the ring. not to be used from irqs on a cpu which may hold a
+ * claim on the same mpmc ring.
+ */
+#define RING_CACHE_LINE 64
+#define __ring_aligned __attribute__((aligned(RING_CACHE_LINE)))
+
+struct spsc_ring {
+	/* written by the producer */
+	volatile u32 head __ring_aligned;
+	/* the producer's last view of tail, spares the consumer's line */
+	u32 tail_cache;
+
+	/* written by the consumer */
+	volatile u32 tail __ring_aligned;
+	u32 head_cache;
+
+	u32 mask __ring_aligned;
+	u32 esize;
+	void *data;
+};
+
+struct ring_headtail {
+	/* slots claimed by this side */
+	volatile u32 head;
+	/* slots this side is done with, visible to the other side */
+	volatile u32 tail;
+};
+
+struct mpmc_ring {
+	struct ring_headtail prod __ring_aligned;
+	struct ring_headtail cons __ring_aligned;
+
+	u32 mask __ring_aligned;
+	u32 esize;
+	void *data;
+};
+
+/* @count slots, a power of two, of @esize bytes, a multiple of 4 */
+int spsc_ring_init(struct spsc_ring *r, void *data, u32 count, u32 esize);
+u32 spsc_ring_enqueue_bulk(struct spsc_ring *r, const void *objs, u32 n);
+u32 spsc_ring_enqueue_burst(struct spsc_ring *r, const void *objs, u32 n);
+u32 spsc_ring_dequeue_bulk(struct spsc_ring *r, void *objs, u32 n);
+u32 spsc_ring_dequeue_burst(struct spsc_ring *r, void *objs, u32 n);
+void *spsc_ring_reserve(struct spsc_ring *r, u32 *n);
+void spsc_ring_commit(struct spsc_ring *r, u32 n);
+void *spsc_ring_peek(struct spsc_ring *r, u32 *n);
+void spsc_ring_consume(struct spsc_ring *r, u32 n);
+
+int mpmc_ring_init(struct mpmc_ring *r, void *data, u32 count, u32 esize);
+u32 mpmc_ring_enqueue_bulk(struct mpmc_ring *r, const void *objs, u32 n);
+u32 mpmc_ring_enqueue_burst(struct mpmc_ring *r, const void *objs, u32 n);
+u32 mpmc_ring_dequeue_bulk(struct mpmc_ring *r, void *objs, u32 n);
+u32 mpmc_ring_dequeue_burst(struct mpmc_ring *r, void *objs, u32 n);
+/* @pos identifies the claim, pass it back to commit or consume */
+void *mpmc_ring_reserve(struct mpmc_ring *r, u32 *n, u32 *pos);
+void mpmc_ring_commit(struct mpmc_ring *r, u32 pos, u32 n);
+void *mpmc_ring_peek(struct mpmc_ring *r, u32 *n, u32 *pos);
+void mpmc_ring_consume(struct mpmc_ring *r, u32 pos, u32 n);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <types.h>
+#include <percpu.h>
+#include <asm-generic/cpu.h>
+#include <register.h>
+
+/*
+ * lazy fpu/sse switching
+ *
+ * the fpu registers of a cpu hold the state of at most one thread, its
+ * fpu_owner. schedule() sets CR0.TS when switching to any other thread,
+ * so its first fpu or sse instruction traps with #NM; the trap saves the
+ * owner's registers with fxsave and loads the ones of the new thread.
+ * threads that never use the fpu never pay for it.
+ *
+ * kernel code uses sse only between kernel_fpu_begin() and
+ * kernel_fpu_end(), which must not sleep. from irq context check
+ * irq_fpu_usable() first, the interrupted code may be in such a region.
+ */
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGN 16
+
+struct thread;
+
+struct fpu {
+	/* fxsave area, FPU_STATE_ALIGN aligned inside buf */
+	u8 *state;
+	void *buf;
+};
+
+DECLARE_PER_CPU(struct thread *, fpu_owner);
+DECLARE_PER_CPU(bool, in_kernel_fpu);
+
+extern bool fpu_has_sse;
+
+static inline void clts(void)
+{
+	asm volatile("clts");
+}
+
+static inline void stts(void)
+{
+	lcr0(rcr0() | CR0_TS);
+}
+
+static inline bool irq_fpu_usable(void)
+{
+	return fpu_has_sse && !this_cpu_read(in_kernel_fpu);
+}
+
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+int fpu_alloc(struct fpu *fpu);
+void fpu_free(struct fpu *fpu);
+void fpu_switch(struct thread *next);
+void fpu_release(struct thread *t);
+
+int fpu_init(int cpu);
+int fpu_init_late(void);
@@ -4,38 +4,103 @@
 #include <list.h>
 #include <string.h>
 #include <vector.h>
+#include <lock.h>
+#include <rcu.h>
 
 struct file;
+struct directory;
+struct super_block;
 
+/*
+ * pread copies up to @len bytes at @off into @buf and returns how many,
+ * 0 at the end of the file. read renders the whole file into @s instead,
+ * vfs_read() serves it in pieces for files without pread, rendering it
+ * once for a reader going front to back. pwrite returns how many bytes
+ * it wrote, truncate sets the size.
+ */
 struct file_operations {
+	int (*pread)(struct file *file, char *buf, size_t len, u32 off);
 	int (*read)(struct file *file, string *s);
-	void (*write)(struct file *file, string *s);
+	int (*pwrite)(struct file *file, const char *buf, size_t len, u32 off);
+	int (*truncate)(struct file *file, u32 size);
 	int (*exec)(struct file *file, vector *vec);
 };
 
+/*
+ * what a file system does for its directories, NULL for what it does not.
+ * create and unlink make and remove regular files. lookup is asked on a
+ * name cache miss and may instantiate the entry @name, @len bytes long and
+ * not terminated, returning 0 if it exists now; populate instantiates
+ * every entry before the directory is listed. both run under
+ * rcu_read_lock() and may race with themselves, the file system checks
+ * for an entry again under its own lock before creating it.
+ */
+struct dir_operations {
+	int (*create)(struct directory *dir, const char *name,
+		      struct file **file);
+	int (*unlink)(struct file *file);
+	int (*lookup)(struct directory *dir, const char *name, size_t len);
+	int (*populate)(struct directory *dir);
+};
+
+/*
+ * mount sets up a super block whose root is the empty mount point,
+ * kill_sb drops whatever the file system keeps below it before unmount
+ */
+struct file_system_type {
+	const char *name;
+	int (*mount)(struct super_block *sb);
+	void (*kill_sb)(struct super_block *sb);
+	struct list_node node;
+};
+
+struct super_block {
+	struct file_system_type *type;
+	struct directory *root;
+	void *priv;
+};
+
 struct file {
 	const char *name;
 	void *priv;
 
 	struct directory *parent;
 	struct list_node node;
+	/* in the name cache, hashed on parent and name */
+	struct list_node hash_node;
+	u32 hash;
 	struct file_operations *fops;
+
+	/* what fops->read rendered, until the read at its end */
+	spinlock_t read_lock;
+	string *read_cache;
+	u32 read_off;
+
+	struct rcu_head rcu;
 };
 
 struct directory {
 	const char *name;
 	struct directory *parent;
+	/* of the mount it is in, NULL in the root file system */
+	struct super_block *sb;
+	struct dir_operations *dops;
 
 	struct list_node node;
+	struct list_node hash_node;
+	u32 hash;
 	struct list_node file_list;
 	struct list_node dir_list;
+	struct rcu_head rcu;
 };
 
 extern struct directory *root;
 extern struct directory *bin;
 extern struct directory *proc;
 extern struct directory *sys;
+extern struct directory *tmp;
 extern struct directory *current_dir;
+extern spinlock_t fs_lock;
 
 int fs_init(void);
 
@@ -47,15 +112,32 @@ int create_directory(const char *name, struct directory *parent,
 		     struct directory **dir);
 int remove_directory(struct directory *dir);
 
+int vfs_read(struct file *file, char *buf, size_t len, u32 off);
+int vfs_write(struct file *file, const char *buf, size_t len, u32 off);
+int vfs_truncate(struct file *file, u32 size);
+int vfs_create(struct directory *dir, const char *name, struct file **file);
+int vfs_unlink(struct file *file);
+
 struct file *dir_find_file(struct directory *dir, const char *name);
 struct directory *dir_find_dir(struct directory *dir, const char *name);
+bool dir_is_below(struct directory *dir, struct directory *top);
+
+int path_lookup(const char *path, struct directory *cwd,
+		struct directory **dir, struct file **file);
+int path_lookup_parent(const char *path, struct directory *cwd,
+		       struct directory **dir, const char **name);
+int vfs_populate(struct directory *dir);
+
+int register_filesystem(struct file_system_type *fs);
+int vfs_mount(const char *type, const char *path, struct directory **mnt);
+int vfs_umount(const char *path);
 
 struct file *binfs_find_file(const char *name);
 int binfs_create_file(const char *name, struct file_operations *fops,
 		      void *priv, struct file **file);
 int binfs_remove_file(const char *name);
 
-int procfs_create_dir(const char *name, struct directory **dir);
-int procfs_remove_dir(const char *name);
+int procfs_init(void);
+int ramfs_init(void);
 
 #endif /* __FS_H__ */
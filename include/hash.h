@@ -0,0 +1,24 @@
+#pragma once
+
+#include <types.h>
+
+#define GOLDEN_RATIO_32 0x61C88647
+
+/* the top @bits of a multiplicative hash, to index a table of 1 << @bits */
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+/* fnv-1a over the first @len bytes of @name */
+static inline u32 name_hash(const char *name, size_t len)
+{
+	u32 hash = 2166136261u;
+
+	while (len--) {
+		hash ^= (u8)*name++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
@@ -3,13 +3,17 @@
 #include <asm-generic/cpu.h>
 #include <x86.h>
 #include <types.h>
+#include <register.h>
 
 /* hardware irq */
 #define PIC_TIMER 0
 #define PIC_KEYBD 1
 #define PIC_SLAVE 2
 #define PIC_COM1 4
+#define PIC_IDE0 14
+#define PIC_IDE1 15
 
+#define IRQ_NM 7
 #define IRQ_GP 13
 #define IRQ_PGFLT 14
 #define IRQ_ERROR 19
@@ -18,6 +22,9 @@
 #define IRQ_TIMER (IRQ_OFFSET + PIC_TIMER)
 #define IRQ_KEYBD (IRQ_OFFSET + PIC_KEYBD)
 #define IRQ_COM1 (IRQ_OFFSET + PIC_COM1)
+#define IRQ_IDE0 (IRQ_OFFSET + PIC_IDE0)
+#define IRQ_IDE1 (IRQ_OFFSET + PIC_IDE1)
+#define IRQ_RESCHED 64
 #define IRQ_NUM 256
 
 struct trapframe {
@@ -58,12 +65,16 @@ int request_irq(u16 irq, irq_handler_t fn);
 void idt_init(void);
 
 void irq_init(void);
+int irq_init_late(void);
 void pic_init(bool enable);
 void pic_enable(unsigned int irq);
 
 void timer_init(void);
+void pit_wait(u32 ms);
 #define TICK_NUM 100
 
+u32 irq_count(int cpu);
+
 static inline void intr_enable(void)
 {
 	sti();
@@ -74,14 +85,41 @@ static inline void intr_disable(void)
 	cli();
 }
 
+/* disable interrupts, return the eflags to restore */
+static inline u32 intr_save(void)
+{
+	u32 flags = read_eflags();
+
+	cli();
+	return flags;
+}
+
+static inline void intr_restore(u32 flags)
+{
+	write_eflags(flags);
+}
+
+static inline bool irqs_disabled(void)
+{
+	return !(read_eflags() & FL_IF);
+}
+
+void irq_enter(void);
+void irq_exit(void);
+
 struct rtc_date;
 
 void ioapic_init(void);
 void ioapic_enable(int irq, int cpu);
 
 extern volatile int *lapic;
+extern u32 lapic_timer_per_tick;
 void lapic_init(void);
 int lapic_id(void);
 void lapic_eoi(void);
+void lapic_timer_periodic(void);
+void lapic_timer_oneshot(u32 count);
+u32 lapic_timer_remaining(void);
+void lapic_send_ipi(u8 apic_id, u32 vector);
 void lapic_startap(u8 apic_id, u32 addr);
 void cmos_time(struct rtc_date *r);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <types.h>
+#include <x86.h>
+
+#define NSEC_PER_USEC 1000UL
+#define NSEC_PER_MSEC 1000000UL
+#define NSEC_PER_SEC 1000000000UL
+#define USEC_PER_SEC 1000000UL
+
+/*
+ * clocksource - a free running counter, cycles are converted to
+ * nanoseconds by (cycles * mult) >> shift
+ */
+struct clocksource {
+	const char *name;
+	u64 (*read)(void);
+	u32 mult;
+	u32 shift;
+	u32 khz;
+	/* counter value at boot, ktime_ns() starts from 0 */
+	u64 base;
+};
+
+extern struct clocksource *clock;
+
+u64 ktime_ns(void);
+
+static inline u64 ktime_to_us(u64 ns)
+{
+	do_div(ns, NSEC_PER_USEC);
+	return ns;
+}
+
+static inline u64 ktime_us(void)
+{
+	return ktime_to_us(ktime_ns());
+}
+
+static inline u64 ktime_ms(void)
+{
+	u64 ns = ktime_ns();
+
+	do_div(ns, NSEC_PER_MSEC);
+	return ns;
+}
+
+void clocksource_init(void);
+int tsc_sync_master(void);
+void tsc_sync_slave(void);
@@ -2,6 +2,7 @@
 #define __LIST_H__
 
 #include <types.h>
+#include <x86.h>
 
 struct list_node {
 	struct list_node *prev;
@@ -45,6 +46,21 @@ static inline void list_remove(struct list_node *node)
 	node->next->prev = node->prev;
 }
 
+/* move all nodes of @list to the tail of @head, @list is empty after that */
+static inline void list_splice_tail_init(struct list_node *list,
+					 struct list_node *head)
+{
+	if (list->next == list)
+		return;
+
+	list->next->prev = head->prev;
+	head->prev->next = list->next;
+	list->prev->next = head;
+	head->prev = list->prev;
+
+	list_init(list);
+}
+
 static inline bool list_empty(struct list_node *head)
 {
 	return head->next == head;
@@ -60,6 +76,45 @@ static inline struct list_node *list_tail(struct list_node *head)
 	return head->prev;
 }
 
+/*
+ * rcu variants, writers still serialise among themselves while readers
+ * walk the list under rcu_read_lock() only. a node is fully initialized
+ * before it is published and keeps its next pointer when removed, so a
+ * reader standing on it finds its way back to the head.
+ */
+static inline void list_insert_rcu(struct list_node *cur, struct list_node *node)
+{
+	node->next = cur->next;
+	node->prev = cur;
+	barrier();
+	cur->next->prev = node;
+	cur->next = node;
+}
+
+static inline void list_insert_tail_rcu(struct list_node *head,
+					struct list_node *node)
+{
+	list_insert_rcu(head->prev, node);
+}
+
+static inline void list_remove_rcu(struct list_node *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline struct list_node *list_next_rcu(struct list_node *node)
+{
+	struct list_node *next = *(struct list_node *volatile *)&node->next;
+
+	barrier();
+	return next;
+}
+
+#define list_for_each_rcu(node, head)                           \
+	for (node = list_next_rcu(head); node != (head);        \
+	     node = list_next_rcu(node))
+
 static inline unsigned long list_size(struct list_node *head)
 {
 	struct list_node *node = head->next;
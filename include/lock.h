@@ -1,17 +1,273 @@
 #pragma once
 
 #include <atomic.h>
+#include <smp.h>
+#include <x86.h>
+#include <irq.h>
+#include <preempt.h>
 
-typedef atomic_t spinlock_t;
+/*
+ * spinlock_t implementation, one of
+ * SPINLOCK_TAS:    test-and-test-and-set, cheapest but unfair
+ * SPINLOCK_TICKET: fifo order, all waiters spin on the same word
+ * SPINLOCK_MCS:    fifo order, every waiter spins on its own cache line
+ */
+#define SPINLOCK_TAS 0
+#define SPINLOCK_TICKET 1
+#define SPINLOCK_MCS 2
 
-static inline void spinlock_init(spinlock_t *lock)
+#define SPINLOCK_TYPE SPINLOCK_TICKET
+
+/*
+ * per lock class contention statistics in /sys/lock_stat, they cost every
+ * spin_lock() a tsc read, so only with DEFS=-DLOCK_STAT
+ */
+
+typedef struct {
+	volatile int locked;
+} tas_lock_t;
+
+typedef struct {
+	volatile u16 owner;
+	volatile u16 next;
+} ticket_lock_t;
+
+/* mcs queue node, every cpu owns MCS_NODES of them for nested locks */
+#define MCS_NODES 8
+
+struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile int locked;
+} __attribute__((aligned(64)));
+
+typedef struct {
+	struct mcs_node *volatile tail;
+	/* the node of the holder, used by unlock */
+	struct mcs_node *node;
+} mcs_lock_t;
+
+void tas_lock(tas_lock_t *lock);
+bool tas_trylock(tas_lock_t *lock);
+
+static inline void tas_unlock(tas_lock_t *lock)
 {
-	lock->counter = 0;
+	barrier();
+	lock->locked = 0;
 }
 
+void ticket_lock(ticket_lock_t *lock);
+bool ticket_trylock(ticket_lock_t *lock);
+
+static inline void ticket_unlock(ticket_lock_t *lock)
+{
+	barrier();
+	lock->owner++;
+}
+
+void mcs_lock(mcs_lock_t *lock);
+bool mcs_trylock(mcs_lock_t *lock);
+void mcs_unlock(mcs_lock_t *lock);
+
+#if SPINLOCK_TYPE == SPINLOCK_TICKET
+typedef ticket_lock_t arch_spinlock_t;
+#define arch_spin_lock ticket_lock
+#define arch_spin_trylock ticket_trylock
+#define arch_spin_unlock ticket_unlock
+#elif SPINLOCK_TYPE == SPINLOCK_MCS
+typedef mcs_lock_t arch_spinlock_t;
+#define arch_spin_lock mcs_lock
+#define arch_spin_trylock mcs_trylock
+#define arch_spin_unlock mcs_unlock
+#else
+typedef tas_lock_t arch_spinlock_t;
+#define arch_spin_lock tas_lock
+#define arch_spin_trylock tas_trylock
+#define arch_spin_unlock tas_unlock
+#endif
+
+struct lock_class_stat {
+	u32 acquired;
+	u32 contended;
+	u64 wait_cycles;
+	u64 max_wait_cycles;
+};
+
+/* all locks initialized at the same call site share one class */
+struct lock_class {
+	const char *name;
+	volatile int registered;
+	struct lock_class *next;
+	struct lock_class_stat stats[MAX_CPU];
+};
+
+extern struct lock_class *lock_classes;
+
+typedef struct {
+	arch_spinlock_t raw;
+#ifdef LOCK_STAT
+	struct lock_class *class;
+#endif
+} spinlock_t;
+
+void __spinlock_init(spinlock_t *lock, struct lock_class *class);
+
+#ifdef LOCK_STAT
+#define spinlock_init(lock)                                      \
+	do {                                                     \
+		static struct lock_class __class = { .name = #lock }; \
+		__spinlock_init(lock, &__class);                 \
+	} while (0)
+#else
+#define spinlock_init(lock) __spinlock_init(lock, NULL)
+#endif
+
 void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
 
 static inline void spin_unlock(spinlock_t *lock)
 {
-	atomic_set(lock, 0);
+	arch_spin_unlock(&lock->raw);
+	preempt_enable();
+}
+
+/*
+ * locks also taken in irq context must be taken with irqs disabled,
+ * otherwise an irq on the same cpu spins on it forever
+ */
+#define spin_lock_irqsave(lock, flags)  \
+	do {                            \
+		flags = intr_save();    \
+		spin_lock(lock);        \
+	} while (0)
+
+#define spin_unlock_irqrestore(lock, flags) \
+	do {                                \
+		spin_unlock(lock);          \
+		intr_restore(flags);        \
+	} while (0)
+
+static inline void spin_lock_irq(spinlock_t *lock)
+{
+	intr_disable();
+	spin_lock(lock);
 }
+
+static inline void spin_unlock_irq(spinlock_t *lock)
+{
+	spin_unlock(lock);
+	intr_enable();
+}
+
+const char *spinlock_type(void);
+
+/*
+ * rwlock - any number of readers or one writer
+ *
+ * a waiting writer holds new readers back so it is not starved, except
+ * readers in irq context which may nest in a reader on the same cpu.
+ */
+#define RW_WRITER -1
+
+typedef struct {
+	/* number of readers, RW_WRITER if write locked */
+	volatile int count;
+	volatile int writers;
+} rwlock_t;
+
+static inline void rwlock_init(rwlock_t *lock)
+{
+	lock->count = 0;
+	lock->writers = 0;
+}
+
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+
+#define read_lock_irqsave(lock, flags)  \
+	do {                            \
+		flags = intr_save();    \
+		read_lock(lock);        \
+	} while (0)
+
+#define read_unlock_irqrestore(lock, flags) \
+	do {                                \
+		read_unlock(lock);          \
+		intr_restore(flags);        \
+	} while (0)
+
+#define write_lock_irqsave(lock, flags) \
+	do {                            \
+		flags = intr_save();    \
+		write_lock(lock);       \
+	} while (0)
+
+#define write_unlock_irqrestore(lock, flags) \
+	do {                                 \
+		write_unlock(lock);          \
+		intr_restore(flags);         \
+	} while (0)
+
+/*
+ * seqlock - readers never block writers, they retry if a writer ran
+ * meanwhile, for small data copied out by value
+ *
+ *	do {
+ *		seq = read_seqbegin(&lock);
+ *		copy the data
+ *	} while (read_seqretry(&lock, seq));
+ */
+typedef struct {
+	volatile u32 sequence;
+	spinlock_t lock;
+} seqlock_t;
+
+#define seqlock_init(sl)                   \
+	do {                               \
+		(sl)->sequence = 0;        \
+		spinlock_init(&(sl)->lock); \
+	} while (0)
+
+static inline u32 read_seqbegin(seqlock_t *sl)
+{
+	u32 seq;
+
+	while ((seq = sl->sequence) & 1)
+		cpu_relax();
+
+	smp_rmb();
+	return seq;
+}
+
+static inline bool read_seqretry(seqlock_t *sl, u32 start)
+{
+	smp_rmb();
+	return sl->sequence != start;
+}
+
+static inline void write_seqlock(seqlock_t *sl)
+{
+	spin_lock(&sl->lock);
+	sl->sequence++;
+	smp_wmb();
+}
+
+static inline void write_sequnlock(seqlock_t *sl)
+{
+	smp_wmb();
+	sl->sequence++;
+	spin_unlock(&sl->lock);
+}
+
+#define write_seqlock_irqsave(sl, flags) \
+	do {                             \
+		flags = intr_save();     \
+		write_seqlock(sl);       \
+	} while (0)
+
+#define write_sequnlock_irqrestore(sl, flags) \
+	do {                                  \
+		write_sequnlock(sl);          \
+		intr_restore(flags);          \
+	} while (0)
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * memcpy() and memset() are picked by size and cpu features: rep movsl
+ * with an aligned fast path for small copies, rep movsb on cpus with
+ * enhanced rep movsb (ERMS) from MEM_ERMS_MIN, and sse2 non-temporal
+ * stores from MEM_NT_MIN, which would only evict the caches otherwise.
+ */
+#define MEM_ERMS_MIN 256
+#define MEM_NT_MIN (256 * 1024)
+
+#define MEM_NEED_ERMS (1 << 0)
+#define MEM_NEED_SSE2 (1 << 1)
+
+/* one implementation, membench runs them all */
+struct mem_variant {
+	const char *name;
+	u32 needs;
+	void *(*memcpy)(void *dst, const void *src, size_t n);
+	void *(*memset)(void *s, char c, size_t n);
+};
+
+void *arch_memcpy(void *dst, const void *src, size_t n);
+void *arch_memset(void *s, char c, size_t n);
+void *arch_memmove(void *dst, const void *src, size_t n);
+int arch_memcmp(const void *v1, const void *v2, size_t n);
+
+extern const struct mem_variant mem_variants[];
+extern const int nr_mem_variants;
+
+bool mem_variant_usable(const struct mem_variant *v);
+
+int memcpy_init(void);
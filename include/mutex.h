@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic.h>
+#include <wait.h>
+
+/* sleeping lock, must not be taken in irq context */
+struct mutex {
+	/* 1: unlocked, 0: locked */
+	atomic_t count;
+	struct thread *owner;
+	struct wait_queue_head wait;
+};
+
+void mutex_init(struct mutex *lock);
+bool mutex_trylock(struct mutex *lock);
+void mutex_lock(struct mutex *lock);
+void mutex_unlock(struct mutex *lock);
+
+static inline bool mutex_is_locked(struct mutex *lock)
+{
+	return atomic_read(&lock->count) != 1;
+}
+
+/* counting semaphore, up() may be called in irq context */
+struct semaphore {
+	atomic_t count;
+	struct wait_queue_head wait;
+};
+
+void sema_init(struct semaphore *sem, int val);
+bool down_trylock(struct semaphore *sem);
+void down(struct semaphore *sem);
+void up(struct semaphore *sem);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * per-cpu variables
+ *
+ * DEFINE_PER_CPU() puts a variable in .data.percpu. that section is the
+ * area of cpu 0, every other cpu gets a cache line aligned copy of it at
+ * boot. the %fs segment of a cpu is based at the offset of its copy, so
+ * this_cpu_*() access the own copy of a variable with one instruction and
+ * without knowing the cpu number. per_cpu() reaches any cpu's copy.
+ *
+ * threads never change cpu, but a value read here may be stale once the
+ * thread slept.
+ */
+#define PER_CPU_SECTION ".data.percpu"
+
+#define DEFINE_PER_CPU(type, name) \
+	__attribute__((section(PER_CPU_SECTION))) __typeof__(type) name
+
+#define DECLARE_PER_CPU(type, name) \
+	extern __attribute__((section(PER_CPU_SECTION))) __typeof__(type) name
+
+extern unsigned long __per_cpu_offset[];
+extern char __per_cpu_start[], __per_cpu_end[];
+
+DECLARE_PER_CPU(unsigned long, this_cpu_off);
+
+#define per_cpu_offset(cpu) (__per_cpu_offset[cpu])
+
+#define per_cpu_ptr(ptr, cpu) \
+	((typeof(ptr))((unsigned long)(ptr) + per_cpu_offset(cpu)))
+
+#define per_cpu(var, cpu) (*per_cpu_ptr(&(var), cpu))
+
+/* only sizes 1, 2 and 4 are supported, the link fails otherwise */
+extern void __bad_percpu_size(void);
+
+#define percpu_to_op(op, var, val)                                        \
+	do {                                                              \
+		typeof(var) __val = (val);                                \
+		switch (sizeof(var)) {                                    \
+		case 1:                                                   \
+			asm volatile(op "b %1, %%fs:%0"                   \
+				     : "+m"(var)                          \
+				     : "qi"(__val)                        \
+				     : "memory");                         \
+			break;                                            \
+		case 2:                                                   \
+			asm volatile(op "w %1, %%fs:%0"                   \
+				     : "+m"(var)                          \
+				     : "ri"(__val)                        \
+				     : "memory");                         \
+			break;                                            \
+		case 4:                                                   \
+			asm volatile(op "l %1, %%fs:%0"                   \
+				     : "+m"(var)                          \
+				     : "ri"(__val)                        \
+				     : "memory");                         \
+			break;                                            \
+		default:                                                  \
+			__bad_percpu_size();                              \
+		}                                                         \
+	} while (0)
+
+#define percpu_from_op(op, var)                                           \
+	({                                                                \
+		typeof(var) __ret;                                        \
+		switch (sizeof(var)) {                                    \
+		case 1:                                                   \
+			asm volatile(op "b %%fs:%1, %0"                   \
+				     : "=q"(__ret)                        \
+				     : "m"(var));                         \
+			break;                                            \
+		case 2:                                                   \
+			asm volatile(op "w %%fs:%1, %0"                   \
+				     : "=r"(__ret)                        \
+				     : "m"(var));                         \
+			break;                                            \
+		case 4:                                                   \
+			asm volatile(op "l %%fs:%1, %0"                   \
+				     : "=r"(__ret)                        \
+				     : "m"(var));                         \
+			break;                                            \
+		default:                                                  \
+			__bad_percpu_size();                              \
+		}                                                         \
+		__ret;                                                    \
+	})
+
+#define this_cpu_read(var) percpu_from_op("mov", var)
+#define this_cpu_write(var, val) percpu_to_op("mov", var, val)
+#define this_cpu_add(var, val) percpu_to_op("add", var, val)
+#define this_cpu_sub(var, val) percpu_to_op("sub", var, val)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_dec(var) this_cpu_sub(var, 1)
+
+#define this_cpu_ptr(ptr) \
+	((typeof(ptr))((unsigned long)(ptr) + this_cpu_read(this_cpu_off)))
+
+int setup_per_cpu_areas(void);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <types.h>
+#include <smp.h>
+#include <x86.h>
+#include <percpu.h>
+
+/*
+ * per-cpu preempt count
+ * bits 0-7: spinlocks held, bits 16-23: hardirq nesting depth
+ */
+#define PREEMPT_MASK 0x000000ff
+#define HARDIRQ_SHIFT 16
+#define HARDIRQ_OFFSET (1 << HARDIRQ_SHIFT)
+#define HARDIRQ_MASK 0x00ff0000
+
+DECLARE_PER_CPU(u32, __preempt_count);
+
+static inline u32 preempt_count(void)
+{
+	return this_cpu_read(__preempt_count);
+}
+
+/* a single instruction, an irq in between leaves the count as it found it */
+static inline void preempt_disable(void)
+{
+	this_cpu_inc(__preempt_count);
+	barrier();
+}
+
+static inline void preempt_enable(void)
+{
+	barrier();
+	this_cpu_dec(__preempt_count);
+}
+
+#define hardirq_count() (preempt_count() & HARDIRQ_MASK)
+#define in_irq() (hardirq_count() != 0)
+#define in_atomic() (preempt_count() != 0)
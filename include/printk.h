@@ -0,0 +1,126 @@
+#pragma once
+
+#include <types.h>
+#include <string.h>
+
+/*
+ * printk log rings
+ *
+ * every cpu writes its records into its own ring without a lock, an irq
+ * on the same cpu may nest a record inside the one being written. a
+ * record takes a sequence number from one global counter when it is
+ * reserved and is marked committed once its text is in. the console
+ * thread drains the rings in sequence order to the serial port and to
+ * dmesg, up to the first record still being written.
+ *
+ * a record never holds more than LOG_LINE_MAX bytes, longer output goes
+ * on in the next one. with its ring full a writer drops the record and
+ * counts it, unless it may flush, then it drains the rings itself.
+ */
+#define LOG_LINE_MAX 256
+/* records per cpu, a power of two */
+#define LOG_RING_SIZE 64
+
+/* the console polls the rings this often */
+#define CONSOLE_POLL_MS 10
+
+#define LOG_CONSOLE (1 << 0)
+#define LOG_DMESG (1 << 1)
+/* goes on the text of the record before, without a prefix of its own */
+#define LOG_CONT (1 << 2)
+
+/* the lower the more severe */
+#define LOG_EMERG 0
+#define LOG_ALERT 1
+#define LOG_CRIT 2
+#define LOG_ERR 3
+#define LOG_WARNING 4
+#define LOG_NOTICE 5
+#define LOG_INFO 6
+#define LOG_DEBUG 7
+
+struct log_record {
+	u32 seq;
+	u16 len;
+	u16 flags;
+	/* set by the writer once the text is in */
+	bool committed;
+	u8 level;
+	u8 cpu;
+	/* NULL for printk, which has no prefix */
+	const char *module;
+	u64 ts;
+	char text[LOG_LINE_MAX];
+};
+
+struct log_ring {
+	/* records [tail, head) are reserved, only the own cpu moves head */
+	u32 head;
+	/* only the console moves tail */
+	u32 tail;
+	u32 dropped;
+	struct log_record records[LOG_RING_SIZE];
+} __attribute__((aligned(64)));
+
+/* one message, written in pieces with log_write() */
+struct log_writer {
+	struct log_record *rec;
+	u16 flags;
+	u8 level;
+	bool may_flush;
+	const char *module;
+	u64 ts;
+};
+
+void log_open(struct log_writer *w, u16 flags, int level, const char *module,
+	      bool may_flush);
+void log_write(struct log_writer *w, const char *str);
+void log_writen(struct log_writer *w, const char *str, size_t len);
+void log_close(struct log_writer *w);
+
+/* the longest log_prefix() */
+#define LOG_PREFIX_MAX 64
+
+int log_prefix(string *s, u64 ts, u32 cpu, int level, const char *module);
+
+/* pr_* below this level go to the console once the kernel is up */
+extern int console_loglevel;
+
+void console_flush(void);
+void console_init(void);
+int console_init_late(void);
+
+/*
+ * dmesg - the records of pr_* kept in one ring of DMESG_BUF_SIZE bytes,
+ * the oldest overwritten by new ones. /sys/dmesg is the text since the
+ * last clear, /sys/kmsg the same records in binary, each a struct
+ * dmesg_record followed by its text and padded to 4 bytes.
+ */
+#define DMESG_BUF_SIZE (4096 * 32)
+#define DMESG_MODULE_MAX 12
+
+struct dmesg_record {
+	/* of the record with its text, 0 marks the rest of the ring unused */
+	u16 size;
+	u16 len;
+	u8 cpu;
+	u8 level;
+	u8 flags;
+	u8 pad;
+	u32 seq;
+	u64 ts;
+	char module[DMESG_MODULE_MAX];
+};
+
+/* a reader's position, moved forward if the records were overwritten */
+struct dmesg_iter {
+	u32 seq;
+	u32 idx;
+};
+
+void dmesg_store(struct log_record *rec);
+void dmesg_iter_init(struct dmesg_iter *it);
+int dmesg_iter_next(struct dmesg_iter *it, int max_level, string *s);
+void dmesg_clear(struct dmesg_iter *it);
+void dmesg_init(void);
+int dmesg_init_late(void);
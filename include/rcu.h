@@ -0,0 +1,61 @@
+#pragma once
+
+#include <types.h>
+#include <x86.h>
+#include <preempt.h>
+
+/*
+ * quiescent state rcu
+ *
+ * readers walk rcu protected lists without any lock between
+ * rcu_read_lock() and rcu_read_unlock() and must not sleep in there.
+ * the kernel is not preemptible, so a context switch or idle on a cpu
+ * means that cpu left all its read side sections; once every started cpu
+ * went through one of them after an object was unlinked, no reader can
+ * still see it and call_rcu() callbacks run to free it.
+ */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+/* only to catch sleeping in a read side section */
+static inline void rcu_read_lock(void)
+{
+	preempt_disable();
+}
+
+static inline void rcu_read_unlock(void)
+{
+	preempt_enable();
+}
+
+/* x86 does not reorder stores with other stores nor loads with loads */
+#define rcu_dereference(p)                                     \
+	({                                                     \
+		typeof(p) __p = *(typeof(p) volatile *)&(p);   \
+		barrier();                                     \
+		__p;                                           \
+	})
+
+#define rcu_assign_pointer(p, v)  \
+	do {                      \
+		barrier();        \
+		(p) = (v);        \
+	} while (0)
+
+void call_rcu(struct rcu_head *head, rcu_callback_t func);
+void synchronize_rcu(void);
+
+/* hooks of the scheduler, idle and irq entry */
+void rcu_note_context_switch(void);
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+void rcu_irq_enter(void);
+bool rcu_pending(void);
+void rcu_process_callbacks(void);
+
+int rcu_init(int cpu);
+int rcu_init_late(void);
@@ -7,11 +7,13 @@ static inline void write_eflags(uint32_t eflags) __attribute__((always_inline));
 
 static inline void lcr0(uintptr_t cr0) __attribute__((always_inline));
 static inline void lcr3(uintptr_t cr3) __attribute__((always_inline));
+static inline void lcr4(uintptr_t cr4) __attribute__((always_inline));
 
 static inline uintptr_t rcr0(void) __attribute__((always_inline));
 static inline uintptr_t rcr1(void) __attribute__((always_inline));
 static inline uintptr_t rcr2(void) __attribute__((always_inline));
 static inline uintptr_t rcr3(void) __attribute__((always_inline));
+static inline uintptr_t rcr4(void) __attribute__((always_inline));
 
 static inline uint32_t read_eip(void) __attribute__((always_inline));
 
@@ -46,6 +48,11 @@ static inline void lcr3(uintptr_t cr3)
 	asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
 }
 
+static inline void lcr4(uintptr_t cr4)
+{
+	asm volatile("mov %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
 static inline uintptr_t rcr0(void)
 {
 	uintptr_t cr0;
@@ -74,6 +81,13 @@ static inline uintptr_t rcr3(void)
 	return cr3;
 }
 
+static inline uintptr_t rcr4(void)
+{
+	uintptr_t cr4;
+	asm volatile("mov %%cr4, %0" : "=r"(cr4)::"memory");
+	return cr4;
+}
+
 static inline uint32_t read_eip(void)
 {
 	uint32_t eip;
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <fs.h>
 #include <smp.h>
+#include <lock.h>
+#include <fpu.h>
 
 struct thread_context {
 	uint32_t eip;
@@ -29,16 +31,22 @@ struct thread {
 	u32 tid;
 	string *s;
 	enum thread_state state;
+	/* the cpu whose run queue the thread is on */
+	int cpu;
 	struct process *proc;
 	uintptr_t kstack;
 	struct trapframe *tf;
 	struct thread_context context;
+	/* fpu and sse registers, saved lazily, see fpu.h */
+	struct fpu fpu;
+	/* in proc->thread_group, rcu protected */
 	struct list_node node;
 	struct list_node sched_node;
+	struct rcu_head rcu;
 
-	struct directory *dir;
-	struct file *f_state;
-	struct file *f_context;
+	/* ns on a cpu until the last switch away and when it last got one */
+	u64 runtime;
+	u64 exec_start;
 };
 
 struct process {
@@ -48,16 +56,25 @@ struct process {
 };
 
 struct run_queue {
+	/* threads are woken up on a run queue from irqs and other cpus */
+	spinlock_t lock;
 	struct list_node head;
 };
 
 int schedule_init(int cpu);
 void schedule(void);
+void cpu_idle_loop(void) __attribute__((noreturn));
 
 struct thread *thread_run(int (*fn)(void *), void *arg, int cpu);
 void thread_exit(int err);
 void thread_sleep(struct thread *thread);
 void thread_wakeup(struct thread *thread);
 
-extern struct thread *current_threads[MAX_CPU];
-#define current current_threads[cpu_id()]
+struct thread *find_thread(u32 tid);
+int for_each_thread(int (*fn)(struct thread *t, void *arg), void *arg);
+const char *thread_state_name(enum thread_state state);
+u64 thread_runtime(struct thread *t);
+u32 thread_stack_used(struct thread *t);
+
+DECLARE_PER_CPU(struct thread *, current_task);
+#define current this_cpu_read(current_task)
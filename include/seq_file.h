@@ -0,0 +1,55 @@
+#pragma once
+
+#include <types.h>
+#include <string.h>
+#include <lock.h>
+#include <rcu.h>
+
+/*
+ * seq_file - files made of records, read in pieces
+ *
+ * start() returns the record at *pos, next() the one after @v and
+ * advances *pos, both return NULL at the end; stop() is called with
+ * whatever was returned last, even NULL, so start() may take a lock that
+ * stop() drops. show() appends one record to m->s.
+ *
+ * a read renders the records it covers one at a time into m->s, which
+ * only grows to the largest record, and remembers where it stopped so
+ * reading the file front to back renders every record once.
+ */
+struct seq_file;
+
+/* start() returns it for a header before the first record */
+#define SEQ_START_TOKEN ((void *)1)
+
+struct seq_operations {
+	void *(*start)(struct seq_file *m, u32 *pos);
+	void *(*next)(struct seq_file *m, void *v, u32 *pos);
+	void (*stop)(struct seq_file *m, void *v);
+	int (*show)(struct seq_file *m, void *v);
+};
+
+struct seq_file {
+	const struct seq_operations *op;
+	void *priv;
+	/* the record being read */
+	string *s;
+	/* left to start() and stop() */
+	u32 flags;
+
+	spinlock_t lock;
+	/* the last read ended @skip bytes into record @index, at @off */
+	u32 off;
+	u32 index;
+	u32 skip;
+	struct rcu_head rcu;
+};
+
+struct file;
+struct directory;
+
+int seq_read(struct file *file, char *buf, size_t len, u32 off);
+
+int seq_create_file(const char *name, const struct seq_operations *op,
+		    struct directory *parent, void *priv, struct file **file);
+int seq_remove_file(struct file *file);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <types.h>
+#include <percpu.h>
+#include <asm-generic/cpu.h>
 
 #define ROM_BASE 0xF0000
 #define ROM_SIZE 0x10000
@@ -179,11 +181,18 @@ struct cpu {
 	struct mp_processor *processor;
 };
 
-#define MAX_CPU 8
-
 extern struct cpu cpus[MAX_CPU];
 extern u32 nr_cpu;
 
-u32 cpu_id();
+DECLARE_PER_CPU(int, cpu_number);
+
+/* one %fs relative load, 0 until smp_init() found the other cpus */
+static inline u32 cpu_id(void)
+{
+	return this_cpu_read(cpu_number);
+}
+
+u32 hard_cpu_id(void);
 struct cpu *this_cpu();
 int cpu_up(u32 cpu);
+void smp_send_reschedule(u32 cpu);
@@ -10,13 +10,14 @@ int serial_received();
 void serial_init(void);
 void serial_putc(int ch);
 char serial_getc(void);
+void serial_irq_init(void);
 
 void putchar(int ch);
 int puts(const char *str);
 
 extern queue *stdio_que;
-extern spinlock_t pr_lock;
 
+void stdio_push(char c);
 char readchar(void);
 void readline(string *s);
 
@@ -24,54 +25,64 @@ void stdio_init(void);
 
 extern const char line_end[];
 int print_args(const char *end, ...);
-int print_debug(const char *module, const char *debug, const char *end, ...);
+int print_debug(const char *module, int level, const char *end, ...);
 
 #define printk(...) print_args(line_end, ##__VA_ARGS__, line_end)
-#define printk_debug(module, debug, ...) \
-	print_debug(module, debug, line_end, ##__VA_ARGS__, line_end)
-
-string *get_out_string(void);
-
-static inline char *ch(char c)
-{
-	string *s = get_out_string();
-	ksappend_char(s, c);
-	return s->str;
-}
-
-static inline char *__dec(long val)
+#define printk_debug(module, level, ...) \
+	print_debug(module, level, line_end, ##__VA_ARGS__, line_end)
+
+int printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * the strings of dec() and friends are formatted into a compound literal
+ * of the caller's block, so they share nothing between cpus and need no
+ * lock. each one lives until the end of that block, it must not be kept
+ * past it or returned.
+ */
+/* "-2147483648" */
+#define DEC_BUF_SIZE 12
+/* "0x" and 8 digits */
+#define HEX_BUF_SIZE 11
+/* "<hex, hex>" */
+#define PAIR_BUF_SIZE (2 * HEX_BUF_SIZE + 4)
+#define REPEAT_BUF_SIZE 128
+
+static inline char *__dec(int val, char *buf)
 {
-	string *s = get_out_string();
-	ksappend_int(s, val);
-	return s->str;
+	snprintf(buf, DEC_BUF_SIZE, "%d", val);
+	return buf;
 }
 
-static inline char *__hex(unsigned long val)
+static inline char *__hex(unsigned long val, char *buf)
 {
-	string *s = get_out_string();
-	ksappend_hex(s, val);
-	return s->str;
+	snprintf(buf, HEX_BUF_SIZE, "0x%08lx", val);
+	return buf;
 }
 
-static inline char *__pair(unsigned long a, unsigned long b)
+static inline char *__pair(unsigned long a, unsigned long b, char *buf)
 {
-	string *s = get_out_string();
-	ksappend(s, "<", __hex(a), ", ", __hex(b), ">");
-	return s->str;
+	snprintf(buf, PAIR_BUF_SIZE, "<0x%08lx, 0x%08lx>", a, b);
+	return buf;
 }
 
-static inline char *__repeat(const char *str, unsigned long n)
+/* cut at REPEAT_BUF_SIZE */
+static inline char *__repeat(const char *str, unsigned long n, char *buf)
 {
-	string *s = get_out_string();
+	size_t len = 0;
 
-	while (n--)
-		ksappend_str(s, str);
+	buf[0] = '\0';
+	while (n-- && len < REPEAT_BUF_SIZE - 1)
+		len += snprintf(buf + len, REPEAT_BUF_SIZE - len, "%s", str);
 
-	return s->str;
+	return buf;
 }
 
-#define dec(val) __dec((int)val)
-#define hex(val) __hex((unsigned long)val)
-#define pair(a, b) __pair((unsigned long)a, (unsigned long)b)
+#define ch(c) ((char[2]){ (c), '\0' })
+#define dec(val) __dec((int)(val), (char[DEC_BUF_SIZE]){ 0 })
+#define hex(val) __hex((unsigned long)(val), (char[HEX_BUF_SIZE]){ 0 })
+#define pair(a, b) \
+	__pair((unsigned long)(a), (unsigned long)(b), (char[PAIR_BUF_SIZE]){ 0 })
 #define range(start, end) pair(start, end)
-#define repeat(str, n) __repeat((const char *)str, (unsigned long)n)
+#define repeat(str, n) \
+	__repeat((const char *)(str), (unsigned long)(n), \
+		 (char[REPEAT_BUF_SIZE]){ 0 })
@@ -2,6 +2,7 @@
 
 #include <types.h>
 #include <vector.h>
+#include <stdarg.h>
 
 typedef struct string {
 	char *str;
@@ -67,6 +68,16 @@ static inline int ksappend_kvx(string *s, const char *key, int val)
 	return 0;
 }
 
+typedef void (*format_put_t)(void *priv, const char *str, size_t len);
+
+int vformat(format_put_t put, void *priv, const char *fmt, va_list args);
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+int ksvprintf(string *s, const char *fmt, va_list args);
+int ksprintf(string *s, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
 int kssplit(string *s, char c, vector *vec);
 int ksfit(string *s, char c, int n);
 int hex_to_value(string *s, int *value);
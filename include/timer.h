@@ -11,16 +11,42 @@ struct time {
         uint32_t ticks;
 };
 
-struct thread;
+typedef void (*timer_fn_t)(void *data);
 
+struct timer_base;
+
+/*
+ * timer - callback @fn(@data) is called in timer irq once the tick count
+ * of the cpu which armed the timer reaches @expires
+ */
 struct timer {
-        struct time expired;
-        struct thread *thread;
+        u64 expires;
+        timer_fn_t fn;
+        void *data;
+
+        /* the wheel the timer is queued on, NULL if not pending */
+        struct timer_base *base;
         struct list_node node;
 };
 
+static inline bool timer_pending(struct timer *timer)
+{
+        return timer->base != NULL;
+}
+
 int time_now(struct time *t);
 uint64_t time_ms(void);
-struct timer *timer_create(struct thread *thread, struct time *time_expired);
+
+u64 timer_ticks(void);
+u64 msecs_to_ticks(u32 msecs);
+
+void timer_setup(struct timer *timer, timer_fn_t fn, void *data);
+struct timer *timer_create(timer_fn_t fn, void *data);
+int timer_add(struct timer *timer, u64 expires);
+int timer_cancel(struct timer *timer);
+
+void timer_idle(void);
+int timer_init_late(void);
+
 void sleep(int seconds);
 void msleep(int msecs);
\ No newline at end of file
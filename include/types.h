@@ -31,6 +31,8 @@ typedef short s16;
 typedef unsigned short u16;
 typedef long s32;
 typedef unsigned long u32;
+typedef long long s64;
+typedef unsigned long long u64;
 
 /* *
  * Pointers and addresses are 32 bits long.
@@ -3,6 +3,11 @@
 int usr_fs_init(void);
 int usr_debug_init(void);
 int usr_thread_init(void);
+int usr_lock_init(void);
+int usr_ring_init(void);
+int usr_percpu_init(void);
+int usr_string_init(void);
+int usr_block_init(void);
 int mem_init(void);
 
 int start_new_shell(void);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <types.h>
+#include <list.h>
+#include <lock.h>
+#include <schedule.h>
+
+/*
+ * wait queue - threads sleep on it until a condition becomes true,
+ * the side changing the condition calls wake_up() afterwards
+ */
+struct wait_queue_head {
+	spinlock_t lock;
+	struct list_node head;
+};
+
+struct wait_queue_entry {
+	struct thread *thread;
+	struct list_node node;
+};
+
+void wait_queue_init(struct wait_queue_head *wq);
+void init_wait_entry(struct wait_queue_entry *wait);
+void prepare_to_wait(struct wait_queue_head *wq, struct wait_queue_entry *wait);
+void finish_wait(struct wait_queue_head *wq, struct wait_queue_entry *wait);
+
+void __wake_up(struct wait_queue_head *wq, int nr);
+#define wake_up(wq) __wake_up(wq, 0)
+#define wake_up_one(wq) __wake_up(wq, 1)
+
+long schedule_timeout(long timeout);
+
+/**
+ * wait_event - sleep until @condition is true
+ *
+ * @condition is checked after the thread is queued and marked sleeping,
+ * so a wake_up() in between is never lost.
+ */
+#define wait_event(wq, condition)                              \
+	do {                                                   \
+		struct wait_queue_entry __wait;                \
+                                                               \
+		init_wait_entry(&__wait);                      \
+		while (1) {                                    \
+			prepare_to_wait(wq, &__wait);          \
+			if (condition)                         \
+				break;                         \
+			schedule();                            \
+		}                                              \
+		finish_wait(wq, &__wait);                      \
+	} while (0)
+
+/**
+ * wait_event_timeout - sleep until @condition is true or @timeout ticks
+ *
+ * return 0 if @condition is still false after @timeout, otherwise the
+ * remaining ticks, at least 1.
+ */
+#define wait_event_timeout(wq, condition, timeout)             \
+	({                                                     \
+		long __ret = timeout;                          \
+		struct wait_queue_entry __wait;                \
+                                                               \
+		init_wait_entry(&__wait);                      \
+		while (1) {                                    \
+			prepare_to_wait(wq, &__wait);          \
+			if (condition) {                       \
+				if (!__ret)                    \
+					__ret = 1;             \
+				break;                         \
+			}                                      \
+			if (!__ret)                            \
+				break;                         \
+			__ret = schedule_timeout(__ret);       \
+		}                                              \
+		finish_wait(wq, &__wait);                      \
+		__ret;                                         \
+	})
@@ -23,9 +23,21 @@
 		__mod;                                               \
 	})
 
-#define smp_wmb() asm volatile("mfence" ::: "memory")
 #define barrier() __asm__ __volatile__("" ::: "memory")
 
+/* for device memory and non temporal stores */
+#define mb() asm volatile("mfence" ::: "memory")
+#define rmb() asm volatile("lfence" ::: "memory")
+#define wmb() asm volatile("sfence" ::: "memory")
+
+/*
+ * x86 only reorders a store with a later load from another address,
+ * a locked instruction on the stack orders that cheaper than mfence
+ */
+#define smp_mb() asm volatile("lock; addl $0, 0(%%esp)" ::: "memory", "cc")
+#define smp_rmb() barrier()
+#define smp_wmb() barrier()
+
 static inline uint8_t inb(uint16_t port) __attribute__((always_inline));
 static inline void insl(uint32_t port, void *addr, int cnt)
 	__attribute__((always_inline));
@@ -33,7 +45,16 @@ static inline void outb(uint16_t port, uint8_t data)
 	__attribute__((always_inline));
 static inline void outw(uint16_t port, uint16_t data)
 	__attribute__((always_inline));
+static inline uint32_t inl(uint16_t port) __attribute__((always_inline));
+static inline void outl(uint16_t port, uint32_t data)
+	__attribute__((always_inline));
+static inline void outsl(uint32_t port, const void *addr, int cnt)
+	__attribute__((always_inline));
 static inline void breakpoint(void) __attribute__((always_inline));
+static inline uint64_t rdtsc(void) __attribute__((always_inline));
+static inline void cpuid(uint32_t op, uint32_t *eax, uint32_t *ebx,
+			 uint32_t *ecx, uint32_t *edx)
+	__attribute__((always_inline));
 static inline uint32_t read_dr(unsigned regnum) __attribute__((always_inline));
 static inline void write_dr(unsigned regnum, uint32_t value)
 	__attribute__((always_inline));
@@ -76,11 +97,47 @@ static inline void outw(uint16_t port, uint16_t data)
 	asm volatile("outw %0, %1" ::"a"(data), "d"(port) : "memory");
 }
 
+static inline uint32_t inl(uint16_t port)
+{
+	uint32_t data;
+	asm volatile("inl %1, %0" : "=a"(data) : "d"(port) : "memory");
+	return data;
+}
+
+static inline void outl(uint16_t port, uint32_t data)
+{
+	asm volatile("outl %0, %1" ::"a"(data), "d"(port) : "memory");
+}
+
+static inline void outsl(uint32_t port, const void *addr, int cnt)
+{
+	asm volatile("cld;"
+		     "repne; outsl;"
+		     : "=S"(addr), "=c"(cnt)
+		     : "d"(port), "0"(addr), "1"(cnt)
+		     : "memory", "cc");
+}
+
 static inline void breakpoint(void)
 {
 	asm volatile("int $3");
 }
 
+static inline uint64_t rdtsc(void)
+{
+	uint64_t tsc;
+	asm volatile("rdtsc" : "=A"(tsc));
+	return tsc;
+}
+
+static inline void cpuid(uint32_t op, uint32_t *eax, uint32_t *ebx,
+			 uint32_t *ecx, uint32_t *edx)
+{
+	asm volatile("cpuid"
+		     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		     : "a"(op), "c"(0));
+}
+
 static inline uint32_t read_dr(unsigned regnum)
 {
 	uint32_t value = 0;
@@ -156,8 +213,6 @@ static inline void invlpg(void *addr)
 	asm volatile("invlpg (%0)" ::"r"(addr) : "memory");
 }
 
-static inline int __strcmp(const char *s1, const char *s2)
-	__attribute__((always_inline));
 static inline char *__strcpy(char *dst, const char *src)
 	__attribute__((always_inline));
 static inline void *__memset(void *s, char c, size_t n)
@@ -167,29 +222,6 @@ static inline void *__memmove(void *dst, const void *src, size_t n)
 static inline void *__memcpy(void *dst, const void *src, size_t n)
 	__attribute__((always_inline));
 
-#ifndef __HAVE_ARCH_STRCMP
-#define __HAVE_ARCH_STRCMP
-static inline int __strcmp(const char *s1, const char *s2)
-{
-	int d0, d1, ret;
-	asm volatile("1: lodsb;"
-		     "scasb;"
-		     "jne 2f;"
-		     "testb %%al, %%al;"
-		     "jne 1b;"
-		     "xorl %%eax, %%eax;"
-		     "jmp 3f;"
-		     "2: sbbl %%eax, %%eax;"
-		     "orb $1, %%al;"
-		     "3:"
-		     : "=a"(ret), "=&S"(d0), "=&D"(d1)
-		     : "1"(s1), "2"(s2)
-		     : "memory");
-	return ret;
-}
-
-#endif /* __HAVE_ARCH_STRCMP */
-
 #ifndef __HAVE_ARCH_STRCPY
 #define __HAVE_ARCH_STRCPY
 static inline char *__strcpy(char *dst, const char *src)
@@ -255,11 +287,22 @@ static inline void *__memcpy(void *dst, const void *src, size_t n)
 }
 #endif /* __HAVE_ARCH_MEMCPY */
 
+/* word at a time, in kernel/memcpy.c */
+#ifndef __HAVE_ARCH_MEMCMP
+#define __HAVE_ARCH_MEMCMP
+#endif /* __HAVE_ARCH_MEMCMP */
+
 static inline void halt(void)
 {
 	asm volatile("hlt");
 }
 
+/* enable interrupts and halt, no interrupt can sneak in between */
+static inline void safe_halt(void)
+{
+	asm volatile("sti; hlt" ::: "memory");
+}
+
 static inline void cpu_relax(void)
 {
 	asm volatile("rep; nop" ::: "memory");
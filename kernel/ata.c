@@ -0,0 +1,512 @@
+/*
+ * ATA disks on the legacy IDE channels
+ * - commands move up to 256 sectors, by pio or, when the pci ide
+ *   controller can bus master like qemu's piix, by dma with one prd entry
+ *   per buffer page and the channel irq signalling the end.
+ * https://wiki.osdev.org/ATA_PIO_Mode
+ * https://wiki.osdev.org/ATA/ATAPI_using_DMA
+ */
+
+#include <block.h>
+#include <memory.h>
+#include <completion.h>
+#include <mutex.h>
+#include <timer.h>
+#include <ktime.h>
+#include <irq.h>
+#include <x86.h>
+#include <kernel.h>
+#include <stdio.h>
+#include <debug.h>
+#include <error.h>
+
+#define MODULE "ata"
+#define MODULE_DEBUG 0
+
+/* task file, from the channel's io base */
+#define ATA_DATA 0
+#define ATA_ERROR 1
+#define ATA_COUNT 2
+#define ATA_LBA0 3
+#define ATA_LBA1 4
+#define ATA_LBA2 5
+#define ATA_DRIVE 6
+#define ATA_STATUS 7
+#define ATA_CMD 7
+
+/* from the control base, alternate status when read */
+#define ATA_CTRL 0
+#define CTRL_NIEN 0x02
+#define CTRL_SRST 0x04
+
+#define STATUS_ERR 0x01
+#define STATUS_DRQ 0x08
+#define STATUS_DF 0x20
+#define STATUS_DRDY 0x40
+#define STATUS_BSY 0x80
+
+#define CMD_READ_PIO 0x20
+#define CMD_WRITE_PIO 0x30
+#define CMD_READ_DMA 0xc8
+#define CMD_WRITE_DMA 0xca
+#define CMD_FLUSH 0xe7
+#define CMD_IDENTIFY 0xec
+
+/* bus master registers of a channel */
+#define BM_CMD 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+#define PRD_EOT 0x80000000
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_COMMAND 0x04
+#define PCI_CLASS 0x08
+#define PCI_BAR4 0x20
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_MASTER 0x04
+
+#define ATA_SECTORS_MAX 256
+#define ATA_LBA28_MAX (1 << 28)
+#define ATA_TIMEOUT_MS 2000
+
+struct ata_channel {
+	u16 base;
+	u16 ctrl;
+	/* bus master base, 0 without dma */
+	u16 bmide;
+	int irq;
+
+	/* one command at a time on the two drives */
+	struct mutex lock;
+	struct completion done;
+	bool dma_wait;
+	u32 *prdt;
+	u32 prdt_phys;
+};
+
+struct ata_drive {
+	struct ata_channel *chan;
+	bool slave;
+	bool present;
+	bool dma;
+	u32 sectors;
+	char model[41];
+	struct block_device bdev;
+};
+
+static struct ata_channel ata_channels[2] = {
+	{ .base = 0x1f0, .ctrl = 0x3f6, .irq = PIC_IDE0 },
+	{ .base = 0x170, .ctrl = 0x376, .irq = PIC_IDE1 },
+};
+
+static struct ata_drive ata_drives[4];
+static const char *ata_names[4] = { "hda", "hdb", "hdc", "hdd" };
+
+static u32 pci_read(u32 bus, u32 dev, u32 fn, u32 reg)
+{
+	outl(PCI_CONFIG_ADDR,
+	     0x80000000 | bus << 16 | dev << 11 | fn << 8 | (reg & 0xfc));
+	return inl(PCI_CONFIG_DATA);
+}
+
+static void pci_write(u32 bus, u32 dev, u32 fn, u32 reg, u32 val)
+{
+	outl(PCI_CONFIG_ADDR,
+	     0x80000000 | bus << 16 | dev << 11 | fn << 8 | (reg & 0xfc));
+	outl(PCI_CONFIG_DATA, val);
+}
+
+/* the bus master base of the first ide controller on bus 0, 0 if none */
+static u16 ata_find_bmide(void)
+{
+	u32 dev, fn, class, cmd;
+
+	for (dev = 0; dev < 32; dev++) {
+		for (fn = 0; fn < 8; fn++) {
+			if ((pci_read(0, dev, fn, 0) & 0xffff) == 0xffff)
+				continue;
+
+			/* mass storage, ide, prog if bit 7 bus master */
+			class = pci_read(0, dev, fn, PCI_CLASS);
+			if ((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+
+			cmd = pci_read(0, dev, fn, PCI_COMMAND);
+			pci_write(0, dev, fn, PCI_COMMAND,
+				  (cmd & 0xffff) | PCI_COMMAND_IO |
+					  PCI_COMMAND_MASTER);
+
+			return pci_read(0, dev, fn, PCI_BAR4) & 0xfffc;
+		}
+	}
+
+	return 0;
+}
+
+/* reading the alternate status takes 100ns, the drive needs 400 */
+static inline void ata_delay(struct ata_channel *chan)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		inb(chan->ctrl + ATA_CTRL);
+}
+
+/* wait for BSY to clear and then for all of @bits, the status or -errno */
+static int ata_wait(struct ata_channel *chan, u8 bits)
+{
+	u64 deadline = ktime_ns() + ATA_TIMEOUT_MS * 1000000ull;
+	u8 status;
+
+	do {
+		status = inb(chan->ctrl + ATA_CTRL);
+		if (status & STATUS_BSY)
+			continue;
+
+		if (status & (STATUS_ERR | STATUS_DF))
+			return -EIO;
+
+		if ((status & bits) == bits)
+			return status;
+	} while (ktime_ns() < deadline);
+
+	return -ETIMEDOUT;
+}
+
+static void ata_reset(struct ata_channel *chan)
+{
+	outb(chan->ctrl + ATA_CTRL, CTRL_SRST | CTRL_NIEN);
+	ata_delay(chan);
+	outb(chan->ctrl + ATA_CTRL, CTRL_NIEN);
+	ata_wait(chan, 0);
+}
+
+/* select the drive and load the task file for @count sectors at @lba */
+static int ata_setup(struct ata_drive *drive, u32 lba, u32 count)
+{
+	struct ata_channel *chan = drive->chan;
+	int ret;
+
+	ret = ata_wait(chan, 0);
+	if (ret < 0)
+		return ret;
+
+	outb(chan->base + ATA_DRIVE,
+	     0xe0 | drive->slave << 4 | ((lba >> 24) & 0x0f));
+	ata_delay(chan);
+
+	outb(chan->base + ATA_COUNT, count == ATA_SECTORS_MAX ? 0 : count);
+	outb(chan->base + ATA_LBA0, lba & 0xff);
+	outb(chan->base + ATA_LBA1, (lba >> 8) & 0xff);
+	outb(chan->base + ATA_LBA2, (lba >> 16) & 0xff);
+	return 0;
+}
+
+static int ata_flush(struct ata_drive *drive)
+{
+	struct ata_channel *chan = drive->chan;
+	int ret;
+
+	outb(chan->base + ATA_CMD, CMD_FLUSH);
+	ret = ata_wait(chan, 0);
+	return ret < 0 ? ret : 0;
+}
+
+/* every sector of the command has its own DRQ */
+static int ata_pio(struct ata_drive *drive, struct request *req, u32 lba,
+		   u32 count)
+{
+	struct ata_channel *chan = drive->chan;
+	struct buffer_head *bh;
+	struct list_node *node;
+	int i, ret;
+
+	ret = ata_setup(drive, lba, count);
+	if (ret)
+		return ret;
+
+	outb(chan->base + ATA_CMD, req->write ? CMD_WRITE_PIO : CMD_READ_PIO);
+
+	for (node = req->bh_list.next; node != &req->bh_list;
+	     node = node->next) {
+		bh = container_of(node, struct buffer_head, req_node);
+
+		for (i = 0; i < BLOCK_SECTORS; i++) {
+			ret = ata_wait(chan, STATUS_DRQ);
+			if (ret < 0)
+				return ret;
+
+			if (req->write)
+				outsl(chan->base + ATA_DATA,
+				      bh->data + i * SECTOR_SIZE,
+				      SECTOR_SIZE / 4);
+			else
+				insl(chan->base + ATA_DATA,
+				     bh->data + i * SECTOR_SIZE,
+				     SECTOR_SIZE / 4);
+		}
+	}
+
+	ret = ata_wait(chan, 0);
+	if (ret < 0)
+		return ret;
+
+	return req->write ? ata_flush(drive) : 0;
+}
+
+static int ata_dma(struct ata_drive *drive, struct request *req, u32 lba,
+		   u32 count)
+{
+	struct ata_channel *chan = drive->chan;
+	struct buffer_head *bh;
+	struct list_node *node;
+	u8 bm_status;
+	int i = 0, ret;
+
+	/* buffers are pages, an entry never crosses 64K */
+	for (node = req->bh_list.next; node != &req->bh_list;
+	     node = node->next) {
+		bh = container_of(node, struct buffer_head, req_node);
+		chan->prdt[2 * i] = page_to_phys(bh->page);
+		chan->prdt[2 * i + 1] = BLOCK_SIZE;
+		i++;
+	}
+	chan->prdt[2 * i - 1] |= PRD_EOT;
+
+	outl(chan->bmide + BM_PRDT, chan->prdt_phys);
+	outb(chan->bmide + BM_CMD, req->write ? 0 : BM_CMD_READ);
+	outb(chan->bmide + BM_STATUS,
+	     inb(chan->bmide + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+
+	ret = ata_setup(drive, lba, count);
+	if (ret)
+		return ret;
+
+	init_completion(&chan->done);
+	chan->dma_wait = true;
+	outb(chan->ctrl + ATA_CTRL, 0);
+
+	outb(chan->base + ATA_CMD, req->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb(chan->bmide + BM_CMD,
+	     inb(chan->bmide + BM_CMD) | BM_CMD_START);
+
+	if (!wait_for_completion_timeout(&chan->done,
+					 msecs_to_ticks(ATA_TIMEOUT_MS)))
+		ret = -ETIMEDOUT;
+
+	outb(chan->bmide + BM_CMD, inb(chan->bmide + BM_CMD) & ~BM_CMD_START);
+	chan->dma_wait = false;
+	outb(chan->ctrl + ATA_CTRL, CTRL_NIEN);
+
+	if (ret)
+		return ret;
+
+	bm_status = inb(chan->bmide + BM_STATUS);
+	if (bm_status & BM_STATUS_ERR)
+		return -EIO;
+
+	ret = ata_wait(chan, 0);
+	if (ret < 0)
+		return ret;
+
+	return req->write ? ata_flush(drive) : 0;
+}
+
+static int ata_transfer(struct block_device *bdev, struct request *req)
+{
+	struct ata_drive *drive = bdev->priv;
+	struct ata_channel *chan = drive->chan;
+	u32 lba = req->block * BLOCK_SECTORS;
+	u32 count = req->nr * BLOCK_SECTORS;
+	int ret;
+
+	if (count > ATA_SECTORS_MAX || lba + count > drive->sectors)
+		return -EINVAL;
+
+	mutex_lock(&chan->lock);
+
+	if (drive->dma) {
+		ret = ata_dma(drive, req, lba, count);
+		if (ret == -ETIMEDOUT) {
+			/* no irq came, the drive is still in the command */
+			pr_err(bdev->name, ": dma timed out, using pio");
+			drive->dma = false;
+			ata_reset(chan);
+			ret = ata_pio(drive, req, lba, count);
+		}
+	} else {
+		ret = ata_pio(drive, req, lba, count);
+	}
+
+	mutex_unlock(&chan->lock);
+	return ret;
+}
+
+static const struct block_device_operations ata_ops = {
+	.transfer = ata_transfer,
+};
+
+static void ata_irq(struct ata_channel *chan)
+{
+	u8 bm_status;
+
+	/* reading the status acknowledges the drive */
+	inb(chan->base + ATA_STATUS);
+
+	if (!chan->bmide)
+		return;
+
+	bm_status = inb(chan->bmide + BM_STATUS);
+	if (!(bm_status & BM_STATUS_IRQ))
+		return;
+
+	outb(chan->bmide + BM_STATUS, bm_status & ~BM_STATUS_ERR);
+	if (chan->dma_wait)
+		complete(&chan->done);
+}
+
+static void ata_irq_handler0(void)
+{
+	ata_irq(&ata_channels[0]);
+}
+
+static void ata_irq_handler1(void)
+{
+	ata_irq(&ata_channels[1]);
+}
+
+/* words 27-46 of identify, two characters each with the bytes swapped */
+static void ata_model(struct ata_drive *drive, u16 *id)
+{
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		drive->model[2 * i] = id[27 + i] >> 8;
+		drive->model[2 * i + 1] = id[27 + i] & 0xff;
+	}
+
+	for (i = 40; i > 0 && drive->model[i - 1] == ' '; i--)
+		;
+	drive->model[i] = '\0';
+}
+
+static bool ata_identify(struct ata_drive *drive, u16 *id)
+{
+	struct ata_channel *chan = drive->chan;
+
+	outb(chan->base + ATA_DRIVE, 0xa0 | drive->slave << 4);
+	ata_delay(chan);
+
+	outb(chan->base + ATA_COUNT, 0);
+	outb(chan->base + ATA_LBA0, 0);
+	outb(chan->base + ATA_LBA1, 0);
+	outb(chan->base + ATA_LBA2, 0);
+	outb(chan->base + ATA_CMD, CMD_IDENTIFY);
+
+	if (!inb(chan->ctrl + ATA_CTRL))
+		return false;
+
+	if (ata_wait(chan, 0) < 0)
+		return false;
+
+	/* atapi devices set the signature and abort */
+	if (inb(chan->base + ATA_LBA1) || inb(chan->base + ATA_LBA2))
+		return false;
+
+	if (ata_wait(chan, STATUS_DRQ) < 0)
+		return false;
+
+	insl(chan->base + ATA_DATA, id, SECTOR_SIZE / 4);
+	return true;
+}
+
+static void ata_probe(struct ata_drive *drive, int index, u16 *id)
+{
+	struct block_device *bdev = &drive->bdev;
+
+	if (!ata_identify(drive, id))
+		return;
+
+	/* lba is word 49 bit 9, dma bit 8 */
+	if (!(id[49] & (1 << 9)))
+		return;
+
+	drive->sectors = min(id[60] | (u32)id[61] << 16, ATA_LBA28_MAX);
+	drive->dma = drive->chan->bmide && (id[49] & (1 << 8));
+	drive->present = true;
+	ata_model(drive, id);
+
+	bdev->name = ata_names[index];
+	bdev->nr_blocks = drive->sectors / BLOCK_SECTORS;
+	bdev->ops = &ata_ops;
+	bdev->priv = drive;
+
+	pr_info(bdev->name, ": ", drive->model, ", ", dec(drive->sectors),
+		" sectors, ", drive->dma ? "dma" : "pio");
+	register_block_device(bdev);
+}
+
+static int ata_channel_init(struct ata_channel *chan, u16 bmide)
+{
+	struct page *page;
+
+	mutex_init(&chan->lock);
+	init_completion(&chan->done);
+	chan->dma_wait = false;
+
+	/* no drive pulls the bus down */
+	if (inb(chan->base + ATA_STATUS) == 0xff)
+		return -ENODEV;
+
+	outb(chan->ctrl + ATA_CTRL, CTRL_NIEN);
+
+	if (bmide) {
+		page = alloc_page(GFP_NORMAL);
+		if (page) {
+			chan->bmide = bmide;
+			chan->prdt = (u32 *)page_to_virt(page);
+			chan->prdt_phys = page_to_phys(page);
+		}
+	}
+
+	return 0;
+}
+
+int ata_init_late(void)
+{
+	u16 bmide, *id;
+	struct page *page;
+	int i;
+
+	page = alloc_page(GFP_NORMAL);
+	if (!page)
+		return -ENOMEM;
+	id = (u16 *)page_to_virt(page);
+
+	bmide = ata_find_bmide();
+
+	for (i = 0; i < 2; i++) {
+		if (ata_channel_init(&ata_channels[i], bmide ? bmide + 8 * i : 0))
+			continue;
+
+		ata_drives[2 * i].chan = &ata_channels[i];
+		ata_drives[2 * i + 1].chan = &ata_channels[i];
+		ata_drives[2 * i + 1].slave = true;
+
+		ata_probe(&ata_drives[2 * i], 2 * i, id);
+		ata_probe(&ata_drives[2 * i + 1], 2 * i + 1, id);
+	}
+
+	free_pages(page);
+
+	request_irq(IRQ_IDE0, ata_irq_handler0);
+	request_irq(IRQ_IDE1, ata_irq_handler1);
+	ioapic_enable(PIC_IDE0, 0);
+	ioapic_enable(PIC_IDE1, 0);
+	return 0;
+}
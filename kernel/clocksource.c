@@ -0,0 +1,188 @@
+/*
+ * clocksource - monotonic nanosecond clock built on the time stamp counter
+ *
+ * the tsc is calibrated against pit channel 2 at boot, secondary cpus
+ * measure the offset of their tsc to the cpu which started them, so
+ * ktime_ns() is consistent across cpus.
+ */
+
+#include <ktime.h>
+#include <irq.h>
+#include <smp.h>
+#include <debug.h>
+#include <kernel.h>
+#include <lock.h>
+#include <x86.h>
+#include <error.h>
+
+#define MODULE "clock"
+#define MODULE_DEBUG 0
+
+#define TSC_CALIBRATE_MS 50
+#define TSC_SHIFT 22
+#define TSC_SYNC_ROUNDS 5
+/* a cpu not at the handshake by then is left unsynced */
+#define TSC_SYNC_TIMEOUT_MS 1000
+/* before calibration, about a second at a few GHz */
+#define TSC_SYNC_TIMEOUT_CYCLES (4ULL << 30)
+
+/* offset of the tsc of each cpu to the tsc of cpu 0 */
+static s64 tsc_offsets[MAX_CPU];
+
+static u64 tsc_read(void)
+{
+	return rdtsc() + tsc_offsets[cpu_id()];
+}
+
+static struct clocksource tsc_clocksource = {
+	.name = "tsc",
+	.read = tsc_read,
+	.shift = TSC_SHIFT,
+};
+
+struct clocksource *clock = &tsc_clocksource;
+
+/* mult and base are read on every ktime_ns(), written on calibration */
+static seqlock_t clock_seq;
+
+/* (cycles * mult) >> shift without a 64 bit multiply overflow */
+static inline u64 cycles_to_ns(u64 cycles, u32 mult, u32 shift)
+{
+	u32 lo = (u32)cycles, hi = cycles >> 32;
+
+	return (((u64)lo * mult) >> shift) + (((u64)hi * mult) << (32 - shift));
+}
+
+u64 ktime_ns(void)
+{
+	u64 base;
+	u32 mult, seq;
+
+	do {
+		seq = read_seqbegin(&clock_seq);
+		base = clock->base;
+		mult = clock->mult;
+	} while (read_seqretry(&clock_seq, seq));
+
+	if (!mult)
+		return 0;
+
+	return cycles_to_ns(clock->read() - base, mult, clock->shift);
+}
+
+static u32 tsc_calibrate(void)
+{
+	u64 start, cycles;
+
+	start = rdtsc();
+	pit_wait(TSC_CALIBRATE_MS);
+	cycles = rdtsc() - start;
+
+	do_div(cycles, TSC_CALIBRATE_MS);
+	return cycles;
+}
+
+void clocksource_init(void)
+{
+	struct clocksource *cs = clock;
+	u64 mult;
+	u32 flags;
+
+	seqlock_init(&clock_seq);
+
+	cs->khz = tsc_calibrate();
+	if (!cs->khz) {
+		pr_err("failed to calibrate ", cs->name);
+		return;
+	}
+
+	mult = (u64)NSEC_PER_MSEC << cs->shift;
+	do_div(mult, cs->khz);
+
+	write_seqlock_irqsave(&clock_seq, flags);
+	cs->base = cs->read();
+	cs->mult = mult;
+	write_sequnlock_irqrestore(&clock_seq, flags);
+
+	pr_info("clocksource ", cs->name, " ", dec(cs->khz / 1000), ".",
+		dec(cs->khz % 1000), " MHz");
+}
+
+/*
+ * tsc sync handshake, the starting cpu publishes its clock and the new
+ * cpu takes the smallest delay over a few rounds as its offset
+ */
+enum { TSC_SYNC_IDLE, TSC_SYNC_READY, TSC_SYNC_GO, TSC_SYNC_DONE };
+
+static volatile u32 tsc_sync_state;
+static volatile u64 tsc_sync_value;
+
+static u64 tsc_sync_timeout(void)
+{
+	if (!clock->khz)
+		return TSC_SYNC_TIMEOUT_CYCLES;
+
+	return (u64)clock->khz * TSC_SYNC_TIMEOUT_MS;
+}
+
+/* spin until the state is @state, or while it is with @leave */
+static int tsc_sync_wait(u32 state, bool leave)
+{
+	u64 start = rdtsc(), timeout = tsc_sync_timeout();
+
+	while ((tsc_sync_state == state) == leave) {
+		if (rdtsc() - start > timeout)
+			return -ETIMEDOUT;
+		cpu_relax();
+	}
+
+	return 0;
+}
+
+/* -ETIMEDOUT if the new cpu did not take part, its tsc is then unsynced */
+int tsc_sync_master(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < TSC_SYNC_ROUNDS && !ret; i++) {
+		ret = tsc_sync_wait(TSC_SYNC_READY, false);
+		if (ret)
+			break;
+
+		tsc_sync_value = tsc_read();
+		smp_wmb();
+		tsc_sync_state = TSC_SYNC_GO;
+
+		/* the slave may already be ready for the next round */
+		ret = tsc_sync_wait(TSC_SYNC_GO, true);
+	}
+
+	tsc_sync_state = TSC_SYNC_IDLE;
+	return ret;
+}
+
+void tsc_sync_slave(void)
+{
+	s64 offset, max = 0;
+	int i;
+
+	for (i = 0; i < TSC_SYNC_ROUNDS; i++) {
+		tsc_sync_state = TSC_SYNC_READY;
+
+		/* the master gave up on us, keep the offset at 0 */
+		if (tsc_sync_wait(TSC_SYNC_GO, false)) {
+			tsc_sync_state = TSC_SYNC_IDLE;
+			pr_err("cpu-", dec(cpu_id()), " tsc left unsynced");
+			return;
+		}
+
+		/* the value was read before ours, the max is the closest */
+		offset = tsc_sync_value - rdtsc();
+		if (!i || offset > max)
+			max = offset;
+
+		tsc_sync_state = TSC_SYNC_DONE;
+	}
+
+	tsc_offsets[cpu_id()] = max;
+}
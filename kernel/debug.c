@@ -9,7 +9,10 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <smp.h>
-#include <timer.h>
+#include <ktime.h>
+#include <printk.h>
+#include <error.h>
+#include <atomic.h>
 
 #define MODULE "debug"
 #define MODULE_DEBUG 0
@@ -57,20 +60,11 @@ extern const char __STABSTR_END__[]; // end of string table
 
 static struct rb_tree *g_stab_so_tree;
 static struct rb_tree *g_stab_fun_tree;
+/* symbolisation on several cpus at once only takes the read side */
+static rwlock_t stab_lock;
 
-static string debug_s;
-static char g_debug_buf[128];
 static bool b_init_debug = false;
 
-static char dmesg_buf[4096 * 32];
-static string dmesg_s;
-
-static char line_buf[128];
-static string line;
-
-static char s_buf[128];
-static string s;
-
 static void dump_eip(uint32_t eip)
 {
 	struct rb_node *node;
@@ -78,15 +72,22 @@ static void dump_eip(uint32_t eip)
 	const char *file = NULL, *func = NULL;
 	const char *str = __STABSTR_BEGIN__;
 	char *split;
+	char buf[128];
+	string debug_s;
 
 	if (!b_init_debug)
 		return;
 
+	ksinit(&debug_s, buf, sizeof(buf));
+	buf[0] = 0;
+
+	read_lock(&stab_lock);
+
 	node = rb_tree_search(g_stab_so_tree, eip);
 	if (node) {
 		stab = rb_node_value(node);
 		if (!stab)
-			return;
+			goto out;
 
 		file = str + stab->n_strx;
 	} else {
@@ -97,11 +98,10 @@ static void dump_eip(uint32_t eip)
 	if (node) {
 		stab = rb_node_value(node);
 		if (!stab)
-			return;
+			goto out;
 
 		func = str + stab->n_strx;
 
-		debug_s.length = 0;
 		split = strfind(func, ':');
 		if (split)
 			ksappend_strn(&debug_s, func, split - func);
@@ -114,6 +114,9 @@ static void dump_eip(uint32_t eip)
 	} else {
 		pr_info("\t", "unknown", "\t[", file, "]");
 	}
+
+out:
+	read_unlock(&stab_lock);
 }
 
 void dump_trapstack(uint32_t ebp, uint32_t eip)
@@ -148,53 +151,149 @@ void dump_stack(void)
 	pr_info("---[ end trace ]---");
 }
 
-int print_debug(const char *module, const char *debug, const char *end, ...)
+/*
+ * print_debug - a record for dmesg, on the console as well until the
+ * kernel is up or below console_loglevel. never waits for the console,
+ * a full ring loses it.
+ */
+int print_debug(const char *module, int level, const char *end, ...)
 {
+	struct log_writer w;
+	u16 flags = LOG_DMESG;
 	char *p = NULL;
 	va_list args;
 	int n = 0;
-	int ret = 0;
-	struct time now;
 
-	spin_lock(&pr_lock);
+	if (!os_start || level < console_loglevel)
+		flags |= LOG_CONSOLE;
 
-	line.length = 0;
-	s.length = 0;
-
-	ksappend_str(&s, module);
-	ksfit(&s, ' ', 10);
-
-	time_now(&now);
-	ksappend(&line, "[", dec(now.hours), ".", dec(now.minutes), ".",
-		 dec(now.seconds), ".", dec(now.msecs), "][", dec(cpu_id()), "]",
-		 "[", s.str, "][", debug, "] ");
+	log_open(&w, flags, level, module, false);
 
 	va_start(args, end);
 	while (p != end && n <= 32) {
 		p = va_arg(args, char *);
-		ksappend_str(&line, p);
+		if (p != end)
+			log_write(&w, p);
+		n++;
 	}
 	va_end(args);
 
-	if (!os_start)
-		puts(line.str);
+	log_close(&w);
+	return 0;
+}
+
+/* the first site of each module stands for it */
+static bool log_site_first(struct log_site *site)
+{
+	struct log_site *p;
+
+	for (p = __log_sites_start; p != site; p++)
+		if (!strcmp(p->module, site->module))
+			return false;
 
-	ksappend_str(&dmesg_s, line.str);
+	return true;
+}
+
+static int loglevel_read(struct file *file, string *s)
+{
+	struct log_site *site, *p;
+	int sites;
+
+	for (site = __log_sites_start; site != __log_sites_end; site++) {
+		if (!log_site_first(site))
+			continue;
+
+		sites = 0;
+		for (p = site; p != __log_sites_end; p++)
+			sites += !strcmp(p->module, site->module);
+
+		ksappend(s, site->module, " ", dec(site->module_level),
+			 " sites:", dec(sites), "\n");
+	}
+
+	return 0;
+}
+
+/* @module, or every module for "all", -ENOENT if it has no site */
+static int loglevel_set(const char *module, int level)
+{
+	struct log_site *site;
+	bool all = !strcmp(module, "all");
+	int ret = -ENOENT;
+
+	for (site = __log_sites_start; site != __log_sites_end; site++) {
+		if (all || !strcmp(site->module, module)) {
+			WRITE_ONCE(site->module_level, level);
+			ret = 0;
+		}
+	}
 
-	spin_unlock(&pr_lock);
 	return ret;
 }
 
-void dmesg(void)
+/*
+ * "<module> <level>" may come in several writes, the write command puts
+ * down a word at a time, so it takes effect once the level is in
+ */
+#define LOGLEVEL_BUF_MAX 32
+
+static char loglevel_buf[LOGLEVEL_BUF_MAX];
+static spinlock_t loglevel_lock;
+
+/* loglevel_lock held, 0 until the text holds a level */
+static int loglevel_parse(void)
+{
+	char *level, *end;
+	long val;
+
+	level = strchr(loglevel_buf, ' ');
+	if (!level || !level[1])
+		return 0;
+
+	*level++ = '\0';
+	val = strtol(level, &end, 10);
+	if (*end != '\0' || val < LOG_EMERG || val > LOG_DEBUG)
+		return -EINVAL;
+
+	return loglevel_set(loglevel_buf, val);
+}
+
+static int loglevel_pwrite(struct file *file, const char *buf, size_t len,
+			   u32 off)
 {
-	printk((char *)((char *)dmesg_s.str));
+	int ret;
+
+	if (off + len >= LOGLEVEL_BUF_MAX)
+		return -EINVAL;
+
+	spin_lock(&loglevel_lock);
+	memcpy(loglevel_buf + off, buf, len);
+	loglevel_buf[off + len] = '\0';
+	ret = loglevel_parse();
+	spin_unlock(&loglevel_lock);
+
+	return ret ? ret : len;
 }
 
+static int loglevel_truncate(struct file *file, u32 size)
+{
+	return 0;
+}
+
+static struct file_operations loglevel_fops = {
+	.read = loglevel_read,
+	.pwrite = loglevel_pwrite,
+	.truncate = loglevel_truncate,
+};
+
 void debug_init(void)
 {
 	const struct stab *stab = __STAB_BEGIN__;
 	const struct stab *prev_so_stab = NULL, *prev_fun_stab = NULL;
 
+	rwlock_init(&stab_lock);
+	write_lock(&stab_lock);
+
 	g_stab_so_tree = rb_tree_create();
 	g_stab_fun_tree = rb_tree_create();
 
@@ -229,12 +328,18 @@ void debug_init(void)
 		rb_tree_insert(g_stab_fun_tree, prev_fun_stab->n_value,
 			       0xffffffff, (void *)prev_fun_stab);
 
-	ksinit(&debug_s, g_debug_buf, 128);
-	ksinit(&line, line_buf, 128);
-	ksinit(&s, s_buf, 128);
-	ksinit(&dmesg_s, dmesg_buf, 4096 * 32);
+	write_unlock(&stab_lock);
+
 	b_init_debug = true;
 
 	pr_info("debug init success");
 	return;
 }
+
+int debug_init_late(void)
+{
+	struct file *file;
+
+	spinlock_init(&loglevel_lock);
+	return create_file("loglevel", &loglevel_fops, sys, NULL, &file);
+}
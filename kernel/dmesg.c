@@ -0,0 +1,278 @@
+#include <printk.h>
+#include <seq_file.h>
+#include <string.h>
+#include <stdlib.h>
+#include <lock.h>
+#include <irq.h>
+#include <fs.h>
+#include <debug.h>
+#include <error.h>
+
+#define MODULE "dmesg"
+#define MODULE_DEBUG 0
+
+/*
+ * records are stored back to back, a record that does not fit before the
+ * end of the buffer starts over at 0 after a record of size 0. the oldest
+ * records are dropped to make room, the others never move, so a reader's
+ * index stays good as long as its sequence number was not dropped.
+ */
+static char dmesg_buf[DMESG_BUF_SIZE] __attribute__((aligned(8)));
+
+/* written by the console thread, read by the dmesg readers */
+static spinlock_t dmesg_lock;
+/* records [first_seq, next_seq) at [first, next) */
+static u32 dmesg_first, dmesg_next;
+static u32 dmesg_first_seq, dmesg_next_seq;
+/* readers start from the last clear */
+static u32 dmesg_clear_idx, dmesg_clear_seq;
+
+static struct dmesg_iter dmesg_seq_iter;
+static struct dmesg_iter kmsg_seq_iter;
+
+/* dmesg_lock held, the record at @idx, following the mark to 0 */
+static struct dmesg_record *dmesg_record(u32 *idx)
+{
+	struct dmesg_record *r = (struct dmesg_record *)(dmesg_buf + *idx);
+
+	if (!r->size) {
+		*idx = 0;
+		r = (struct dmesg_record *)dmesg_buf;
+	}
+
+	return r;
+}
+
+/* dmesg_lock held, room for @size bytes and the mark after them */
+static bool dmesg_has_space(u32 size)
+{
+	u32 free;
+
+	if (dmesg_next > dmesg_first)
+		free = max(DMESG_BUF_SIZE - dmesg_next, dmesg_first);
+	else
+		free = dmesg_first - dmesg_next;
+
+	return free >= size + sizeof(struct dmesg_record);
+}
+
+/* dmesg_lock held */
+static void dmesg_drop_first(void)
+{
+	struct dmesg_record *r = dmesg_record(&dmesg_first);
+
+	dmesg_first += r->size;
+	dmesg_first_seq++;
+}
+
+/* from the console thread, in the order the records were made */
+void dmesg_store(struct log_record *rec)
+{
+	struct dmesg_record *r;
+	u32 size = round_up(sizeof(*r) + rec->len, 4);
+	u32 flags;
+
+	spin_lock_irqsave(&dmesg_lock, flags);
+
+	while (dmesg_first_seq != dmesg_next_seq && !dmesg_has_space(size))
+		dmesg_drop_first();
+
+	/* there is room at 0, or the ring is empty */
+	if (dmesg_next + size + sizeof(*r) > DMESG_BUF_SIZE) {
+		((struct dmesg_record *)(dmesg_buf + dmesg_next))->size = 0;
+		dmesg_next = 0;
+	}
+
+	r = (struct dmesg_record *)(dmesg_buf + dmesg_next);
+	r->size = size;
+	r->len = rec->len;
+	r->cpu = rec->cpu;
+	r->level = rec->level;
+	r->flags = rec->flags & LOG_CONT;
+	r->pad = 0;
+	r->seq = dmesg_next_seq;
+	r->ts = rec->ts;
+	memset(r->module, 0, sizeof(r->module));
+	if (rec->module)
+		strncpy(r->module, rec->module, sizeof(r->module) - 1);
+	memcpy(r + 1, rec->text, rec->len);
+
+	dmesg_next += size;
+	dmesg_next_seq++;
+
+	spin_unlock_irqrestore(&dmesg_lock, flags);
+}
+
+/* dmesg_lock held */
+static void __dmesg_iter_init(struct dmesg_iter *it)
+{
+	it->seq = dmesg_clear_seq;
+	it->idx = dmesg_clear_idx;
+}
+
+/* dmesg_lock held, false at the end */
+static bool dmesg_iter_valid(struct dmesg_iter *it)
+{
+	if ((int)(it->seq - dmesg_first_seq) < 0) {
+		it->seq = dmesg_first_seq;
+		it->idx = dmesg_first;
+	}
+
+	return it->seq != dmesg_next_seq;
+}
+
+/* dmesg_lock held, @it is valid */
+static struct dmesg_record *dmesg_iter_advance(struct dmesg_iter *it)
+{
+	struct dmesg_record *r = dmesg_record(&it->idx);
+
+	it->idx += r->size;
+	it->seq++;
+	return r;
+}
+
+static void dmesg_format(struct dmesg_record *r, string *s)
+{
+	if (!(r->flags & LOG_CONT))
+		log_prefix(s, r->ts, r->cpu, r->level, r->module);
+
+	ksappend_strn(s, (char *)(r + 1), r->len);
+}
+
+void dmesg_iter_init(struct dmesg_iter *it)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&dmesg_lock, flags);
+	__dmesg_iter_init(it);
+	spin_unlock_irqrestore(&dmesg_lock, flags);
+}
+
+/*
+ * dmesg_iter_next - append the next record at @max_level or below to @s,
+ * -ENOENT at the end. nothing may print under dmesg_lock, a full log ring
+ * would be flushed into dmesg_store().
+ */
+int dmesg_iter_next(struct dmesg_iter *it, int max_level, string *s)
+{
+	struct dmesg_record *r;
+	u32 flags;
+	int ret = -ENOENT;
+
+	spin_lock_irqsave(&dmesg_lock, flags);
+
+	while (dmesg_iter_valid(it)) {
+		r = dmesg_iter_advance(it);
+		if (r->level <= max_level) {
+			dmesg_format(r, s);
+			ret = 0;
+			break;
+		}
+	}
+
+	spin_unlock_irqrestore(&dmesg_lock, flags);
+	return ret;
+}
+
+/* readers start at @it from now on, the whole ring is kept */
+void dmesg_clear(struct dmesg_iter *it)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&dmesg_lock, flags);
+	dmesg_iter_valid(it);
+	dmesg_clear_seq = it->seq;
+	dmesg_clear_idx = it->idx;
+	spin_unlock_irqrestore(&dmesg_lock, flags);
+}
+
+/*
+ * /sys/dmesg and /sys/kmsg, the position is the sequence number of the
+ * next record, 0 for the start
+ */
+static void *dmesg_seq_start(struct seq_file *m, u32 *pos)
+{
+	struct dmesg_iter *it = m->priv;
+
+	spin_lock_irqsave(&dmesg_lock, m->flags);
+
+	if (!*pos || *pos != it->seq)
+		__dmesg_iter_init(it);
+
+	if (!dmesg_iter_valid(it))
+		return NULL;
+
+	*pos = it->seq;
+	return it;
+}
+
+static void *dmesg_seq_next(struct seq_file *m, void *v, u32 *pos)
+{
+	struct dmesg_iter *it = v;
+
+	dmesg_iter_advance(it);
+	*pos = it->seq;
+	return dmesg_iter_valid(it) ? it : NULL;
+}
+
+static void dmesg_seq_stop(struct seq_file *m, void *v)
+{
+	spin_unlock_irqrestore(&dmesg_lock, m->flags);
+}
+
+static int dmesg_seq_show(struct seq_file *m, void *v)
+{
+	struct dmesg_iter *it = v;
+	u32 idx = it->idx;
+
+	dmesg_format(dmesg_record(&idx), m->s);
+	return 0;
+}
+
+static const struct seq_operations dmesg_seq_ops = {
+	.start = dmesg_seq_start,
+	.next = dmesg_seq_next,
+	.stop = dmesg_seq_stop,
+	.show = dmesg_seq_show,
+};
+
+/* the record as it is stored, zeros and all */
+static int kmsg_seq_show(struct seq_file *m, void *v)
+{
+	struct dmesg_iter *it = v;
+	u32 idx = it->idx;
+	struct dmesg_record *r = dmesg_record(&idx);
+	char *p = (char *)r, *end = p + r->size;
+	int ret = 0;
+
+	while (p < end && !ret)
+		ret = ksappend_char(m->s, *p++);
+
+	return ret;
+}
+
+static const struct seq_operations kmsg_seq_ops = {
+	.start = dmesg_seq_start,
+	.next = dmesg_seq_next,
+	.stop = dmesg_seq_stop,
+	.show = kmsg_seq_show,
+};
+
+void dmesg_init(void)
+{
+	spinlock_init(&dmesg_lock);
+}
+
+int dmesg_init_late(void)
+{
+	struct file *file;
+	int ret;
+
+	ret = seq_create_file("dmesg", &dmesg_seq_ops, sys, &dmesg_seq_iter,
+			      &file);
+	if (ret)
+		return ret;
+
+	return seq_create_file("kmsg", &kmsg_seq_ops, sys, &kmsg_seq_iter,
+			       &file);
+}
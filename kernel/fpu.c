@@ -0,0 +1,208 @@
+#include <fpu.h>
+#include <x86.h>
+#include <irq.h>
+#include <smp.h>
+#include <schedule.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <debug.h>
+#include <error.h>
+#include <fs.h>
+
+#define MODULE "fpu"
+#define MODULE_DEBUG 0
+
+/* default mxcsr, all sse exceptions masked */
+#define MXCSR_DEFAULT 0x1f80
+
+/* the thread whose state is in the fpu registers of this cpu */
+DEFINE_PER_CPU(struct thread *, fpu_owner);
+DEFINE_PER_CPU(bool, in_kernel_fpu);
+
+static DEFINE_PER_CPU(u32, fpu_traps);
+static DEFINE_PER_CPU(u32, fpu_kernel_regions);
+
+bool fpu_has_sse;
+static bool fpu_has_fxsr;
+
+/* state after fninit, copied to every new thread */
+static u8 fpu_init_state[FPU_STATE_SIZE]
+	__attribute__((aligned(FPU_STATE_ALIGN)));
+
+/* without fxsr fnsave/frstor keep the 108 byte x87 state in the area */
+static inline void fpu_save(u8 *state)
+{
+	if (fpu_has_fxsr)
+		asm volatile("fxsave %0" : "=m"(*(u8(*)[FPU_STATE_SIZE])state));
+	else
+		asm volatile("fnsave %0; fwait"
+			     : "=m"(*(u8(*)[FPU_STATE_SIZE])state));
+}
+
+static inline void fpu_restore(u8 *state)
+{
+	if (fpu_has_fxsr)
+		asm volatile("fxrstor %0" ::"m"(*(u8(*)[FPU_STATE_SIZE])state));
+	else
+		asm volatile("frstor %0" ::"m"(*(u8(*)[FPU_STATE_SIZE])state));
+}
+
+int fpu_alloc(struct fpu *fpu)
+{
+	fpu->buf = kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN - 1);
+	if (!fpu->buf)
+		return -ENOMEM;
+
+	fpu->state = (u8 *)round_up((unsigned long)fpu->buf, FPU_STATE_ALIGN);
+	memcpy(fpu->state, fpu_init_state, FPU_STATE_SIZE);
+	return 0;
+}
+
+void fpu_free(struct fpu *fpu)
+{
+	kfree(fpu->buf);
+}
+
+/* interrupts disabled, save the owner's registers if they are live */
+static void fpu_unlazy(void)
+{
+	struct thread *owner = this_cpu_read(fpu_owner);
+
+	clts();
+	if (owner) {
+		fpu_save(owner->fpu.state);
+		this_cpu_write(fpu_owner, NULL);
+	}
+}
+
+/* #NM, current used the fpu while CR0.TS was set */
+static void fpu_nm_handler(void)
+{
+	struct thread *t = current;
+
+	this_cpu_inc(fpu_traps);
+
+	if (this_cpu_read(in_kernel_fpu))
+		pr_err("fpu trap in a kernel fpu region");
+
+	fpu_unlazy();
+	fpu_restore(t->fpu.state);
+	this_cpu_write(fpu_owner, t);
+}
+
+/* called by schedule(), only the owner runs with the fpu enabled */
+void fpu_switch(struct thread *next)
+{
+	if (next == this_cpu_read(fpu_owner))
+		clts();
+	else
+		stts();
+}
+
+/* threads exit on their cpu, so the owner can only be this cpu's */
+void fpu_release(struct thread *t)
+{
+	if (this_cpu_read(fpu_owner) == t)
+		this_cpu_write(fpu_owner, NULL);
+}
+
+/*
+ * kernel_fpu_begin - let the kernel use fpu and sse registers until
+ * kernel_fpu_end(), the state of the owning thread is saved first and
+ * restored lazily when it uses the fpu again
+ */
+void kernel_fpu_begin(void)
+{
+	u32 flags;
+
+	preempt_disable();
+
+	flags = intr_save();
+	WARN_ON(this_cpu_read(in_kernel_fpu));
+	fpu_unlazy();
+	this_cpu_write(in_kernel_fpu, true);
+	this_cpu_inc(fpu_kernel_regions);
+	intr_restore(flags);
+}
+
+void kernel_fpu_end(void)
+{
+	this_cpu_write(in_kernel_fpu, false);
+	stts();
+
+	preempt_enable();
+}
+
+static int fpu_stat_read(struct file *file, string *s)
+{
+	struct thread *owner;
+	int cpu;
+
+	ksappend(s, "fxsr:", dec(fpu_has_fxsr), " sse:", dec(fpu_has_sse),
+		 "\n");
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!cpus[cpu].started)
+			continue;
+
+		owner = per_cpu(fpu_owner, cpu);
+		ksappend(s, "cpu-", dec(cpu), " traps:",
+			 dec(per_cpu(fpu_traps, cpu)), " kernel_regions:",
+			 dec(per_cpu(fpu_kernel_regions, cpu)), " owner:");
+		if (owner)
+			ksappend(s, dec(owner->tid), "\n");
+		else
+			ksappend(s, "none\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations fpu_stat_fops = {
+	.read = fpu_stat_read,
+};
+
+/*
+ * fpu_init - enable fxsave and sse on this cpu and leave CR0.TS set, so
+ * the first fpu instruction of any thread traps
+ */
+int fpu_init(int cpu)
+{
+	u32 eax, ebx, ecx, edx;
+	u32 mxcsr = MXCSR_DEFAULT;
+
+	if (cpu == 0) {
+		cpuid(1, &eax, &ebx, &ecx, &edx);
+		fpu_has_fxsr = !!(edx & CPUID_FXSR);
+		fpu_has_sse = fpu_has_fxsr && (edx & CPUID_SSE);
+	}
+
+	if (fpu_has_fxsr)
+		lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+	clts();
+	asm volatile("fninit");
+
+	if (fpu_has_sse)
+		asm volatile("ldmxcsr %0" ::"m"(mxcsr));
+
+	if (cpu == 0) {
+		fpu_save(fpu_init_state);
+		request_irq(IRQ_NM, fpu_nm_handler);
+		pr_info("fxsr:", dec(fpu_has_fxsr), " sse:", dec(fpu_has_sse));
+	}
+
+	this_cpu_write(fpu_owner, NULL);
+	stts();
+
+	return 0;
+}
+
+int fpu_init_late(void)
+{
+	struct file *file;
+
+	return create_file("fpu", &fpu_stat_fops, sys, NULL, &file);
+}
@@ -16,6 +16,12 @@
 #include <kernel.h>
 #include <smp.h>
 #include <lock.h>
+#include <timer.h>
+#include <percpu.h>
+#include <memcpy.h>
+#include <rcu.h>
+#include <block.h>
+#include <printk.h>
 
 bool os_start = false;
 
@@ -38,6 +44,14 @@ int kernel_init_late(void)
 	kmalloc_init_late();
 	vmalloc_init_late();
 	smp_init_late();
+	irq_init_late();
+	timer_init_late();
+	rcu_init_late();
+	console_init_late();
+	debug_init_late();
+	fpu_init_late();
+	block_init_late();
+	ata_init_late();
 	return 0;
 }
 
@@ -63,6 +77,12 @@ void start_kernel(void)
 
 	smp_init(mm);
 
+	setup_per_cpu_areas();
+
+	fpu_init(0);
+
+	memcpy_init();
+
 	schedule_init(0);
 
 	current->proc->mm = mm;
@@ -80,7 +100,5 @@ void start_kernel(void)
 
 	usr_init();
 
-	while (1) {
-		schedule();
-	}
+	cpu_idle_loop();
 }
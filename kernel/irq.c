@@ -10,6 +10,8 @@
 #include <usr.h>
 #include <memory.h>
 #include <smp.h>
+#include <preempt.h>
+#include <rcu.h>
 
 #define MODULE "irq"
 #define MODULE_DEBUG 0
@@ -31,6 +33,8 @@ static struct pseudodesc idt_pd = { sizeof(idt_array) - 1,
 				    (uintptr_t)idt_array };
 
 static irq_handler_t irq_handlers[IRQ_NUM];
+static DEFINE_PER_CPU(u32, irq_counts);
+static DEFINE_PER_CPU(u32, irq_depth_max);
 
 static void set_gate(struct gate_desc *gate, unsigned long istrap,
 		     unsigned long selector, unsigned long offset,
@@ -85,6 +89,30 @@ static void dump_trapframe(struct trapframe *tf)
 
 void monitor(void);
 
+u32 irq_count(int cpu)
+{
+	return per_cpu(irq_counts, cpu);
+}
+
+void irq_enter(void)
+{
+	u32 depth;
+
+	this_cpu_add(__preempt_count, HARDIRQ_OFFSET);
+	this_cpu_inc(irq_counts);
+
+	depth = hardirq_count() >> HARDIRQ_SHIFT;
+	if (depth > this_cpu_read(irq_depth_max))
+		this_cpu_write(irq_depth_max, depth);
+
+	rcu_irq_enter();
+}
+
+void irq_exit(void)
+{
+	this_cpu_sub(__preempt_count, HARDIRQ_OFFSET);
+}
+
 void irq_handler(struct trapframe *tf)
 {
 	if (tf->irq > IRQ_NUM) {
@@ -92,9 +120,14 @@ void irq_handler(struct trapframe *tf)
 		return;
 	}
 
+	irq_enter();
+
 	if (irq_handlers[tf->irq]) {
 		irq_handlers[tf->irq]();
-		lapic_eoi();
+		/* exceptions are not delivered by the lapic */
+		if (tf->irq >= IRQ_OFFSET)
+			lapic_eoi();
+		irq_exit();
 		return;
 	}
 
@@ -114,6 +147,8 @@ void irq_handler(struct trapframe *tf)
 
 	dump_trapframe(tf);
 
+	irq_exit();
+
 	if (!os_start)
 		halt();
 
@@ -121,7 +156,6 @@ void irq_handler(struct trapframe *tf)
 		start_new_shell();
 
 	thread_exit(tf->err);
-	lapic_eoi();
 }
 
 int request_irq(u16 irq, irq_handler_t fn)
@@ -142,5 +176,34 @@ void irq_init(void)
 	idt_init();
 	timer_init();
 	keyboard_init();
+	serial_irq_init();
 	intr_enable();
 }
+
+static int irq_stat_read(struct file *file, string *s)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!cpus[cpu].started)
+			continue;
+
+		ksappend(s, "cpu-", dec(cpu), " irqs:",
+			 dec(per_cpu(irq_counts, cpu)), " max_depth:",
+			 dec(per_cpu(irq_depth_max, cpu)), " preempt_count:",
+			 hex(per_cpu(__preempt_count, cpu)), "\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations irq_stat_fops = {
+	.read = irq_stat_read,
+};
+
+int irq_init_late(void)
+{
+	struct file *file;
+
+	return create_file("irq_stat", &irq_stat_fops, sys, NULL, &file);
+}
@@ -172,7 +172,7 @@ static void keyboard_read_all_buffer(void)
 
 	while ((c = keyboard_device_getc()) != -1) {
 		if (c != 0)
-			enqueue(stdio_que, char, c);
+			stdio_push(c);
 	}
 }
 
@@ -190,6 +190,6 @@ void keyboard_init(void)
 	/* enable keyboard interrupt */
 	/* pic_enable(PIC_KEYBD); */
 
-	ioapic_enable(IRQ_KEYBD, 0);
+	ioapic_enable(PIC_KEYBD, 0);
 }
 
@@ -12,6 +12,8 @@
 #define MODULE "lapic"
 #define MODULE_DEBUG 0
 
+#define CALIBRATE_MS 10
+
 // Local APIC registers, divided by 4 for use as int[] indices.
 #define ID (0x0020) // ID
 #define VER (0x0030) // Version
@@ -33,6 +35,7 @@
 #define ICRHI (0x0310) // Interrupt Command [63:32]
 #define TIMER (0x0320) // Local Vector Table 0 (TIMER)
 #define X1 0x0000000B // divide counts by 1
+#define ONESHOT 0x00000000 // One-shot
 #define PERIODIC 0x00020000 // Periodic
 #define PCINT (0x0340) // Performance Counter LVT
 #define LINT0 (0x0350) // Local Vector Table 1 (LINT0)
@@ -45,6 +48,9 @@
 
 volatile int *lapic; // Initialized in mp.c
 
+/* lapic timer counts in one tick, calibrated against the pit */
+u32 lapic_timer_per_tick;
+
 #define lapic_addr(reg) ((u32 *)((u32)lapic + reg))
 
 static u32 lapic_read(u32 reg)
@@ -60,6 +66,29 @@ static void lapic_write(u32 reg, u32 value)
 	lapic_read(ID);
 }
 
+/*
+ * lapic_timer_calibrate - count how fast the lapic timer runs during
+ * a fixed pit interval, all cpus share the same bus frequency
+ */
+static void lapic_timer_calibrate(void)
+{
+	u32 count;
+
+	lapic_write(TDCR, X1);
+	lapic_write(TIMER, MASKED | IRQ_TIMER);
+	lapic_write(TICR, 0xffffffff);
+
+	pit_wait(CALIBRATE_MS);
+
+	count = 0xffffffff - lapic_read(TCCR);
+	lapic_write(TICR, 0);
+
+	lapic_timer_per_tick = count / CALIBRATE_MS * (1000 / TICK_NUM);
+
+	pr_info("lapic timer: ", dec(count / CALIBRATE_MS), " counts/ms, ",
+		dec(lapic_timer_per_tick), " counts/tick");
+}
+
 void lapic_init(void)
 {
 	if (!lapic) {
@@ -72,11 +101,15 @@ void lapic_init(void)
 
 	// The timer repeatedly counts down at bus frequency
 	// from TICR and then issues an interrupt.
-	// If xv6 cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// TICR is calibrated against the pit to give TICK_NUM ticks/s.
+	if (!lapic_timer_per_tick)
+		lapic_timer_calibrate();
+
+	if (!lapic_timer_per_tick)
+		lapic_timer_per_tick = 10000000;
+
 	lapic_write(TDCR, X1);
-	lapic_write(TIMER, PERIODIC | IRQ_TIMER);
-	lapic_write(TICR, 10000000);
+	lapic_timer_periodic();
 
 	// Disable logical interrupt lines.
 	lapic_write(LINT0, MASKED);
@@ -114,6 +147,36 @@ int lapic_id(void)
 	return lapic_read(ID) >> 24;
 }
 
+void lapic_timer_periodic(void)
+{
+	lapic_write(TIMER, PERIODIC | IRQ_TIMER);
+	lapic_write(TICR, lapic_timer_per_tick);
+}
+
+/* fire the timer irq only once after @count lapic timer counts */
+void lapic_timer_oneshot(u32 count)
+{
+	lapic_write(TIMER, ONESHOT | IRQ_TIMER);
+	lapic_write(TICR, count);
+}
+
+u32 lapic_timer_remaining(void)
+{
+	return lapic_read(TCCR);
+}
+
+// Send a fixed interrupt to the cpu with @apic_id.
+void lapic_send_ipi(u8 apic_id, u32 vector)
+{
+	if (!lapic)
+		return;
+
+	lapic_write(ICRHI, apic_id << 24);
+	lapic_write(ICRLO, FIXED | ASSERT | vector);
+	while (lapic_read(ICRLO) & DELIVS)
+		;
+}
+
 // Acknowledge interrupt.
 void lapic_eoi(void)
 {
@@ -0,0 +1,304 @@
+#include <memcpy.h>
+#include <string.h>
+#include <x86.h>
+#include <fpu.h>
+#include <stdio.h>
+#include <debug.h>
+#include <stdlib.h>
+
+#define MODULE "memcpy"
+#define MODULE_DEBUG 0
+
+/* cpuid leaf 7 ebx */
+#define CPUID_ERMS (1 << 9)
+
+static u32 mem_features;
+
+static void *memcpy_bytes(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+
+	while (n-- > 0)
+		*d++ = *s++;
+	return dst;
+}
+
+static void *memset_bytes(void *s, char c, size_t n)
+{
+	char *p = s;
+
+	while (n-- > 0)
+		*p++ = c;
+	return s;
+}
+
+/* word copies, dst is aligned first unless everything already is */
+static void *memcpy_movsl(void *dst, const void *src, size_t n)
+{
+	int d0, d1, d2;
+	size_t head;
+
+	if (!(((unsigned long)dst | (unsigned long)src | n) & 3)) {
+		asm volatile("rep; movsl;"
+			     : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+			     : "0"(n / 4), "1"(dst), "2"(src)
+			     : "memory");
+		return dst;
+	}
+
+	head = -(unsigned long)dst & 3;
+	if (head > n)
+		head = n;
+
+	asm volatile("rep; movsb;"
+		     "movl %4, %%ecx;"
+		     "shrl $2, %%ecx;"
+		     "rep; movsl;"
+		     "movl %4, %%ecx;"
+		     "andl $3, %%ecx;"
+		     "rep; movsb;"
+		     : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+		     : "0"(head), "g"(n - head), "1"(dst), "2"(src)
+		     : "memory");
+	return dst;
+}
+
+static void *memset_stosl(void *s, char c, size_t n)
+{
+	u32 pattern = (u8)c * 0x01010101;
+	int d0, d1;
+
+	asm volatile("rep; stosl;"
+		     "movl %4, %%ecx;"
+		     "andl $3, %%ecx;"
+		     "rep; stosb;"
+		     : "=&c"(d0), "=&D"(d1)
+		     : "0"(n / 4), "a"(pattern), "g"(n), "1"(s)
+		     : "memory");
+	return s;
+}
+
+static void *memcpy_erms(void *dst, const void *src, size_t n)
+{
+	int d0, d1, d2;
+
+	asm volatile("rep; movsb;"
+		     : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+		     : "0"(n), "1"(dst), "2"(src)
+		     : "memory");
+	return dst;
+}
+
+static void *memset_erms(void *s, char c, size_t n)
+{
+	int d0, d1;
+
+	asm volatile("rep; stosb;"
+		     : "=&c"(d0), "=&D"(d1)
+		     : "0"(n), "a"(c), "1"(s)
+		     : "memory");
+	return s;
+}
+
+/*
+ * 64 bytes per loop, stores bypass the cache. dst is 16 byte aligned as
+ * movntdq needs, src may be unaligned.
+ */
+static void *memcpy_sse2_nt(void *dst, const void *src, size_t n)
+{
+	size_t head = min(-(unsigned long)dst & 15, n);
+	size_t blocks;
+	void *d = dst;
+
+	memcpy_movsl(d, src, head);
+	d += head;
+	src += head;
+	n -= head;
+	blocks = n / 64;
+	if (!blocks)
+		return memcpy_movsl(d, src, n);
+
+	kernel_fpu_begin();
+
+	asm volatile("1: prefetchnta 256(%1);"
+		     "movdqu (%1), %%xmm0;"
+		     "movdqu 16(%1), %%xmm1;"
+		     "movdqu 32(%1), %%xmm2;"
+		     "movdqu 48(%1), %%xmm3;"
+		     "movntdq %%xmm0, (%0);"
+		     "movntdq %%xmm1, 16(%0);"
+		     "movntdq %%xmm2, 32(%0);"
+		     "movntdq %%xmm3, 48(%0);"
+		     "addl $64, %1;"
+		     "addl $64, %0;"
+		     "decl %2;"
+		     "jnz 1b;"
+		     "sfence;"
+		     : "+r"(d), "+r"(src), "+r"(blocks)
+		     :
+		     : "memory");
+
+	kernel_fpu_end();
+
+	memcpy_movsl(d, src, n & 63);
+	return dst;
+}
+
+static void *memset_sse2_nt(void *s, char c, size_t n)
+{
+	u32 pattern[4];
+	size_t head = min(-(unsigned long)s & 15, n);
+	size_t blocks;
+	void *p = s;
+
+	pattern[0] = pattern[1] = pattern[2] = pattern[3] =
+		(u8)c * 0x01010101;
+
+	memset_stosl(p, c, head);
+	p += head;
+	n -= head;
+	blocks = n / 64;
+	if (!blocks)
+		return memset_stosl(p, c, n);
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqu (%2), %%xmm0;"
+		     "1: movntdq %%xmm0, (%0);"
+		     "movntdq %%xmm0, 16(%0);"
+		     "movntdq %%xmm0, 32(%0);"
+		     "movntdq %%xmm0, 48(%0);"
+		     "addl $64, %0;"
+		     "decl %1;"
+		     "jnz 1b;"
+		     "sfence;"
+		     : "+r"(p), "+r"(blocks)
+		     : "r"(pattern)
+		     : "memory");
+
+	kernel_fpu_end();
+
+	memset_stosl(p, c, n & 63);
+	return s;
+}
+
+/* irqs may copy while the interrupted code is in a kernel fpu region */
+static inline bool mem_use_nt(size_t n)
+{
+	return n >= MEM_NT_MIN && (mem_features & MEM_NEED_SSE2) &&
+	       irq_fpu_usable();
+}
+
+void *arch_memcpy(void *dst, const void *src, size_t n)
+{
+	if (mem_use_nt(n))
+		return memcpy_sse2_nt(dst, src, n);
+
+	if (n >= MEM_ERMS_MIN && (mem_features & MEM_NEED_ERMS))
+		return memcpy_erms(dst, src, n);
+
+	return memcpy_movsl(dst, src, n);
+}
+
+void *arch_memset(void *s, char c, size_t n)
+{
+	if (mem_use_nt(n))
+		return memset_sse2_nt(s, c, n);
+
+	if (n >= MEM_ERMS_MIN && (mem_features & MEM_NEED_ERMS))
+		return memset_erms(s, c, n);
+
+	return memset_stosl(s, c, n);
+}
+
+/* copies downwards, the last n % 4 bytes first and then whole words */
+static void *memmove_backward(void *dst, const void *src, size_t n)
+{
+	int d0, d1, d2;
+
+	asm volatile("std;"
+		     "rep; movsb;"
+		     "subl $3, %%esi;"
+		     "subl $3, %%edi;"
+		     "movl %6, %%ecx;"
+		     "rep; movsl;"
+		     "cld;"
+		     : "=&c"(d0), "=&S"(d1), "=&D"(d2)
+		     : "0"(n & 3), "1"(src + n - 1), "2"(dst + n - 1), "g"(n / 4)
+		     : "memory");
+	return dst;
+}
+
+/* a forward copy is safe unless dst starts inside src */
+void *arch_memmove(void *dst, const void *src, size_t n)
+{
+	if (dst <= src || dst >= src + n)
+		return arch_memcpy(dst, src, n);
+
+	return memmove_backward(dst, src, n);
+}
+
+/* words are compared until one differs, then its bytes */
+int arch_memcmp(const void *v1, const void *v2, size_t n)
+{
+	const u32 *w1 = v1, *w2 = v2;
+	const u8 *s1, *s2;
+
+	while (n >= 4 && *w1 == *w2) {
+		w1++;
+		w2++;
+		n -= 4;
+	}
+
+	s1 = (const u8 *)w1;
+	s2 = (const u8 *)w2;
+
+	while (n-- > 0) {
+		if (*s1 != *s2)
+			return (int)*s1 - (int)*s2;
+		s1++;
+		s2++;
+	}
+
+	return 0;
+}
+
+const struct mem_variant mem_variants[] = {
+	{ "bytes", 0, memcpy_bytes, memset_bytes },
+	{ "movsl", 0, memcpy_movsl, memset_stosl },
+	{ "erms", MEM_NEED_ERMS, memcpy_erms, memset_erms },
+	{ "sse2_nt", MEM_NEED_SSE2, memcpy_sse2_nt, memset_sse2_nt },
+	{ "auto", 0, arch_memcpy, arch_memset },
+};
+
+const int nr_mem_variants = sizeof(mem_variants) / sizeof(mem_variants[0]);
+
+bool mem_variant_usable(const struct mem_variant *v)
+{
+	if ((v->needs & mem_features) != v->needs)
+		return false;
+
+	return !(v->needs & MEM_NEED_SSE2) || irq_fpu_usable();
+}
+
+/* after fpu_init(), sse needs the fxsave support checked there */
+int memcpy_init(void)
+{
+	u32 eax, ebx, ecx, edx;
+
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		cpuid(7, &eax, &ebx, &ecx, &edx);
+		if (ebx & CPUID_ERMS)
+			mem_features |= MEM_NEED_ERMS;
+	}
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (fpu_has_sse && (edx & CPUID_SSE2))
+		mem_features |= MEM_NEED_SSE2;
+
+	pr_info("erms:", dec(!!(mem_features & MEM_NEED_ERMS)),
+		" sse2:", dec(!!(mem_features & MEM_NEED_SSE2)));
+	return 0;
+}
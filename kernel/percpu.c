@@ -0,0 +1,51 @@
+#include <percpu.h>
+#include <smp.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <debug.h>
+#include <error.h>
+
+#define MODULE "percpu"
+#define MODULE_DEBUG 0
+
+/* cpus do not share a cache line of their areas */
+#define PER_CPU_ALIGN 64
+
+/* cpu 0 uses .data.percpu itself, its offset stays 0 */
+unsigned long __per_cpu_offset[MAX_CPU];
+
+DEFINE_PER_CPU(unsigned long, this_cpu_off);
+DEFINE_PER_CPU(int, cpu_number);
+
+/*
+ * setup_per_cpu_areas - copy .data.percpu for every other cpu found by
+ * smp_init(), before they are started and before cpu 0 changed any of
+ * its per-cpu variables
+ */
+int setup_per_cpu_areas(void)
+{
+	unsigned long size = __per_cpu_end - __per_cpu_start;
+	char *area;
+	int cpu;
+
+	for (cpu = 1; cpu < MAX_CPU; cpu++) {
+		if (!cpus[cpu].init)
+			continue;
+
+		area = kmalloc(size + PER_CPU_ALIGN);
+		if (!area)
+			return -ENOMEM;
+
+		area = (char *)round_up((unsigned long)area, PER_CPU_ALIGN);
+		memcpy(area, __per_cpu_start, size);
+
+		__per_cpu_offset[cpu] = area - __per_cpu_start;
+		per_cpu(this_cpu_off, cpu) = __per_cpu_offset[cpu];
+		per_cpu(cpu_number, cpu) = cpu;
+	}
+
+	pr_info("per-cpu area ", dec(size), " bytes at ", hex(__per_cpu_start));
+	return 0;
+}
@@ -0,0 +1,305 @@
+#include <printk.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic.h>
+#include <irq.h>
+#include <smp.h>
+#include <lock.h>
+#include <timer.h>
+#include <schedule.h>
+#include <debug.h>
+#include <fs.h>
+#include <error.h>
+#include <ktime.h>
+
+#define MODULE "printk"
+#define MODULE_DEBUG 0
+
+static struct log_ring log_rings[MAX_CPU];
+static atomic_t log_seq;
+
+/* one cpu drains the rings at a time, the writers never take it */
+static spinlock_t console_lock;
+static struct thread *console_task;
+/* the drops of each ring already reported */
+static u32 console_dropped[MAX_CPU];
+
+int console_loglevel;
+
+#define LOG_MODULE_WIDTH 10
+
+static const char *log_level_names[] = {
+	"emerg", "alert", "crit ", "error", "warn ", "notic", "info ", "debug",
+};
+
+/* "[secs.usecs][cpu][module    ][level] ", the start of a pr_* line */
+int log_prefix(string *s, u64 ts, u32 cpu, int level, const char *module)
+{
+	u32 usecs = do_div(ts, NSEC_PER_SEC) / NSEC_PER_USEC;
+
+	return ksprintf(s, "[%llu.%06lu][%lu][%-*.*s][%s] ", ts, usecs, cpu,
+			LOG_MODULE_WIDTH, LOG_MODULE_WIDTH, module,
+			log_level_names[level & LOG_DEBUG]);
+}
+
+void log_open(struct log_writer *w, u16 flags, int level, const char *module,
+	      bool may_flush)
+{
+	w->rec = NULL;
+	w->flags = flags;
+	w->level = level;
+	w->module = module;
+	w->ts = ktime_ns();
+	/* flushing here takes as long as the serial port needs */
+	w->may_flush = !console_task || (may_flush && !irqs_disabled());
+}
+
+/* the next record of the own ring, irqs off so a nested one comes after */
+static struct log_record *log_reserve(struct log_writer *w)
+{
+	struct log_ring *ring;
+	struct log_record *rec;
+	u32 flags, head;
+
+	while (1) {
+		flags = intr_save();
+		ring = &log_rings[cpu_id()];
+		head = ring->head;
+		if (head - READ_ONCE(ring->tail) < LOG_RING_SIZE)
+			break;
+
+		if (!w->may_flush) {
+			ring->dropped++;
+			intr_restore(flags);
+			return NULL;
+		}
+
+		intr_restore(flags);
+		console_flush();
+		cpu_relax();
+	}
+
+	rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+	rec->seq = atomic_add_return(&log_seq, 1);
+	rec->len = 0;
+	rec->flags = w->flags;
+	rec->level = w->level;
+	rec->cpu = cpu_id();
+	rec->module = w->module;
+	rec->ts = w->ts;
+	rec->committed = false;
+	smp_store_release(&ring->head, head + 1);
+
+	intr_restore(flags);
+	return rec;
+}
+
+/* the rest of the message goes on in a record without a prefix */
+static void log_commit(struct log_writer *w)
+{
+	smp_store_release(&w->rec->committed, true);
+	w->rec = NULL;
+	w->flags |= LOG_CONT;
+}
+
+void log_writen(struct log_writer *w, const char *str, size_t len)
+{
+	size_t n;
+
+	while (len) {
+		if (!w->rec) {
+			w->rec = log_reserve(w);
+			if (!w->rec)
+				return;
+		}
+
+		n = min(len, (size_t)(LOG_LINE_MAX - w->rec->len));
+		memcpy(w->rec->text + w->rec->len, str, n);
+		w->rec->len += n;
+		str += n;
+		len -= n;
+
+		if (w->rec->len == LOG_LINE_MAX)
+			log_commit(w);
+	}
+}
+
+void log_write(struct log_writer *w, const char *str)
+{
+	if (str)
+		log_writen(w, str, strlen(str));
+}
+
+void log_close(struct log_writer *w)
+{
+	if (w->rec)
+		log_commit(w);
+
+	/* nobody else prints before the console thread runs */
+	if (!console_task)
+		console_flush();
+}
+
+/* the oldest record not yet drained, NULL if it is still being written */
+static struct log_record *console_next(struct log_ring **next_ring)
+{
+	struct log_record *rec, *next = NULL;
+	struct log_ring *ring;
+	u32 tail;
+	int cpu;
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		ring = &log_rings[cpu];
+		tail = ring->tail;
+		if (tail == smp_load_acquire(&ring->head))
+			continue;
+
+		rec = &ring->records[tail & (LOG_RING_SIZE - 1)];
+		if (!next || (int)(rec->seq - next->seq) < 0) {
+			next = rec;
+			*next_ring = ring;
+		}
+	}
+
+	if (!next || !smp_load_acquire(&next->committed))
+		return NULL;
+
+	return next;
+}
+
+static void console_report_dropped(void)
+{
+	u32 dropped;
+	int cpu;
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		dropped = READ_ONCE(log_rings[cpu].dropped);
+		if (dropped == console_dropped[cpu])
+			continue;
+
+		puts("** ");
+		puts(dec(dropped - console_dropped[cpu]));
+		puts(" log records dropped on cpu-");
+		puts(dec(cpu));
+		puts(" **\n");
+		console_dropped[cpu] = dropped;
+	}
+}
+
+static void console_emit_prefix(struct log_record *rec)
+{
+	char buf[LOG_PREFIX_MAX];
+	string s;
+
+	ksinit(&s, buf, sizeof(buf) - 1);
+	log_prefix(&s, rec->ts, rec->cpu, rec->level, rec->module);
+	puts(s.str);
+}
+
+/* console_lock held, false if there was nothing to drain */
+static bool console_emit_next(void)
+{
+	struct log_ring *ring;
+	struct log_record *rec;
+	u16 i;
+
+	rec = console_next(&ring);
+	if (!rec) {
+		console_report_dropped();
+		return false;
+	}
+
+	if (rec->flags & LOG_CONSOLE) {
+		if (rec->module && !(rec->flags & LOG_CONT))
+			console_emit_prefix(rec);
+
+		for (i = 0; i < rec->len; i++)
+			putchar(rec->text[i]);
+	}
+
+	if (rec->flags & LOG_DMESG)
+		dmesg_store(rec);
+
+	smp_store_release(&ring->tail, ring->tail + 1);
+	return true;
+}
+
+/* drain every committed record now, unless another cpu is at it */
+void console_flush(void)
+{
+	if (!spin_trylock(&console_lock))
+		return;
+
+	while (console_emit_next())
+		;
+
+	spin_unlock(&console_lock);
+}
+
+/* the other threads of the cpu run between two records */
+static int console_thread(void *arg)
+{
+	bool more;
+
+	while (1) {
+		while (spin_trylock(&console_lock)) {
+			more = console_emit_next();
+			spin_unlock(&console_lock);
+			if (!more)
+				break;
+
+			schedule();
+		}
+
+		msleep(CONSOLE_POLL_MS);
+	}
+
+	return 0;
+}
+
+static int printk_stat_read(struct file *file, string *s)
+{
+	struct log_ring *ring;
+	int cpu;
+
+	ksappend(s, "seq:", dec(atomic_read(&log_seq)), "\n");
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!cpus[cpu].started)
+			continue;
+
+		ring = &log_rings[cpu];
+		ksappend(s, "cpu-", dec(cpu), " head:", dec(ring->head),
+			 " tail:", dec(ring->tail), " dropped:",
+			 dec(ring->dropped), "\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations printk_stat_fops = {
+	.read = printk_stat_read,
+};
+
+void console_init(void)
+{
+	spinlock_init(&console_lock);
+	dmesg_init();
+}
+
+int console_init_late(void)
+{
+	struct file *file;
+	int ret;
+
+	console_task = thread_run(console_thread, NULL, 0);
+	if (!console_task)
+		return -ENOMEM;
+
+	ret = create_file("printk", &printk_stat_fops, sys, NULL, &file);
+	if (ret)
+		return ret;
+
+	return dmesg_init_late();
+}
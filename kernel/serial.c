@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <x86.h>
+#include <irq.h>
 
 #define COM1 0x3F8
 
@@ -94,6 +95,21 @@ void serial_putc(int c)
 	serial_out(TX, c);
 }
 
+static void serial_irq_handler(void)
+{
+	while (serial_received())
+		stdio_push(serial_getc());
+}
+
+void serial_irq_init(void)
+{
+	if (!serial_exists)
+		return;
+
+	request_irq(IRQ_COM1, serial_irq_handler);
+	ioapic_enable(PIC_COM1, 0);
+}
+
 /**
  * serial_getc
  * get character from serial port
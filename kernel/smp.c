@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <smp.h>
+#include <ktime.h>
+#include <completion.h>
 #include <fs.h>
 #include <irq.h>
 #include <schedule.h>
@@ -12,11 +14,15 @@
 
 bool __smp_init = false;
 
+/* the kernel page directory the secondary cpus start paging with */
+static u32 *boot_pgdir;
+
 struct cpu cpus[MAX_CPU];
 
 extern volatile u8 ioapic_id;
 
-u32 cpu_id()
+/* the cpu number read from the lapic, for before %fs is set up */
+u32 hard_cpu_id(void)
 {
 	if (!__smp_init)
 		return 0;
@@ -174,6 +180,8 @@ int smp_init(struct mm_context *mm)
 		" version:", dec(config->version), s->str,
 		" lapic_addr:", hex(config->lapic_addr));
 
+	boot_pgdir = mm->pgdir;
+
 	lapic = (void *)config->lapic_addr;
 	page_map(mm->pgdir, (uint32_t)lapic, (uint32_t)lapic, PAGE_SIZE, PTE_W);
 
@@ -202,15 +210,21 @@ int smp_init_late(void)
 	return 0;
 }
 
+/* signaled by a secondary cpu once it is up */
+static struct completion cpu_online[MAX_CPU];
+
 void start_secondary(void) __attribute__((noreturn));
 
 void start_secondary(void)
 {
 	u32 next_cpu;
 
-	start_paging(current->proc->mm->pgdir);
+	/* %fs does not point to the area of this cpu before paging is on */
+	start_paging(boot_pgdir);
 	lapic_init();
+	tsc_sync_slave();
 	idt_init();
+	fpu_init(cpu_id());
 	schedule_init(cpu_id());
 	intr_enable();
 
@@ -222,10 +236,18 @@ void start_secondary(void)
 		cpu_up(next_cpu);
 
 	this_cpu()->started = true;
+	complete(&cpu_online[cpu_id()]);
 
-	while (1) {
-		halt();
-	}
+	cpu_idle_loop();
+}
+
+/* kick a cpu out of idle to pick up its run queue */
+void smp_send_reschedule(u32 cpu)
+{
+	if (cpu == cpu_id() || !cpus[cpu].init)
+		return;
+
+	lapic_send_ipi(cpus[cpu].processor->lapic_id, IRQ_RESCHED);
 }
 
 int cpu_up(u32 cpu)
@@ -243,12 +265,19 @@ int cpu_up(u32 cpu)
 
 	assert(c->id == c->processor->lapic_id);
 
+	init_completion(&cpu_online[cpu]);
+
 	lapic_startap(c->processor->lapic_id, virt_to_phys(code));
 
+	/* a cpu that never got here would never complete cpu_online either */
+	if (tsc_sync_master()) {
+		pr_err("cpu-", dec(c->id), " did not sync its tsc, giving up");
+		return -ETIMEDOUT;
+	}
+
 	pr_info("start cpu-", dec(c->id));
 
-	while (!c->started) {
-	}
+	wait_for_completion(&cpu_online[cpu]);
 
 	return 0;
 }
@@ -3,27 +3,23 @@
 #include <string.h>
 #include <queue.h>
 #include <lock.h>
+#include <wait.h>
+#include <timer.h>
+#include <register.h>
+#include <printk.h>
 
 #define STDIO_MAX_ARGS 128
 
-static string g_out_string[STDIO_MAX_ARGS];
-static char g_out_buf[STDIO_MAX_ARGS][128];
-static int index = 0;
-
 const char line_end[1];
 
 queue *stdio_que;
 
-spinlock_t pr_lock;
+/* input from keyboard and serial irqs, readers sleep on stdio_wait */
+static spinlock_t stdio_lock;
+static struct wait_queue_head stdio_wait;
 
-string *get_out_string(void)
-{
-	string *s;
-	index = (index + 1) % STDIO_MAX_ARGS;
-	s = &g_out_string[index];
-	ksinit(s, &g_out_buf[index][0], 128);
-	return s;
-}
+/* serial input is polled as well in case the com1 irq is not routed */
+#define STDIO_POLL_MS 100
 
 void putchar(int ch)
 {
@@ -49,39 +45,94 @@ int puts(const char *str)
  * print - print all args as string, check last string as end
  *
  * @end: the string used to check end
+ *
+ * the console thread prints it later, a caller that may wait drains the
+ * log rings itself when its ring is full instead of losing output.
  */
 int print_args(const char *end, ...)
 {
+	struct log_writer w;
 	char *p = NULL;
 	va_list args;
 	int n = 0;
 	int ret = 0;
 
-	spin_lock(&pr_lock);
+	log_open(&w, LOG_CONSOLE, LOG_INFO, NULL, true);
 
 	va_start(args, end);
 	while (p != end && n <= STDIO_MAX_ARGS) {
 		p = va_arg(args, char *);
-		ret += puts(p);
+		if (p != end && p) {
+			log_write(&w, p);
+			ret += strlen(p);
+		}
 		n++;
 	}
 	va_end(args);
 
-	spin_unlock(&pr_lock);
+	log_close(&w);
+	return ret;
+}
+
+static void printf_put(void *priv, const char *str, size_t len)
+{
+	log_writen(priv, str, len);
+}
+
+/* formatted straight into the log records, in one pass */
+int printf(const char *fmt, ...)
+{
+	struct log_writer w;
+	va_list args;
+	int ret;
+
+	log_open(&w, LOG_CONSOLE, LOG_INFO, NULL, true);
+
+	va_start(args, fmt);
+	ret = vformat(printf_put, &w, fmt, args);
+	va_end(args);
+
+	log_close(&w);
+	return ret;
+}
+
+/* called in irq context */
+void stdio_push(char c)
+{
+	spin_lock(&stdio_lock);
+	enqueue(stdio_que, char, c);
+	spin_unlock(&stdio_lock);
+
+	wake_up(&stdio_wait);
+}
+
+static bool stdio_pop(char *c)
+{
+	bool ret = true;
+	u32 flags;
+
+	spin_lock_irqsave(&stdio_lock, flags);
+
+	if (serial_received())
+		*c = serial_getc();
+	else if (!queue_empty(stdio_que))
+		*c = dequeue(stdio_que, char);
+	else
+		ret = false;
+
+	spin_unlock_irqrestore(&stdio_lock, flags);
 	return ret;
 }
 
 char readchar(void)
 {
-	while (1) {
-		if (serial_received())
-			return serial_getc();
+	char c;
 
-		if (!queue_empty(stdio_que))
-			return dequeue(stdio_que, char);
+	while (!wait_event_timeout(&stdio_wait, stdio_pop(&c),
+				   msecs_to_ticks(STDIO_POLL_MS)))
+		;
 
-		halt();
-	}
+	return c;
 }
 
 void readline(string *s)
@@ -104,7 +155,9 @@ void readline(string *s)
 void stdio_init(void)
 {
 	stdio_que = queue_create(char);
+	spinlock_init(&stdio_lock);
+	wait_queue_init(&stdio_wait);
 
 	serial_init();
-	spinlock_init(&pr_lock);
+	console_init();
 }
@@ -18,9 +18,15 @@
 #include <schedule.h>
 #include <debug.h>
 #include <smp.h>
+#include <percpu.h>
+#include <rcu.h>
 #include <kernel.h>
 #include <timer.h>
 #include <kmalloc.h>
+#include <register.h>
+#include <fs.h>
+#include <ktime.h>
+#include <wait.h>
 
 #define MODULE "timer"
 #define MODULE_DEBUG 0
@@ -45,106 +51,349 @@
 
 #define TIMER_DIV(x) ((TIMER_FREQ + (x) / 2) / (x))
 
-static struct time times[MAX_CPU];
-static struct list_node timer_lists[MAX_CPU];
+/* channel 2 is gated by port 0x61 and not wired to any irq */
+#define TIMER_CHANNEL2 0x80
+#define TIMER_MODE_ONESHOT 0x00
+#define IO_TIMER_GATE 0x61
+#define TIMER_GATE2 0x01
+#define TIMER_SPEAKER 0x02
+#define TIMER_OUT2 0x20
 
-static bool time_cmp(struct time *t1, struct time *t2)
+/*
+ * hashed hierarchical timer wheel, one per cpu
+ *
+ * tv1 holds the timers expiring in the next 256 ticks, one slot per tick.
+ * tvn[i] holds the timers expiring later, each slot covers 256 * 64^i
+ * ticks and is cascaded into the lower levels when the wheel wraps, so
+ * both insert and cancel are O(1) list operations.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_NUM 4
+#define MAX_TVAL ((1ULL << (TVR_BITS + TVN_NUM * TVN_BITS)) - 1)
+
+struct timer_base {
+	spinlock_t lock;
+
+	/* ticks elapsed on the clocksource, updated on timer irq */
+	u64 ticks;
+	/* next tick to be processed by the wheel */
+	u64 clk;
+
+	struct list_node tv1[TVR_SIZE];
+	struct list_node tvn[TVN_NUM][TVN_SIZE];
+};
+
+/* tickless idle statistics */
+struct tick_stat {
+	u32 timer_irqs;
+	u32 idle_entries;
+	u64 idle_ns;
+};
+
+static DEFINE_PER_CPU(struct timer_base, timer_bases);
+static DEFINE_PER_CPU(struct tick_stat, tick_stats);
+
+#define this_timer_base this_cpu_ptr(&timer_bases)
+
+#define TICK_NS (NSEC_PER_SEC / TICK_NUM)
+
+static u64 ktime_to_ticks(u64 ns)
+{
+	do_div(ns, TICK_NS);
+	return ns;
+}
+
+/* ticks are derived from the clocksource, so all cpus agree on them */
+static void tick_update(struct timer_base *base)
 {
-	if (t1->hours > t2->hours)
-		return true;
-	if (t1->hours < t2->hours)
-		return false;
+	base->ticks = ktime_to_ticks(ktime_ns());
+}
 
-	if (t1->minutes > t2->minutes)
-		return true;
-	if (t1->minutes < t2->minutes)
-		return false;
+static void wheel_insert(struct timer_base *base, struct timer *timer)
+{
+	u64 expires = timer->expires;
+	u64 idx = expires - base->clk;
+	struct list_node *vec;
+	int i;
+
+	if ((s64)idx < 0) {
+		/* already expired, run it with the next processed tick */
+		vec = &base->tv1[base->clk & TVR_MASK];
+	} else if (idx < TVR_SIZE) {
+		vec = &base->tv1[expires & TVR_MASK];
+	} else {
+		if (idx > MAX_TVAL) {
+			idx = MAX_TVAL;
+			expires = base->clk + idx;
+		}
 
-	if (t1->seconds * 1000 + t1->msecs >= t2->seconds * 1000 + t2->msecs)
-		return true;
+		for (i = 0; i < TVN_NUM - 1; i++) {
+			if (idx < (1ULL << (TVR_BITS + (i + 1) * TVN_BITS)))
+				break;
+		}
 
-	return false;
+		vec = &base->tvn[i][(expires >> (TVR_BITS + i * TVN_BITS)) &
+				    TVN_MASK];
+	}
+
+	list_insert_tail(vec, &timer->node);
 }
 
-static void time_add_ms(struct time *t, int msecs)
+/* re-insert all timers of one outer slot, they fall into lower levels */
+static int cascade(struct timer_base *base, int level)
 {
-	t->msecs += msecs;
-	t->seconds += t->msecs / 1000;
-	t->msecs = t->msecs % 1000;
+	int index = (base->clk >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+	struct list_node list, *node;
+	struct timer *timer;
 
-	t->minutes += t->seconds / 60;
-	t->seconds = t->seconds % 60;
+	list_init(&list);
+	list_splice_tail_init(&base->tvn[level][index], &list);
+
+	while (!list_empty(&list)) {
+		node = list_next(&list);
+		list_remove(node);
+		timer = container_of(node, struct timer, node);
+		wheel_insert(base, timer);
+	}
 
-	t->hours += t->minutes / 60;
-	t->minutes = t->minutes % 60;
+	return index;
 }
 
-static void time_add(struct time *t, int seconds)
+/*
+ * run_timers - collect every slot up to the current tick into one batch,
+ * then call the expired timers without holding the wheel lock.
+ */
+static void run_timers(struct timer_base *base)
 {
-	time_add_ms(t, seconds * 1000);
+	struct list_node work, *node;
+	struct timer *timer;
+	int index, level;
+
+	list_init(&work);
+
+	spin_lock(&base->lock);
+
+	while ((s64)(base->ticks - base->clk) >= 0) {
+		index = base->clk & TVR_MASK;
+
+		for (level = 0; !index && level < TVN_NUM; level++) {
+			if (cascade(base, level))
+				break;
+		}
+
+		list_splice_tail_init(&base->tv1[index], &work);
+		base->clk++;
+	}
+
+	while (!list_empty(&work)) {
+		node = list_next(&work);
+		list_remove(node);
+		timer = container_of(node, struct timer, node);
+		timer->base = NULL;
+
+		spin_unlock(&base->lock);
+		timer->fn(timer->data);
+		spin_lock(&base->lock);
+	}
+
+	spin_unlock(&base->lock);
 }
 
 static void timer_irq_handler()
 {
-	struct time *t = &times[cpu_id()];
-	struct list_node *node;
-	struct timer *timer;
+	struct timer_base *base = this_timer_base;
 
-	t->ticks++;
-	t->msecs = (t->ticks % 100) * 10;
+	this_cpu_inc(tick_stats.timer_irqs);
 
-	/* 1s = 100 ticks = 1000ms*/
-	if (t->ticks % TICK_NUM == 0)
-		time_add(t, 1);
+	tick_update(base);
+	run_timers(base);
+	rcu_process_callbacks();
+}
 
-	if (t->ticks == 0) {
-		/* find timerout timer */
-		node = list_next(&timer_lists[cpu_id()]);
-		while (node) {
-			timer = container_of(node, struct timer, node);
-			if (time_cmp(&timer->expired, t))
-				thread_wakeup(timer->thread);
+/*
+ * timer_next_expiry - the tick of the nearest pending timer, timers in
+ * the outer levels are reported at the next cascade of the wheel
+ */
+static u64 timer_next_expiry(struct timer_base *base)
+{
+	u64 clk = base->clk;
+	int i, level;
 
-			node = node->next;
+	for (i = 0; i < TVR_SIZE; i++) {
+		if (!list_empty(&base->tv1[(clk + i) & TVR_MASK]))
+			return clk + i;
+	}
+
+	for (level = 0; level < TVN_NUM; level++) {
+		for (i = 0; i < TVN_SIZE; i++) {
+			if (!list_empty(&base->tvn[level][i]))
+				return (clk | TVR_MASK) + 1;
 		}
+	}
 
-		schedule();
+	return clk + MAX_TVAL;
+}
+
+/*
+ * timer_idle - halt this cpu until the next pending timer or any other
+ * interrupt, with the periodic tick stopped in between
+ *
+ * called and returns with interrupts disabled.
+ */
+void timer_idle(void)
+{
+	struct timer_base *base = this_timer_base;
+	struct tick_stat *stat = this_cpu_ptr(&tick_stats);
+	u64 delta, start;
+	u32 count;
+
+	stat->idle_entries++;
+
+	rcu_process_callbacks();
+
+	spin_lock(&base->lock);
+	tick_update(base);
+	delta = timer_next_expiry(base) - base->ticks;
+	spin_unlock(&base->lock);
+
+	if ((s64)delta < 1)
+		delta = 1;
+
+	if (delta > 0xffffffff / lapic_timer_per_tick)
+		delta = 0xffffffff / lapic_timer_per_tick;
+
+	count = (u32)delta * lapic_timer_per_tick;
+
+	start = ktime_ns();
+	lapic_timer_oneshot(count);
+
+	/* our quiescent state may have ended the grace period we wait for */
+	rcu_idle_enter();
+	if (!rcu_pending())
+		safe_halt();
+	intr_disable();
+	rcu_idle_exit();
+
+	lapic_timer_periodic();
+	stat->idle_ns += ktime_ns() - start;
+
+	tick_update(base);
+	run_timers(base);
+}
+
+static void timer_base_init(struct timer_base *base)
+{
+	int i, level;
+
+	spinlock_init(&base->lock);
+	base->ticks = 0;
+	base->clk = 0;
+
+	for (i = 0; i < TVR_SIZE; i++)
+		list_init(&base->tv1[i]);
+
+	for (level = 0; level < TVN_NUM; level++) {
+		for (i = 0; i < TVN_SIZE; i++)
+			list_init(&base->tvn[level][i]);
 	}
 }
 
+/**
+ * pit_wait - busy wait @ms milliseconds on pit channel 2
+ * used to calibrate other clocks at boot, @ms must be less than 55
+ */
+void pit_wait(u32 ms)
+{
+	u32 count = TIMER_FREQ / 1000 * ms;
+	u8 gate;
+
+	gate = inb(IO_TIMER_GATE);
+	outb(IO_TIMER_GATE, (gate & ~TIMER_SPEAKER) | TIMER_GATE2);
+
+	outb(IO_TIMER_CMD, TIMER_CHANNEL2 | TIMER_MODE_ONESHOT | TIMER_BIT_16);
+	outb(IO_TIMER + 2, count % TIMER_OFFSET);
+	outb(IO_TIMER + 2, count / TIMER_OFFSET);
+
+	while (!(inb(IO_TIMER_GATE) & TIMER_OUT2))
+		;
+
+	outb(IO_TIMER_GATE, gate);
+}
+
 /**
  * timer_init - init 8253 pit
  * generate 100 timer interrupt per second
  */
 void timer_init(void)
 {
+	int cpu;
+
 	outb(IO_TIMER_CMD, TIMER_CHANNEL0 | TIMER_MODE_RATEGEN | TIMER_BIT_16);
 
 	outb(IO_TIMER, TIMER_DIV(TICK_NUM) % TIMER_OFFSET);
 	outb(IO_TIMER, TIMER_DIV(TICK_NUM) / TIMER_OFFSET);
 
 	/* pic_enable(PIC_TIMER); */
-	request_irq(IRQ_TIMER, timer_irq_handler);
+	clocksource_init();
 
-	list_init(&timer_lists[cpu_id()]);
+	/* cpus without an area of their own share the one of cpu 0 */
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!cpu || cpus[cpu].init)
+			timer_base_init(per_cpu_ptr(&timer_bases, cpu));
+	}
+
+	request_irq(IRQ_TIMER, timer_irq_handler);
 
 	pr_info("init timer success");
 }
 
 int time_now(struct time *t)
 {
-	memcpy(t, &times[cpu_id()], sizeof(struct time));
+	u64 ms = ktime_ms();
+	u32 secs;
+
+	t->ticks = ktime_to_ticks(ktime_ns());
+	t->msecs = do_div(ms, 1000);
+	secs = ms;
+
+	t->seconds = secs % 60;
+	t->minutes = secs / 60 % 60;
+	t->hours = secs / 3600;
 	return 0;
 }
 
 uint64_t time_ms(void)
 {
-	struct time *t = &times[cpu_id()];
-	return ((t->hours * 60 + t->minutes) * 60 + t->seconds) * 1000 +
-	       t->msecs;
+	return ktime_ms();
 }
 
-struct timer *timer_create(struct thread *thread, struct time *time_expired)
+u64 timer_ticks(void)
+{
+	return ktime_to_ticks(ktime_ns());
+}
+
+u64 msecs_to_ticks(u32 msecs)
+{
+	u32 tick_ms = 1000 / TICK_NUM;
+
+	return (msecs + tick_ms - 1) / tick_ms;
+}
+
+void timer_setup(struct timer *timer, timer_fn_t fn, void *data)
+{
+	timer->expires = 0;
+	timer->fn = fn;
+	timer->data = data;
+	timer->base = NULL;
+	list_init(&timer->node);
+}
+
+struct timer *timer_create(timer_fn_t fn, void *data)
 {
 	struct timer *t;
 
@@ -152,27 +401,193 @@ struct timer *timer_create(struct thread *thread, struct time *time_expired)
 	if (!t)
 		return NULL;
 
-	t->expired = *time_expired;
-	t->thread = thread;
-	list_init(&t->node);
+	timer_setup(t, fn, data);
 	return t;
 }
 
+/*
+ * timer_cancel - remove a pending timer from its wheel
+ *
+ * return 1 if the timer was pending, 0 otherwise.
+ */
+int timer_cancel(struct timer *timer)
+{
+	struct timer_base *base;
+	u32 flags;
+	int ret = 0;
+
+	/* the timer may be expired or re-armed on another cpu meanwhile */
+	while ((base = timer->base)) {
+		spin_lock_irqsave(&base->lock, flags);
+		if (timer->base == base) {
+			list_remove(&timer->node);
+			timer->base = NULL;
+			spin_unlock_irqrestore(&base->lock, flags);
+			ret = 1;
+			break;
+		}
+		spin_unlock_irqrestore(&base->lock, flags);
+	}
+
+	return ret;
+}
+
+/*
+ * timer_add - arm @timer on the wheel of this cpu, @expires is an
+ * absolute tick count of this cpu, see timer_ticks()
+ */
+int timer_add(struct timer *timer, u64 expires)
+{
+	struct timer_base *base;
+	u32 flags;
+
+	if (!timer->fn)
+		return -EINVAL;
+
+	timer_cancel(timer);
+
+	flags = intr_save();
+
+	base = this_timer_base;
+
+	spin_lock(&base->lock);
+	timer->expires = expires;
+	timer->base = base;
+	wheel_insert(base, timer);
+	spin_unlock(&base->lock);
+
+	intr_restore(flags);
+	return 0;
+}
+
 void sleep(int seconds)
 {
 	msleep(seconds * 1000);
 }
 
-void msleep(int msecs)
+static void process_timeout(void *data)
+{
+	thread_wakeup(data);
+}
+
+/*
+ * schedule_timeout - sleep until woken up or @timeout ticks elapsed,
+ * the caller marks current sleeping before, see wait_event_timeout()
+ *
+ * return the remaining ticks, 0 if timed out.
+ */
+long schedule_timeout(long timeout)
 {
 	struct timer timer;
+	u64 expires;
+	s64 left;
 
-	time_now(&timer.expired);
-	time_add_ms(&timer.expired, msecs);
-	timer.thread = current;
-	current->state = THREAD_SLEEPING;
+	expires = timer_ticks() + timeout;
 
-	list_insert_before(&timer.node, &timer_lists[cpu_id()]);
+	timer_setup(&timer, process_timeout, current);
+	timer_add(&timer, expires);
 	schedule();
-	list_remove(&timer.node);
-}
\ No newline at end of file
+	timer_cancel(&timer);
+
+	left = expires - timer_ticks();
+	return left < 0 ? 0 : left;
+}
+
+void msleep(int msecs)
+{
+	long timeout = msecs_to_ticks(msecs);
+
+	while (timeout) {
+		thread_sleep(current);
+		timeout = schedule_timeout(timeout);
+	}
+}
+
+#define TIMER_BENCH_NR 100000
+
+static void timer_bench_fn(void *data)
+{
+}
+
+static int timer_bench(struct file *file, vector *vec)
+{
+	struct timer *timers;
+	u64 start, add_ns, cancel_ns, now;
+	int i;
+
+	timers = kmalloc(sizeof(*timers) * TIMER_BENCH_NR);
+	if (!timers)
+		return -ENOMEM;
+
+	for (i = 0; i < TIMER_BENCH_NR; i++)
+		timer_setup(&timers[i], timer_bench_fn, NULL);
+
+	/* spread expiries over every level of the wheel */
+	now = timer_ticks();
+	start = ktime_ns();
+	for (i = 0; i < TIMER_BENCH_NR; i++)
+		timer_add(&timers[i], now + 1 + ((u64)(i % 4096) << (i % 20)));
+	add_ns = ktime_ns() - start;
+
+	start = ktime_ns();
+	for (i = 0; i < TIMER_BENCH_NR; i++)
+		timer_cancel(&timers[i]);
+	cancel_ns = ktime_ns() - start;
+
+	kfree(timers);
+
+	do_div(add_ns, TIMER_BENCH_NR);
+	do_div(cancel_ns, TIMER_BENCH_NR);
+
+	printk("timers: ", dec(TIMER_BENCH_NR), "\n");
+	printk("add:    ", dec(add_ns), " ns/op\n");
+	printk("cancel: ", dec(cancel_ns), " ns/op\n");
+	return 0;
+}
+
+static struct file_operations timer_bench_fops = {
+	.exec = timer_bench,
+};
+
+static int tick_stat_read(struct file *file, string *s)
+{
+	struct tick_stat *stat;
+	u64 idle_ms;
+	u32 uptime_ms;
+	int cpu;
+
+	uptime_ms = ktime_ms();
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!cpus[cpu].started)
+			continue;
+
+		stat = per_cpu_ptr(&tick_stats, cpu);
+		idle_ms = stat->idle_ns;
+		do_div(idle_ms, NSEC_PER_MSEC);
+
+		ksappend(s, "cpu-", dec(cpu), " irqs:", dec(irq_count(cpu)),
+			 " timer_irqs:", dec(stat->timer_irqs),
+			 " idle_entries:", dec(stat->idle_entries),
+			 " idle_ms:", dec(idle_ms), " uptime_ms:", dec(uptime_ms),
+			 " residency:",
+			 dec(uptime_ms ? (u32)idle_ms * 100 / uptime_ms : 0),
+			 "%\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations tick_stat_fops = {
+	.read = tick_stat_read,
+};
+
+int timer_init_late(void)
+{
+	struct file *file;
+
+	binfs_create_file("timer_bench", &timer_bench_fops, NULL, &file);
+	create_file("tick_stat", &tick_stat_fops, sys, NULL, &file);
+
+	return 0;
+}
@@ -2,6 +2,9 @@
 #include <string.h>
 #include <fifo.h>
 #include <x86.h>
+#include <atomic.h>
+#include <log2.h>
+#include <error.h>
 
 void fifo_init(struct fifo *fifo, void *data, unsigned int size)
 {
@@ -69,7 +72,7 @@ static void fifo_copy_out(struct fifo *fifo, void *dst, unsigned int len,
 	memcpy(dst, fifo->data + off, l);
 	memcpy(dst + l, fifo->data, len - l);
 
-	smp_wmb();
+	smp_mb();
 }
 
 int fifo_out(struct fifo *fifo, void *data, unsigned int size)
@@ -102,3 +105,313 @@ int fifo_skip(struct fifo *fifo, unsigned int size)
 	fifo->out = (fifo->out + size) % fifo->size;
 	return 0;
 }
+
+/* elements are a multiple of 4 bytes, copy them a word at a time */
+static inline void ring_copy(void *dst, const void *src, u32 bytes)
+{
+	const u32 *s = src;
+	u32 *d = dst;
+	u32 i;
+
+	for (i = 0; i < bytes / 4; i++)
+		d[i] = s[i];
+}
+
+static void ring_copy_in(void *data, u32 mask, u32 esize, u32 pos,
+			 const void *objs, u32 n)
+{
+	u32 idx = pos & mask;
+	u32 first = min(n, mask + 1 - idx);
+
+	ring_copy(data + idx * esize, objs, first * esize);
+	ring_copy(data, objs + first * esize, (n - first) * esize);
+}
+
+static void ring_copy_out(void *data, u32 mask, u32 esize, u32 pos,
+			  void *objs, u32 n)
+{
+	u32 idx = pos & mask;
+	u32 first = min(n, mask + 1 - idx);
+
+	ring_copy(objs, data + idx * esize, first * esize);
+	ring_copy(objs + first * esize, data, (n - first) * esize);
+}
+
+static int ring_check(void *data, u32 count, u32 esize)
+{
+	if (!data || !is_power_of_2(count) || !esize || esize % 4)
+		return -EINVAL;
+
+	return 0;
+}
+
+int spsc_ring_init(struct spsc_ring *r, void *data, u32 count, u32 esize)
+{
+	int ret = ring_check(data, count, esize);
+
+	if (ret)
+		return ret;
+
+	r->head = r->tail_cache = 0;
+	r->tail = r->head_cache = 0;
+	r->mask = count - 1;
+	r->esize = esize;
+	r->data = data;
+	return 0;
+}
+
+/* free slots seen by the producer, re-read tail only if too few */
+static u32 spsc_ring_free(struct spsc_ring *r, u32 head, u32 n)
+{
+	u32 free = r->mask + 1 - (head - r->tail_cache);
+
+	if (free >= n)
+		return free;
+
+	/* the consumer is done reading the slots it gave back */
+	r->tail_cache = smp_load_acquire(&r->tail);
+	return r->mask + 1 - (head - r->tail_cache);
+}
+
+static u32 spsc_ring_avail(struct spsc_ring *r, u32 tail, u32 n)
+{
+	u32 avail = r->head_cache - tail;
+
+	if (avail >= n)
+		return avail;
+
+	/* the producer's copy into the slots is visible */
+	r->head_cache = smp_load_acquire(&r->head);
+	return r->head_cache - tail;
+}
+
+static u32 __spsc_ring_enqueue(struct spsc_ring *r, const void *objs, u32 n,
+			       bool fixed)
+{
+	u32 head = r->head;
+	u32 free = spsc_ring_free(r, head, n);
+
+	if (free < n) {
+		if (fixed || !free)
+			return 0;
+		n = free;
+	}
+
+	ring_copy_in(r->data, r->mask, r->esize, head, objs, n);
+	smp_store_release(&r->head, head + n);
+	return n;
+}
+
+static u32 __spsc_ring_dequeue(struct spsc_ring *r, void *objs, u32 n,
+			       bool fixed)
+{
+	u32 tail = r->tail;
+	u32 avail = spsc_ring_avail(r, tail, n);
+
+	if (avail < n) {
+		if (fixed || !avail)
+			return 0;
+		n = avail;
+	}
+
+	ring_copy_out(r->data, r->mask, r->esize, tail, objs, n);
+	smp_store_release(&r->tail, tail + n);
+	return n;
+}
+
+u32 spsc_ring_enqueue_bulk(struct spsc_ring *r, const void *objs, u32 n)
+{
+	return __spsc_ring_enqueue(r, objs, n, true);
+}
+
+u32 spsc_ring_enqueue_burst(struct spsc_ring *r, const void *objs, u32 n)
+{
+	return __spsc_ring_enqueue(r, objs, n, false);
+}
+
+u32 spsc_ring_dequeue_bulk(struct spsc_ring *r, void *objs, u32 n)
+{
+	return __spsc_ring_dequeue(r, objs, n, true);
+}
+
+u32 spsc_ring_dequeue_burst(struct spsc_ring *r, void *objs, u32 n)
+{
+	return __spsc_ring_dequeue(r, objs, n, false);
+}
+
+/* up to *@n free slots in a row to fill in place, NULL if the ring is full */
+void *spsc_ring_reserve(struct spsc_ring *r, u32 *n)
+{
+	u32 head = r->head;
+	u32 idx = head & r->mask;
+	u32 free = spsc_ring_free(r, head, *n);
+
+	free = min(free, r->mask + 1 - idx);
+	if (!free)
+		return NULL;
+
+	*n = min(*n, free);
+	return r->data + idx * r->esize;
+}
+
+void spsc_ring_commit(struct spsc_ring *r, u32 n)
+{
+	smp_store_release(&r->head, r->head + n);
+}
+
+/* up to *@n filled slots in a row to read in place, NULL if empty */
+void *spsc_ring_peek(struct spsc_ring *r, u32 *n)
+{
+	u32 tail = r->tail;
+	u32 idx = tail & r->mask;
+	u32 avail = spsc_ring_avail(r, tail, *n);
+
+	avail = min(avail, r->mask + 1 - idx);
+	if (!avail)
+		return NULL;
+
+	*n = min(*n, avail);
+	return r->data + idx * r->esize;
+}
+
+void spsc_ring_consume(struct spsc_ring *r, u32 n)
+{
+	smp_store_release(&r->tail, r->tail + n);
+}
+
+int mpmc_ring_init(struct mpmc_ring *r, void *data, u32 count, u32 esize)
+{
+	int ret = ring_check(data, count, esize);
+
+	if (ret)
+		return ret;
+
+	r->prod.head = r->prod.tail = 0;
+	r->cons.head = r->cons.tail = 0;
+	r->mask = count - 1;
+	r->esize = esize;
+	r->data = data;
+	return 0;
+}
+
+/*
+ * ring_move_head - claim up to @n slots of one side
+ * @capacity: the slot count for producers, 0 for consumers
+ * @contig:   do not claim past the end of the ring
+ *
+ * returns the number claimed and their first position in *@pos.
+ */
+static u32 ring_move_head(struct mpmc_ring *r, struct ring_headtail *ht,
+			  volatile u32 *other_tail, u32 capacity, u32 n,
+			  bool fixed, bool contig, u32 *pos)
+{
+	u32 head, entries, m;
+
+	do {
+		head = READ_ONCE(ht->head);
+		entries = capacity + smp_load_acquire(other_tail) - head;
+		if (contig)
+			entries = min(entries, r->mask + 1 - (head & r->mask));
+
+		m = n;
+		if (entries < m) {
+			if (fixed || !entries)
+				return 0;
+			m = entries;
+		}
+	} while (cmpxchg(&ht->head, (int)head, (int)(head + m)) != (int)head);
+
+	*pos = head;
+	return m;
+}
+
+/* publish in claim order, earlier claims of other cpus go first */
+static void ring_update_tail(struct ring_headtail *ht, u32 pos, u32 n)
+{
+	while (READ_ONCE(ht->tail) != pos)
+		cpu_relax();
+
+	smp_store_release(&ht->tail, pos + n);
+}
+
+static u32 __mpmc_ring_enqueue(struct mpmc_ring *r, const void *objs, u32 n,
+			       bool fixed)
+{
+	u32 pos;
+
+	n = ring_move_head(r, &r->prod, &r->cons.tail, r->mask + 1, n, fixed,
+			   false, &pos);
+	if (!n)
+		return 0;
+
+	ring_copy_in(r->data, r->mask, r->esize, pos, objs, n);
+	ring_update_tail(&r->prod, pos, n);
+	return n;
+}
+
+static u32 __mpmc_ring_dequeue(struct mpmc_ring *r, void *objs, u32 n,
+			       bool fixed)
+{
+	u32 pos;
+
+	n = ring_move_head(r, &r->cons, &r->prod.tail, 0, n, fixed, false,
+			   &pos);
+	if (!n)
+		return 0;
+
+	ring_copy_out(r->data, r->mask, r->esize, pos, objs, n);
+	ring_update_tail(&r->cons, pos, n);
+	return n;
+}
+
+u32 mpmc_ring_enqueue_bulk(struct mpmc_ring *r, const void *objs, u32 n)
+{
+	return __mpmc_ring_enqueue(r, objs, n, true);
+}
+
+u32 mpmc_ring_enqueue_burst(struct mpmc_ring *r, const void *objs, u32 n)
+{
+	return __mpmc_ring_enqueue(r, objs, n, false);
+}
+
+u32 mpmc_ring_dequeue_bulk(struct mpmc_ring *r, void *objs, u32 n)
+{
+	return __mpmc_ring_dequeue(r, objs, n, true);
+}
+
+u32 mpmc_ring_dequeue_burst(struct mpmc_ring *r, void *objs, u32 n)
+{
+	return __mpmc_ring_dequeue(r, objs, n, false);
+}
+
+/* claim up to *@n free slots in a row, others wait for the commit */
+void *mpmc_ring_reserve(struct mpmc_ring *r, u32 *n, u32 *pos)
+{
+	*n = ring_move_head(r, &r->prod, &r->cons.tail, r->mask + 1, *n,
+			    false, true, pos);
+	if (!*n)
+		return NULL;
+
+	return r->data + (*pos & r->mask) * r->esize;
+}
+
+void mpmc_ring_commit(struct mpmc_ring *r, u32 pos, u32 n)
+{
+	ring_update_tail(&r->prod, pos, n);
+}
+
+/* claim up to *@n filled slots in a row, the claim is not undone */
+void *mpmc_ring_peek(struct mpmc_ring *r, u32 *n, u32 *pos)
+{
+	*n = ring_move_head(r, &r->cons, &r->prod.tail, 0, *n, false, true,
+			    pos);
+	if (!*n)
+		return NULL;
+
+	return r->data + (*pos & r->mask) * r->esize;
+}
+
+void mpmc_ring_consume(struct mpmc_ring *r, u32 pos, u32 n)
+{
+	ring_update_tail(&r->cons, pos, n);
+}
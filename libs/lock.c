@@ -2,20 +2,279 @@
 #include <x86.h>
 #include <debug.h>
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <percpu.h>
 
 #define MODULE "lock"
 #define MODULE_DEBUG 0
 
-void spin_lock(spinlock_t *lock)
+struct lock_class *lock_classes;
+
+struct mcs_node_pool {
+	u32 mask;
+	struct mcs_node nodes[MCS_NODES];
+};
+
+static DEFINE_PER_CPU(struct mcs_node_pool, mcs_node_pools);
+
+static inline u16 xadd16(volatile u16 *ptr, u16 val)
+{
+	asm volatile("lock xaddw %0, %1"
+		     : "+r"(val), "+m"(*ptr)
+		     :
+		     : "memory");
+	return val;
+}
+
+void tas_lock(tas_lock_t *lock)
+{
+	do {
+		while (lock->locked)
+			cpu_relax();
+	} while (cmpxchg(&lock->locked, 0, 1));
+}
+
+bool tas_trylock(tas_lock_t *lock)
+{
+	return !lock->locked && !cmpxchg(&lock->locked, 0, 1);
+}
+
+void ticket_lock(ticket_lock_t *lock)
+{
+	u16 ticket = xadd16(&lock->next, 1);
+
+	while (lock->owner != ticket)
+		cpu_relax();
+
+	barrier();
+}
+
+bool ticket_trylock(ticket_lock_t *lock)
+{
+	volatile int *word = (volatile int *)lock;
+	int old = *word;
+
+	/* owner is the low half, next the high half */
+	if ((u16)old != (u16)(old >> 16))
+		return false;
+
+	return cmpxchg(word, old, (int)((u32)old + (1 << 16))) == old;
+}
+
+/* nodes are taken and put back on the same cpu, irqs may nest in between */
+static struct mcs_node *mcs_node_get(void)
+{
+	struct mcs_node_pool *pool = this_cpu_ptr(&mcs_node_pools);
+	int i;
+
+	for (i = 0; i < MCS_NODES; i++) {
+		if (!__test_and_set_bit(i, &pool->mask))
+			return &pool->nodes[i];
+	}
+
+	BUG_ON(0, "mcs nodes exhausted on cpu-", dec(cpu_id()));
+	return NULL;
+}
+
+static void mcs_node_put(struct mcs_node *node)
+{
+	struct mcs_node_pool *pool = this_cpu_ptr(&mcs_node_pools);
+
+	__clear_bit(node - pool->nodes, &pool->mask);
+}
+
+void mcs_lock(mcs_lock_t *lock)
+{
+	struct mcs_node *node = mcs_node_get();
+	struct mcs_node *prev;
+
+	node->next = NULL;
+	node->locked = 1;
+
+	prev = xchg(&lock->tail, node);
+	if (prev) {
+		prev->next = node;
+		while (node->locked)
+			cpu_relax();
+	}
+
+	barrier();
+	lock->node = node;
+}
+
+bool mcs_trylock(mcs_lock_t *lock)
+{
+	struct mcs_node *node;
+
+	if (lock->tail)
+		return false;
+
+	node = mcs_node_get();
+	node->next = NULL;
+
+	if (cmpxchg(&lock->tail, 0, (int)node)) {
+		mcs_node_put(node);
+		return false;
+	}
+
+	lock->node = node;
+	return true;
+}
+
+void mcs_unlock(mcs_lock_t *lock)
+{
+	struct mcs_node *node = lock->node;
+
+	barrier();
+
+	if (!node->next) {
+		if (cmpxchg(&lock->tail, (int)node, 0) == (int)node)
+			goto out;
+
+		/* a waiter swapped the tail but has not linked itself yet */
+		while (!node->next)
+			cpu_relax();
+	}
+
+	node->next->locked = 0;
+out:
+	mcs_node_put(node);
+}
+
+#ifdef LOCK_STAT
+static void lock_class_register(struct lock_class *class)
 {
-	int count = 0;
+	struct lock_class *head;
+
+	if (cmpxchg(&class->registered, 0, 1))
+		return;
 
 	do {
-		while (atomic_read(lock) != 0) {
+		head = lock_classes;
+		class->next = head;
+	} while (cmpxchg(&lock_classes, (int)head, (int)class) != (int)head);
+}
+#endif
+
+void __spinlock_init(spinlock_t *lock, struct lock_class *class)
+{
+	memset(&lock->raw, 0, sizeof(lock->raw));
+
+#ifdef LOCK_STAT
+	lock_class_register(class);
+	lock->class = class;
+#endif
+}
+
+#ifdef LOCK_STAT
+static void lock_stat_acquired(spinlock_t *lock, u64 wait)
+{
+	struct lock_class_stat *stat;
+
+	/* locks never passed to spinlock_init() are not accounted */
+	if (!lock->class)
+		return;
+
+	stat = &lock->class->stats[cpu_id()];
+	stat->acquired++;
+
+	if (!wait)
+		return;
+
+	stat->contended++;
+	stat->wait_cycles += wait;
+	if (wait > stat->max_wait_cycles)
+		stat->max_wait_cycles = wait;
+}
+
+void spin_lock(spinlock_t *lock)
+{
+	u64 start;
+
+	preempt_disable();
+
+	if (arch_spin_trylock(&lock->raw)) {
+		lock_stat_acquired(lock, 0);
+		return;
+	}
+
+	start = rdtsc();
+	arch_spin_lock(&lock->raw);
+	lock_stat_acquired(lock, rdtsc() - start);
+}
+#else
+void spin_lock(spinlock_t *lock)
+{
+	preempt_disable();
+	arch_spin_lock(&lock->raw);
+}
+#endif
+
+bool spin_trylock(spinlock_t *lock)
+{
+	preempt_disable();
+
+	if (!arch_spin_trylock(&lock->raw)) {
+		preempt_enable();
+		return false;
+	}
+
+#ifdef LOCK_STAT
+	lock_stat_acquired(lock, 0);
+#endif
+	return true;
+}
+
+void read_lock(rwlock_t *lock)
+{
+	bool irq = in_irq();
+	int count;
+
+	preempt_disable();
+
+	while (1) {
+		while (lock->count == RW_WRITER || (!irq && lock->writers))
 			cpu_relax();
 
-			assert(count++ < 10000000);
-		}
-	} while (cmpxchg(&lock->counter, 0, 1));
+		count = lock->count;
+		if (count != RW_WRITER && cmpxchg(&lock->count, count,
+						  count + 1) == count)
+			break;
+	}
 }
 
+void read_unlock(rwlock_t *lock)
+{
+	xadd(&lock->count, -1);
+	preempt_enable();
+}
+
+void write_lock(rwlock_t *lock)
+{
+	preempt_disable();
+
+	xadd(&lock->writers, 1);
+
+	while (lock->count || cmpxchg(&lock->count, 0, RW_WRITER))
+		cpu_relax();
+
+	xadd(&lock->writers, -1);
+}
+
+void write_unlock(rwlock_t *lock)
+{
+	smp_store_release(&lock->count, 0);
+	preempt_enable();
+}
+
+const char *spinlock_type(void)
+{
+#if SPINLOCK_TYPE == SPINLOCK_TICKET
+	return "ticket";
+#elif SPINLOCK_TYPE == SPINLOCK_MCS
+	return "mcs";
+#else
+	return "tas";
+#endif
+}
@@ -8,6 +8,8 @@
 #include <log2.h>
 #include <vector.h>
 #include <stdarg.h>
+#include <memcpy.h>
+#include <stdlib.h>
 
 #define MODULE "string"
 #define MODULE_DEBUG 0
@@ -16,6 +18,39 @@ const char ksappend_end[1];
 static const char *__str_hex = "0123456789abcdef";
 #define STRING_MIN_SIZE 32
 
+/*
+ * word at a time helpers. words are only read at aligned addresses, an
+ * aligned word never crosses a page, so a scan never touches the page
+ * after the terminating '\0'.
+ */
+#define WORD_SIZE sizeof(unsigned long)
+#define REPEAT_BYTE(x) ((~0UL / 0xff) * (u8)(x))
+
+/* the lowest set bit marks the first zero byte, higher ones may be false */
+static inline unsigned long has_zero(unsigned long v)
+{
+	return (v - REPEAT_BYTE(0x01)) & ~v & REPEAT_BYTE(0x80);
+}
+
+/* little endian, the first byte in memory is the lowest one */
+static inline unsigned long zero_byte_index(unsigned long mask)
+{
+	return __builtin_ctzl(mask) >> 3;
+}
+
+static inline const unsigned long *word_align(const char *s)
+{
+	return (const unsigned long *)((unsigned long)s & ~(WORD_SIZE - 1));
+}
+
+/* first aligned word of @s, the bytes before @s are made non zero */
+static inline unsigned long first_word(const char *s)
+{
+	unsigned long off = (unsigned long)s & (WORD_SIZE - 1);
+
+	return *word_align(s) | ((1UL << (off * 8)) - 1);
+}
+
 /* *
  * strlen - calculate the length of the string @s, not including
  * the terminating '\0' character.
@@ -25,11 +60,13 @@ static const char *__str_hex = "0123456789abcdef";
  * */
 size_t strlen(const char *s)
 {
-	size_t cnt = 0;
-	while (*s++ != '\0') {
-		cnt++;
-	}
-	return cnt;
+	const unsigned long *w = word_align(s);
+	unsigned long v = first_word(s);
+
+	while (!has_zero(v))
+		v = *++w;
+
+	return (const char *)w + zero_byte_index(has_zero(v)) - s;
 }
 
 /* *
@@ -47,11 +84,24 @@ size_t strlen(const char *s)
  * */
 size_t strnlen(const char *s, size_t len)
 {
-	size_t cnt = 0;
-	while (cnt < len && *s++ != '\0') {
-		cnt++;
+	const unsigned long *w = word_align(s);
+	unsigned long v, zero;
+	size_t cnt;
+
+	if (!len)
+		return 0;
+
+	for (v = first_word(s);; v = *++w) {
+		zero = has_zero(v);
+		if (zero) {
+			cnt = (const char *)w + zero_byte_index(zero) - s;
+			return min(cnt, len);
+		}
+
+		/* never read the word after the one holding s[len - 1] */
+		if ((size_t)((const char *)(w + 1) - s) >= len)
+			return len;
 	}
-	return cnt;
 }
 
 /* *
@@ -117,14 +167,30 @@ char *strncpy(char *dst, const char *src, size_t len)
  * */
 int strcmp(const char *s1, const char *s2)
 {
-#ifdef __HAVE_ARCH_STRCMP
-	return __strcmp(s1, s2);
-#else
+	const unsigned long *w1, *w2;
+
+	/* with the same offset in a word both strings reach alignment */
+	if (!(((unsigned long)s1 ^ (unsigned long)s2) & (WORD_SIZE - 1))) {
+		while ((unsigned long)s1 & (WORD_SIZE - 1)) {
+			if (*s1 == '\0' || *s1 != *s2)
+				goto out;
+			s1++, s2++;
+		}
+
+		w1 = (const unsigned long *)s1;
+		w2 = (const unsigned long *)s2;
+		while (*w1 == *w2 && !has_zero(*w1))
+			w1++, w2++;
+
+		s1 = (const char *)w1;
+		s2 = (const char *)w2;
+	}
+
 	while (*s1 != '\0' && *s1 == *s2) {
 		s1++, s2++;
 	}
+out:
 	return (int)((unsigned char)*s1 - (unsigned char)*s2);
-#endif /* __HAVE_ARCH_STRCMP */
 }
 
 /* *
@@ -157,13 +223,9 @@ int strncmp(const char *s1, const char *s2, size_t n)
  * */
 char *strchr(const char *s, char c)
 {
-	while (*s != '\0') {
-		if (*s == c) {
-			return (char *)s;
-		}
-		s++;
-	}
-	return NULL;
+	char *p = strfind(s, c);
+
+	return *p == c && c != '\0' ? p : NULL;
 }
 
 /* *
@@ -177,13 +239,20 @@ char *strchr(const char *s, char c)
  * */
 char *strfind(const char *s, char c)
 {
-	while (*s != '\0') {
-		if (*s == c) {
-			break;
-		}
-		s++;
+	const unsigned long *w = word_align(s);
+	unsigned long pattern = REPEAT_BYTE(c);
+	unsigned long off = (unsigned long)s & (WORD_SIZE - 1);
+	unsigned long before = (1UL << (off * 8)) - 1;
+	unsigned long v = *w, mask;
+
+	/* bytes before @s match neither '\0' nor @c */
+	mask = has_zero(v | before) | has_zero((v ^ pattern) | before);
+	while (!mask) {
+		v = *++w;
+		mask = has_zero(v) | has_zero(v ^ pattern);
 	}
-	return (char *)s;
+
+	return (char *)w + zero_byte_index(mask);
 }
 
 /* *
@@ -283,7 +352,7 @@ long strtol(const char *s, char **endptr, int base)
 void *memset(void *s, char c, size_t n)
 {
 #ifdef __HAVE_ARCH_MEMSET
-	return __memset(s, c, n);
+	return arch_memset(s, c, n);
 #else
 	char *p = s;
 	while (n-- > 0) {
@@ -305,7 +374,7 @@ void *memset(void *s, char c, size_t n)
 void *memmove(void *dst, const void *src, size_t n)
 {
 #ifdef __HAVE_ARCH_MEMMOVE
-	return __memmove(dst, src, n);
+	return arch_memmove(dst, src, n);
 #else
 	const char *s = src;
 	char *d = dst;
@@ -340,7 +409,7 @@ void *memmove(void *dst, const void *src, size_t n)
 void *memcpy(void *dst, const void *src, size_t n)
 {
 #ifdef __HAVE_ARCH_MEMCPY
-	return __memcpy(dst, src, n);
+	return arch_memcpy(dst, src, n);
 #else
 	const char *s = src;
 	char *d = dst;
@@ -367,6 +436,9 @@ void *memcpy(void *dst, const void *src, size_t n)
  * */
 int memcmp(const void *v1, const void *v2, size_t n)
 {
+#ifdef __HAVE_ARCH_MEMCMP
+	return arch_memcmp(v1, v2, n);
+#else
 	const char *s1 = (const char *)v1;
 	const char *s2 = (const char *)v2;
 	while (n-- > 0) {
@@ -376,6 +448,7 @@ int memcmp(const void *v1, const void *v2, size_t n)
 		s1++, s2++;
 	}
 	return 0;
+#endif /* __HAVE_ARCH_MEMCMP */
 }
 
 void reverse_str(char *buf, int i, int j)
@@ -438,6 +511,356 @@ int to_hex(unsigned int val, char *buf, int len)
 	return i;
 }
 
+/*
+ * vformat - the printf of the kernel, every piece of output goes to @put
+ *
+ * %[-0#][width][.prec][hh|h|l|ll|z] with d i u x X p c s and %%. width and
+ * precision may be *, ll is 64 bits and %p prints like hex(). nothing is
+ * buffered but the digits of one number, so the same pass serves a fixed
+ * buffer, a string or a log record.
+ */
+#define FORMAT_LEFT (1 << 0)
+#define FORMAT_ZERO (1 << 1)
+#define FORMAT_ALT (1 << 2)
+#define FORMAT_SIGNED (1 << 3)
+#define FORMAT_UPPER (1 << 4)
+/* 0x even for 0 */
+#define FORMAT_PTR (1 << 5)
+
+struct format_spec {
+	u32 flags;
+	u32 base;
+	int width;
+	/* -1 if there is none */
+	int prec;
+};
+
+static const char __str_zeros[] = "0000000000000000";
+static const char __str_spaces[] = "                ";
+
+static size_t format_pad(format_put_t put, void *priv, char c, int n)
+{
+	const char *pad = c == '0' ? __str_zeros : __str_spaces;
+	size_t len = max(n, 0);
+
+	for (; n > 0; n -= sizeof(__str_zeros) - 1)
+		put(priv, pad, min(n, (int)sizeof(__str_zeros) - 1));
+
+	return len;
+}
+
+/* the prefix, zeros up to the precision and the digits, padded to width */
+static size_t format_number(format_put_t put, void *priv,
+			    unsigned long long val, struct format_spec *spec)
+{
+	const char *digits = spec->flags & FORMAT_UPPER ? "0123456789ABCDEF" :
+							  __str_hex;
+	const char *prefix = "";
+	/* 20 digits for 64 bits */
+	char buf[24];
+	int i = 0, zeros, pad;
+	size_t len = 0;
+
+	if ((spec->flags & FORMAT_SIGNED) && (long long)val < 0) {
+		prefix = "-";
+		val = -val;
+	} else if ((spec->flags & FORMAT_ALT) && spec->base == 16 &&
+		   (val || (spec->flags & FORMAT_PTR))) {
+		prefix = spec->flags & FORMAT_UPPER ? "0X" : "0x";
+	}
+
+	/* no digits for 0 at precision 0 */
+	while (val || (!i && spec->prec))
+		buf[i++] = digits[do_div(val, spec->base)];
+	reverse_str(buf, 0, i - 1);
+
+	zeros = max(spec->prec - i, 0);
+	pad = spec->width - (int)strlen(prefix) - zeros - i;
+	if ((spec->flags & (FORMAT_ZERO | FORMAT_LEFT)) == FORMAT_ZERO &&
+	    spec->prec < 0) {
+		zeros += max(pad, 0);
+		pad = 0;
+	}
+
+	if (!(spec->flags & FORMAT_LEFT))
+		len += format_pad(put, priv, ' ', pad);
+
+	put(priv, prefix, strlen(prefix));
+	len += strlen(prefix) + format_pad(put, priv, '0', zeros);
+	put(priv, buf, i);
+	len += i;
+
+	if (spec->flags & FORMAT_LEFT)
+		len += format_pad(put, priv, ' ', pad);
+
+	return len;
+}
+
+/* at most the precision of @str, padded to width */
+static size_t format_str(format_put_t put, void *priv, const char *str,
+			 struct format_spec *spec)
+{
+	size_t len, n;
+	int pad;
+
+	if (!str)
+		str = "(null)";
+
+	n = spec->prec < 0 ? strlen(str) : strnlen(str, spec->prec);
+	pad = spec->width - (int)n;
+	len = n;
+
+	if (!(spec->flags & FORMAT_LEFT))
+		len += format_pad(put, priv, ' ', pad);
+
+	put(priv, str, n);
+
+	if (spec->flags & FORMAT_LEFT)
+		len += format_pad(put, priv, ' ', pad);
+
+	return len;
+}
+
+static int format_atoi(const char **fmt)
+{
+	int val = 0;
+
+	while (**fmt >= '0' && **fmt <= '9')
+		val = val * 10 + *(*fmt)++ - '0';
+
+	return val;
+}
+
+int vformat(format_put_t put, void *priv, const char *fmt, va_list args)
+{
+	struct format_spec spec;
+	unsigned long long val;
+	const char *start;
+	size_t len = 0;
+	int qual;
+	char c;
+
+	while (*fmt) {
+		for (start = fmt; *fmt && *fmt != '%'; fmt++)
+			;
+		if (fmt != start) {
+			put(priv, start, fmt - start);
+			len += fmt - start;
+		}
+
+		if (!*fmt++)
+			break;
+
+		spec.flags = 0;
+		for (;; fmt++) {
+			if (*fmt == '-')
+				spec.flags |= FORMAT_LEFT;
+			else if (*fmt == '0')
+				spec.flags |= FORMAT_ZERO;
+			else if (*fmt == '#')
+				spec.flags |= FORMAT_ALT;
+			else
+				break;
+		}
+
+		if (*fmt == '*') {
+			fmt++;
+			spec.width = va_arg(args, int);
+			if (spec.width < 0) {
+				spec.flags |= FORMAT_LEFT;
+				spec.width = -spec.width;
+			}
+		} else {
+			spec.width = format_atoi(&fmt);
+		}
+
+		spec.prec = -1;
+		if (*fmt == '.') {
+			fmt++;
+			if (*fmt == '*') {
+				fmt++;
+				spec.prec = va_arg(args, int);
+				if (spec.prec < 0)
+					spec.prec = -1;
+			} else {
+				spec.prec = format_atoi(&fmt);
+			}
+		}
+
+		/* l and ll count up, h and hh down, z is an int here */
+		for (qual = 0;; fmt++) {
+			if (*fmt == 'l')
+				qual++;
+			else if (*fmt == 'h')
+				qual--;
+			else if (*fmt != 'z')
+				break;
+		}
+
+		spec.base = 10;
+		switch (c = *fmt++) {
+		case 'c':
+			c = va_arg(args, int);
+			if (!(spec.flags & FORMAT_LEFT))
+				len += format_pad(put, priv, ' ', spec.width - 1);
+			put(priv, &c, 1);
+			len++;
+			if (spec.flags & FORMAT_LEFT)
+				len += format_pad(put, priv, ' ', spec.width - 1);
+			continue;
+		case 's':
+			len += format_str(put, priv, va_arg(args, const char *),
+					  &spec);
+			continue;
+		case 'p':
+			spec.flags |= FORMAT_ALT | FORMAT_PTR;
+			spec.base = 16;
+			spec.prec = 2 * sizeof(void *);
+			val = (unsigned long)va_arg(args, void *);
+			len += format_number(put, priv, val, &spec);
+			continue;
+		case 'X':
+			spec.flags |= FORMAT_UPPER;
+			/* fall through */
+		case 'x':
+			spec.base = 16;
+			/* fall through */
+		case 'u':
+			if (qual > 1)
+				val = va_arg(args, unsigned long long);
+			else if (qual == 1)
+				val = va_arg(args, unsigned long);
+			else
+				val = va_arg(args, unsigned int);
+
+			if (qual == -1)
+				val = (unsigned short)val;
+			else if (qual < -1)
+				val = (unsigned char)val;
+			break;
+		case 'd':
+		case 'i':
+			spec.flags |= FORMAT_SIGNED;
+			if (qual > 1)
+				val = va_arg(args, long long);
+			else if (qual == 1)
+				val = va_arg(args, long);
+			else
+				val = va_arg(args, int);
+
+			if (qual == -1)
+				val = (short)val;
+			else if (qual < -1)
+				val = (signed char)val;
+			break;
+		case '%':
+			put(priv, "%", 1);
+			len++;
+			continue;
+		default:
+			/* not a conversion, printed as it is */
+			put(priv, "%", 1);
+			len++;
+			if (!c) {
+				fmt--;
+				continue;
+			}
+			put(priv, &c, 1);
+			len++;
+			continue;
+		}
+
+		len += format_number(put, priv, val, &spec);
+	}
+
+	return len;
+}
+
+struct format_buf {
+	char *buf;
+	size_t size;
+	/* of the whole output, the part past size - 1 is lost */
+	size_t len;
+};
+
+static void format_buf_put(void *priv, const char *str, size_t len)
+{
+	struct format_buf *b = priv;
+
+	if (b->len + 1 < b->size)
+		memcpy(b->buf + b->len, str, min(len, b->size - 1 - b->len));
+
+	b->len += len;
+}
+
+/*
+ * vsnprintf - at most @size bytes into @buf with the '\0', returns the
+ * length of the whole output like the C one
+ */
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+	struct format_buf b = { .buf = buf, .size = size };
+
+	vformat(format_buf_put, &b, fmt, args);
+	if (size)
+		buf[min(b.len, size - 1)] = '\0';
+
+	return b.len;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+
+	return ret;
+}
+
+struct format_string {
+	string *s;
+	int ret;
+};
+
+static void format_string_put(void *priv, const char *str, size_t len)
+{
+	struct format_string *fs = priv;
+
+	/* ksappend_strn() stops at a '\0', which %c may put out */
+	if (strnlen(str, len) == len) {
+		if (!fs->ret)
+			fs->ret = ksappend_strn(fs->s, str, len);
+		return;
+	}
+
+	while (!fs->ret && len--)
+		fs->ret = ksappend_char(fs->s, *str++);
+}
+
+/* appended to @s in the same pass, 0 or the error of growing it */
+int ksvprintf(string *s, const char *fmt, va_list args)
+{
+	struct format_string fs = { .s = s };
+
+	vformat(format_string_put, &fs, fmt, args);
+	return fs.ret;
+}
+
+int ksprintf(string *s, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = ksvprintf(s, fmt, args);
+	va_end(args);
+
+	return ret;
+}
+
 void ksinit(string *s, char *buf, size_t size)
 {
 	s->str = buf;
@@ -536,14 +959,13 @@ int ksappend_strn(string *s, const char *str, size_t length)
 	if (!str)
 		return 0;
 
-	if (strlen(str) < length)
-		length = strlen(str);
+	length = strnlen(str, length);
 
 	ret = string_try_expand(s, s->length + length);
 	if (ret)
 		return ret;
 
-	strncpy(s->str + s->length, str, length);
+	memcpy(s->str + s->length, str, length);
 	s->length += length;
 	s->str[s->length] = 0;
 	return 0;
@@ -572,43 +994,37 @@ int ksappend_args(string *s, const char *end, ...)
 
 int ksappend_int(string *s, int val)
 {
-	char buf[32];
-	int length;
-
-	length = to_str(val, buf, 32);
-	return ksappend_strn(s, buf, length);
+	return ksprintf(s, "%d", val);
 }
 
 int ksappend_hex(string *s, int val)
 {
-	char buf[32];
-	int length;
-
-	length = to_hex(val, buf, 32);
-	return ksappend_strn(s, buf, length);
+	return ksprintf(s, "0x%08x", val);
 }
 
 /* split string and push the result to vec */
 int kssplit(string *s, char c, vector *vec)
 {
-	int i;
+	const char *p, *next, *end;
 	string *sub;
 
-	sub = ksalloc();
-	for (i = 0; i < s->length; i++) {
-		if (s->str[i] == c) {
-			vector_push(vec, string *, sub);
-			sub = ksalloc();
-			continue;
-		}
+	if (!s->length)
+		return 0;
 
-		ksappend_char(sub, s->str[i]);
-	}
+	end = s->str + s->length;
+	for (p = s->str; p < end; p = next + 1) {
+		next = min(strfind(p, c), end);
+
+		sub = ksalloc();
+		ksappend_strn(sub, p, next - p);
+
+		/* an empty last part is dropped, empty ones in between kept */
+		if (next == end && string_empty(sub)) {
+			ksfree(sub);
+			break;
+		}
 
-	if (!string_empty(sub)) {
 		vector_push(vec, string *, sub);
-	} else {
-		ksfree(sub);
 	}
 
 	return 0;
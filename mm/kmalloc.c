@@ -5,6 +5,7 @@
 #include <log2.h>
 #include <stdio.h>
 #include <fs.h>
+#include <seq_file.h>
 #include <kernel.h>
 #include <atomic.h>
 
@@ -217,53 +218,87 @@ static int dump_kmalloc_early(struct file *file, string *s)
 	return 0;
 }
 
-static int dump_kmalloc(struct file *file, string *s)
+/* the header, then a record per cache in use from *pos on */
+static void *kmalloc_seq_find(u32 *pos)
 {
-	unsigned int i;
 	struct kmem_cache *kcache;
-	struct list_node *node;
-	struct page *page;
+	u32 i;
 
-	ksappend(s, "max_size:", dec(KMEM_CACHE_MAX_SIZE), "\n");
-	ksappend(s, "max_order:", dec(KMEM_CACHE_MAX_ORDER), "\n");
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
 
-	for (i = 0; i <= KMEM_CACHE_MAX_ORDER; i++) {
+	for (i = *pos - 1; i <= KMEM_CACHE_MAX_ORDER; i++) {
 		kcache = &kmalloc_cache[i];
 
 		if (list_empty(&kcache->slabs_full) &&
 		    list_empty(&kcache->slabs_partial))
 			continue;
 
-		ksappend_kv(s, "size:", kcache->size);
-		ksappend_kv(s, " slabs_full:", list_size(&kcache->slabs_full));
-		ksappend_kv(s, " slabs_partial:",
-			    list_size(&kcache->slabs_partial));
+		*pos = i + 1;
+		return kcache;
+	}
 
-		for (node = kcache->slabs_partial.next;
-		     node != &kcache->slabs_partial; node = node->next) {
-			page = container_of(node, struct page, node);
-			ksappend_kv(s, " ", page->active);
-		}
+	return NULL;
+}
 
-		ksappend_str(s, "\n");
+static void *kmalloc_seq_start(struct seq_file *m, u32 *pos)
+{
+	return kmalloc_seq_find(pos);
+}
+
+static void *kmalloc_seq_next(struct seq_file *m, void *v, u32 *pos)
+{
+	(*pos)++;
+	return kmalloc_seq_find(pos);
+}
+
+static void kmalloc_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+static int kmalloc_seq_show(struct seq_file *m, void *v)
+{
+	struct kmem_cache *kcache = v;
+	struct list_node *node;
+	struct page *page;
+	string *s = m->s;
+
+	if (v == SEQ_START_TOKEN) {
+		ksappend(s, "max_size:", dec(KMEM_CACHE_MAX_SIZE), "\n");
+		ksappend(s, "max_order:", dec(KMEM_CACHE_MAX_ORDER), "\n");
+		return 0;
 	}
 
+	ksappend_kv(s, "size:", kcache->size);
+	ksappend_kv(s, " slabs_full:", list_size(&kcache->slabs_full));
+	ksappend_kv(s, " slabs_partial:", list_size(&kcache->slabs_partial));
+
+	for (node = kcache->slabs_partial.next; node != &kcache->slabs_partial;
+	     node = node->next) {
+		page = container_of(node, struct page, node);
+		ksappend_kv(s, " ", page->active);
+	}
+
+	ksappend_str(s, "\n");
 	return 0;
 }
 
-static struct file_operations dump_kmalloc_early_fops = {
-	.read = dump_kmalloc_early,
+static const struct seq_operations kmalloc_seq_ops = {
+	.start = kmalloc_seq_start,
+	.next = kmalloc_seq_next,
+	.stop = kmalloc_seq_stop,
+	.show = kmalloc_seq_show,
 };
 
-static struct file_operations dump_kmalloc_fops = {
-	.read = dump_kmalloc,
+static struct file_operations dump_kmalloc_early_fops = {
+	.read = dump_kmalloc_early,
 };
 
 int kmalloc_init_late(void)
 {
 	struct file *file;
 
-	create_file("kmalloc", &dump_kmalloc_fops, sys, NULL, &file);
+	seq_create_file("kmalloc", &kmalloc_seq_ops, sys, NULL, &file);
 	create_file("kmalloc-early", &dump_kmalloc_early_fops, sys, NULL,
 		    &file);
 	return 0;
@@ -10,6 +10,7 @@
 #include <vmalloc.h>
 #include <schedule.h>
 #include <assert.h>
+#include <percpu.h>
 
 #define MODULE "memory"
 #define MODULE_DEBUG 0
@@ -151,17 +152,25 @@ static void seg_init(struct seg_desc *seg, u8 type, u32 base, u32 limit,
 	seg->base_31_24 = (base >> 24) & 0xff;
 }
 
+/* called on every cpu as it enables paging */
 static void gdt_init(void)
 {
+	int cpu;
+
 	seg_init(&gdt[SEG_KTEXT], STA_X | STA_R, 0x0, 0xFFFFFFFF, DPL_KERNEL,
 		 1);
 	seg_init(&gdt[SEG_KDATA], STA_W, 0x0, 0xFFFFFFFF, DPL_KERNEL, 1);
 	seg_init(&gdt[SEG_UTEXT], STA_X | STA_R, 0x0, 0xFFFFFFFF, DPL_USER, 1);
 	seg_init(&gdt[SEG_UDATA], STA_W, 0x0, 0xFFFFFFFF, DPL_USER, 1);
 
+	/* cpus are started after their per-cpu area is set up */
+	for (cpu = 0; cpu < MAX_CPU; cpu++)
+		seg_init(&gdt[SEG_PERCPU + cpu], STA_W, per_cpu_offset(cpu),
+			 0xFFFFFFFF, DPL_KERNEL, 1);
+
 	asm volatile("lgdt (%0)" ::"r"(&gdt_desc));
 	asm volatile("movw %%ax, %%gs" ::"a"(USER_DS));
-	asm volatile("movw %%ax, %%fs" ::"a"(USER_DS));
+	asm volatile("movw %%ax, %%fs" ::"a"(PERCPU_DS(hard_cpu_id())));
 	asm volatile("movw %%ax, %%es" ::"a"(KERNEL_DS));
 	asm volatile("movw %%ax, %%ds" ::"a"(KERNEL_DS));
 	asm volatile("movw %%ax, %%ss" ::"a"(KERNEL_DS));
@@ -142,11 +142,12 @@ struct page *alloc_pages(gfp_t gfp_mask, unsigned int order)
 	unsigned long i;
 	struct list_node *node, *list;
 	struct page *page, *buddy;
+	u32 flags;
 
 	if (order > MAX_ORDER)
 		return NULL;
 
-	spin_lock(&page_lock);
+	spin_lock_irqsave(&page_lock, flags);
 	for (i = order; i <= MAX_ORDER; i++) {
 		list = get_free_list(gfp_mask, i);
 		if (!list_empty(list)) {
@@ -167,11 +168,11 @@ struct page *alloc_pages(gfp_t gfp_mask, unsigned int order)
 			}
 
 			clear_bit(PAGE_FREE, &page->flags);
-			spin_unlock(&page_lock);
+			spin_unlock_irqrestore(&page_lock, flags);
 			return page;
 		}
 	}
-	spin_unlock(&page_lock);
+	spin_unlock_irqrestore(&page_lock, flags);
 
 	return NULL;
 }
@@ -179,8 +180,9 @@ struct page *alloc_pages(gfp_t gfp_mask, unsigned int order)
 void free_pages(struct page *page)
 {
 	struct page *buddy;
+	u32 flags;
 
-	spin_lock(&page_lock);
+	spin_lock_irqsave(&page_lock, flags);
 	while (page->order < MAX_ORDER) {
 		buddy = page_buddy(page);
 
@@ -196,7 +198,7 @@ void free_pages(struct page *page)
 	}
 
 	free_page(page, page->order);
-	spin_unlock(&page_lock);
+	spin_unlock_irqrestore(&page_lock, flags);
 }
 
 void page_init(void)
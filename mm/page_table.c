@@ -127,8 +127,8 @@ void enable_paging(unsigned long cr3)
 
 	lcr3(cr3);
 	cr0 = rcr0();
-	cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_TS | CR0_EM |
-	       CR0_MP;
+	cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_MP;
+	/* fpu_init() sets CR0_TS for lazy fpu switching */
 	cr0 &= ~(CR0_TS | CR0_EM);
 	lcr0(cr0);
 }
@@ -92,12 +92,15 @@ void *kmem_cache_alloc(struct kmem_cache *cache)
 	struct page *page;
 	struct list_node *node;
 	void *ptr;
+	u32 flags;
 
-	spin_lock(&cache->lock);
+	spin_lock_irqsave(&cache->lock, flags);
 	if (list_empty(&cache->slabs_partial)) {
 		page = alloc_page(GFP_NORMAL);
-		if (slab_page_init(cache, page))
+		if (slab_page_init(cache, page)) {
+			spin_unlock_irqrestore(&cache->lock, flags);
 			return NULL;
+		}
 		list_insert(&cache->slabs_partial, &page->node);
 	} else {
 		node = list_next(&cache->slabs_partial);
@@ -106,7 +109,7 @@ void *kmem_cache_alloc(struct kmem_cache *cache)
 
 	assert(page);
 	ptr = alloc_block(cache, page);
-	spin_unlock(&cache->lock);
+	spin_unlock_irqrestore(&cache->lock, flags);
 
 	return ptr;
 }
@@ -114,15 +117,16 @@ void *kmem_cache_alloc(struct kmem_cache *cache)
 void kmem_cache_free(struct kmem_cache *cache, void *obj)
 {
 	struct page *page;
+	u32 flags;
 
 	assert(!is_vmalloc_addr((uintptr_t)obj));
 
 	page = virt_to_page((uintptr_t)obj);
 	assert(page && page->slab_cache == cache && !test_bit(PAGE_HIGHMEM, &page->flags));
 
-	spin_lock(&cache->lock);
+	spin_lock_irqsave(&cache->lock, flags);
 	free_block(cache, page, obj);
-	spin_unlock(&cache->lock);
+	spin_unlock_irqrestore(&cache->lock, flags);
 }
 
 int kmem_cache_create(struct kmem_cache *cache, size_t size)
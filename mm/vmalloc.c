@@ -9,6 +9,7 @@
 #include <error.h>
 #include <mm.h>
 #include <fs.h>
+#include <seq_file.h>
 #include <debug.h>
 #include <lock.h>
 
@@ -20,7 +21,8 @@
 static struct rb_tree *vma_tree;
 struct list_node vma_list;
 struct list_node free_vma_lists[MAX_VMA_ORDER + 1];
-static spinlock_t vma_lock;
+/* vma_tree and lists, find_vma() readers run in parallel */
+static rwlock_t vma_lock;
 
 static inline unsigned long vma_length(struct vm_area *vma)
 {
@@ -51,17 +53,18 @@ static struct vm_area *find_vma(unsigned long va)
 {
 	struct rb_node *node;
 	struct vm_area *vma;
+	u32 flags;
 
 	assert(va >= VMALLOC_START && va < VMALLOC_END,
 	       "invalid addr:", hex(va));
 
-	spin_lock(&vma_lock);
+	read_lock_irqsave(&vma_lock, flags);
 	node = rb_tree_search(vma_tree, va);
 	assert(node);
 
 	vma = rb_node_value(node);
 	assert(vma);
-	spin_lock(&vma_lock);
+	read_unlock_irqrestore(&vma_lock, flags);
 
 	return vma;
 }
@@ -69,10 +72,11 @@ static struct vm_area *find_vma(unsigned long va)
 static void free_vma(struct vm_area *vma)
 {
 	struct vm_area *prev, *next;
+	u32 flags;
 
 	assert(vma && vma->start >= VMALLOC_START && vma->end < VMALLOC_END);
 
-	spin_lock(&vma_lock);
+	write_lock_irqsave(&vma_lock, flags);
 	rb_tree_remove(vma_tree, vma->start);
 
 	while ((prev = vma_prev(vma)) && prev->free) {
@@ -98,7 +102,7 @@ static void free_vma(struct vm_area *vma)
 	}
 
 	vma->free = true;
-	spin_unlock(&vma_lock);
+	write_unlock_irqrestore(&vma_lock, flags);
 }
 
 static struct vm_area *alloc_vma(unsigned long len)
@@ -107,10 +111,11 @@ static struct vm_area *alloc_vma(unsigned long len)
 	struct list_node *node;
 	unsigned long order, buddy_order;
 	unsigned long i;
+	u32 flags;
 
 	order = ilog2_roundup(len >> PAGE_SHIFT);
 
-	spin_lock(&vma_lock);
+	write_lock_irqsave(&vma_lock, flags);
 	for (i = order; i <= MAX_VMA_ORDER; i++) {
 		if (!list_empty(&free_vma_lists[i])) {
 			node = list_next(&free_vma_lists[i]);
@@ -144,13 +149,13 @@ static struct vm_area *alloc_vma(unsigned long len)
 		}
 	}
 
-out:
-	spin_unlock(&vma_lock);
-	return vma;
-
 not_found:
-	spin_unlock(&vma_lock);
+	write_unlock_irqrestore(&vma_lock, flags);
 	return NULL;
+
+out:
+	write_unlock_irqrestore(&vma_lock, flags);
+	return vma;
 }
 
 static int map_vm_area(struct vm_area *vma, struct page **pages,
@@ -299,7 +304,7 @@ int vmalloc_init(void)
 	vma_tree = rb_tree_create();
 	assert(vma_tree);
 
-	spinlock_init(&vma_lock);
+	rwlock_init(&vma_lock);
 	return 0;
 }
 
@@ -308,7 +313,9 @@ static int dump_free_vma_lists(struct file *file, string *s)
 	struct vm_area *vma;
 	struct list_node *list, *node;
 	unsigned int i;
+	u32 flags;
 
+	read_lock_irqsave(&vma_lock, flags);
 	for (i = 0; i <= MAX_VMA_ORDER; i++) {
 		list = &free_vma_lists[i];
 
@@ -328,33 +335,58 @@ static int dump_free_vma_lists(struct file *file, string *s)
 
 		ksappend_str(s, "\n");
 	}
+	read_unlock_irqrestore(&vma_lock, flags);
 
 	return 0;
 }
 
-static int dump_vma_list(struct file *file, string *s)
+/* a record per vma, the list may hold thousands */
+static void *vma_seq_start(struct seq_file *m, u32 *pos)
 {
-	struct vm_area *vma;
 	struct list_node *node;
+	u32 i;
 
-	node = vma_list.next;
-	while (node != &vma_list) {
-		vma = container_of(node, struct vm_area, node);
-
-		ksappend(s, vma->free ? "free" : "nonfree", " <",
-			 hex(vma->start), ", ", hex(vma->end), ">\n");
-		node = node->next;
+	read_lock_irqsave(&vma_lock, m->flags);
+	for (i = 0, node = vma_list.next; node != &vma_list;
+	     i++, node = node->next) {
+		if (i == *pos)
+			return node;
 	}
 
-	return 0;
+	return NULL;
 }
 
-struct file_operations free_vma_fops = {
-	.read = dump_free_vma_lists,
+static void *vma_seq_next(struct seq_file *m, void *v, u32 *pos)
+{
+	struct list_node *node = v;
+
+	(*pos)++;
+	node = node->next;
+	return node != &vma_list ? node : NULL;
+}
+
+static void vma_seq_stop(struct seq_file *m, void *v)
+{
+	read_unlock_irqrestore(&vma_lock, m->flags);
+}
+
+static int vma_seq_show(struct seq_file *m, void *v)
+{
+	struct vm_area *vma = container_of(v, struct vm_area, node);
+
+	return ksappend(m->s, vma->free ? "free" : "nonfree", " <",
+			hex(vma->start), ", ", hex(vma->end), ">\n");
+}
+
+static const struct seq_operations vma_seq_ops = {
+	.start = vma_seq_start,
+	.next = vma_seq_next,
+	.stop = vma_seq_stop,
+	.show = vma_seq_show,
 };
 
-struct file_operations vma_fops = {
-	.read = dump_vma_list,
+struct file_operations free_vma_fops = {
+	.read = dump_free_vma_lists,
 };
 
 int vmalloc_init_late(void)
@@ -362,6 +394,6 @@ int vmalloc_init_late(void)
 	struct file *file;
 
 	create_file("free_vma", &free_vma_fops, sys, NULL, &file);
-	create_file("vma", &vma_fops, sys, NULL, &file);
+	seq_create_file("vma", &vma_seq_ops, sys, NULL, &file);
 	return 0;
 }
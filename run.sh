@@ -2,4 +2,7 @@
 
 make -j4
 
-qemu-system-i386 -m 2G -parallel none -hda bin/oh-my-os.img -serial stdio
+# the data disk, hdb, outlives make clean
+[ -f disk.img ] || dd if=/dev/zero of=disk.img bs=1M count=64
+
+qemu-system-i386 -m 2G -parallel none -hda bin/oh-my-os.img -hdb disk.img -serial stdio
@@ -4,7 +4,10 @@ make clean
 
 make -j4
 
+# the data disk, hdb, outlives make clean
+[ -f disk.img ] || dd if=/dev/zero of=disk.img bs=1M count=64
+
 qemu-system-i386 \
 	-d int,pcall,mmu,cpu_reset,guest_errors \
 	-D ./error.log \
-	-nographic -smp 4 -m 2G -parallel none -hda bin/oh-my-os.img -serial mon:stdio
+	-nographic -smp 4 -m 2G -parallel none -hda bin/oh-my-os.img -hdb disk.img -serial mon:stdio
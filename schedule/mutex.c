@@ -0,0 +1,73 @@
+#include <mutex.h>
+#include <assert.h>
+#include <debug.h>
+
+#define MODULE "mutex"
+#define MODULE_DEBUG 0
+
+void mutex_init(struct mutex *lock)
+{
+	atomic_set(&lock->count, 1);
+	lock->owner = NULL;
+	wait_queue_init(&lock->wait);
+}
+
+bool mutex_trylock(struct mutex *lock)
+{
+	if (atomic_cmpxchg_acquire(&lock->count, 1, 0) != 1)
+		return false;
+
+	lock->owner = current;
+	return true;
+}
+
+void mutex_lock(struct mutex *lock)
+{
+	if (mutex_trylock(lock))
+		return;
+
+	wait_event(&lock->wait, mutex_trylock(lock));
+}
+
+void mutex_unlock(struct mutex *lock)
+{
+	assert(lock->owner == current);
+
+	lock->owner = NULL;
+	atomic_set_release(&lock->count, 1);
+
+	wake_up_one(&lock->wait);
+}
+
+void sema_init(struct semaphore *sem, int val)
+{
+	atomic_set(&sem->count, val);
+	wait_queue_init(&sem->wait);
+}
+
+bool down_trylock(struct semaphore *sem)
+{
+	int count = atomic_read(&sem->count);
+
+	while (count > 0) {
+		if (atomic_try_cmpxchg(&sem->count, &count, count - 1))
+			return true;
+	}
+
+	return false;
+}
+
+void down(struct semaphore *sem)
+{
+	if (down_trylock(sem))
+		return;
+
+	wait_event(&sem->wait, down_trylock(sem));
+}
+
+void up(struct semaphore *sem)
+{
+	atomic_inc(&sem->count);
+
+	wake_up_one(&sem->wait);
+}
@@ -0,0 +1,314 @@
+#include <rcu.h>
+#include <lock.h>
+#include <smp.h>
+#include <percpu.h>
+#include <completion.h>
+#include <kernel.h>
+#include <stdio.h>
+#include <fs.h>
+
+#define MODULE "rcu"
+#define MODULE_DEBUG 0
+
+/*
+ * grace periods are numbered, gpnum is the last one started and
+ * completed the last one finished, gpnum == completed when none runs
+ */
+static struct rcu_state {
+	spinlock_t lock;
+	volatile u32 gpnum;
+	volatile u32 completed;
+	/* the highest grace period some cpu waits for */
+	u32 requested;
+	/* cpus which did not pass a quiescent state in gpnum yet */
+	volatile u32 qs_mask;
+	/*
+	 * cpus waited for, each from rcu_init() on. cpus[].started comes
+	 * later, for the boot cpu only after the others are brought up.
+	 */
+	u32 online_mask;
+} rcu_state;
+
+struct rcu_data {
+	/* queued by call_rcu(), not yet waiting for a grace period */
+	struct rcu_head *next_list;
+	struct rcu_head **next_tail;
+	/* to be invoked once grace period wait_gp completed */
+	struct rcu_head *wait_list;
+	u32 wait_gp;
+	/* an idle cpu is in no read side section and is not waited for */
+	volatile bool idle;
+
+	u32 qs;
+	u32 queued;
+	u32 invoked;
+};
+
+static DEFINE_PER_CPU(struct rcu_data, rcu_datas);
+
+static inline bool rcu_gp_done(u32 gp)
+{
+	return (s32)(rcu_state.completed - gp) >= 0;
+}
+
+/* rcu_state.lock held */
+static void rcu_start_gp(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	u32 mask = 0;
+	int cpu;
+
+	if (rsp->gpnum != rsp->completed || rcu_gp_done(rsp->requested))
+		return;
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if ((rsp->online_mask & (1 << cpu)) &&
+		    !per_cpu(rcu_datas, cpu).idle)
+			mask |= 1 << cpu;
+	}
+
+	rsp->gpnum++;
+	rsp->qs_mask = mask;
+
+	if (!mask)
+		rsp->completed = rsp->gpnum;
+}
+
+/* rcu_state.lock held */
+static void rcu_end_gp(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	struct rcu_data *rdp;
+	int cpu;
+
+	rsp->completed = rsp->gpnum;
+
+	/* idle cpus are tickless, kick those with callbacks now ready */
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!(rsp->online_mask & (1 << cpu)))
+			continue;
+
+		rdp = per_cpu_ptr(&rcu_datas, cpu);
+		if (rdp->wait_list && rcu_gp_done(rdp->wait_gp))
+			smp_send_reschedule(cpu);
+	}
+
+	rcu_start_gp();
+}
+
+/* rcu_state.lock held */
+static void __rcu_report_qs(int cpu)
+{
+	struct rcu_state *rsp = &rcu_state;
+
+	if (rsp->qs_mask & (1 << cpu)) {
+		rsp->qs_mask &= ~(1 << cpu);
+		if (!rsp->qs_mask)
+			rcu_end_gp();
+	}
+}
+
+/* called by schedule(), the previous thread is done with its readers */
+void rcu_note_context_switch(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	int cpu = cpu_id();
+	u32 flags;
+
+	this_cpu_inc(rcu_datas.qs);
+
+	if (!(rsp->qs_mask & (1 << cpu)))
+		return;
+
+	spin_lock_irqsave(&rsp->lock, flags);
+	__rcu_report_qs(cpu);
+	spin_unlock_irqrestore(&rsp->lock, flags);
+}
+
+/*
+ * interrupts disabled, see timer_idle(). under the lock a grace period
+ * either starts before and gets our quiescent state or starts after and
+ * does not wait for us.
+ */
+void rcu_idle_enter(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	int cpu = cpu_id();
+
+	spin_lock(&rsp->lock);
+	this_cpu_write(rcu_datas.idle, true);
+	this_cpu_inc(rcu_datas.qs);
+	__rcu_report_qs(cpu);
+	spin_unlock(&rsp->lock);
+}
+
+/*
+ * leaving idle must be visible before this cpu reads any rcu protected
+ * pointer, or a grace period started meanwhile would not wait for it
+ */
+void rcu_idle_exit(void)
+{
+	struct rcu_data *rdp = this_cpu_ptr(&rcu_datas);
+
+	if (!rdp->idle)
+		return;
+
+	rdp->idle = false;
+	smp_mb();
+}
+
+/* irq handlers may be readers, even when they interrupted idle */
+void rcu_irq_enter(void)
+{
+	rcu_idle_exit();
+}
+
+/* callbacks of this cpu are ready to be invoked */
+bool rcu_pending(void)
+{
+	struct rcu_data *rdp = this_cpu_ptr(&rcu_datas);
+
+	return rdp->wait_list && rcu_gp_done(rdp->wait_gp);
+}
+
+/*
+ * rcu_process_callbacks - invoke the callbacks whose grace period
+ * completed and start one for newly queued callbacks, called from the
+ * tick and from idle
+ */
+void rcu_process_callbacks(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	struct rcu_data *rdp;
+	struct rcu_head *list = NULL, *head;
+	u32 flags;
+
+	flags = intr_save();
+	rdp = this_cpu_ptr(&rcu_datas);
+
+	if (rcu_pending()) {
+		list = rdp->wait_list;
+		rdp->wait_list = NULL;
+	}
+
+	if (!rdp->wait_list && rdp->next_list) {
+		rdp->wait_list = rdp->next_list;
+		rdp->next_list = NULL;
+		rdp->next_tail = &rdp->next_list;
+
+		spin_lock(&rsp->lock);
+
+		/* a running grace period may have started before call_rcu() */
+		rdp->wait_gp = rsp->gpnum + 1;
+		rsp->requested = rdp->wait_gp;
+		rcu_start_gp();
+
+		spin_unlock(&rsp->lock);
+	}
+
+	intr_restore(flags);
+
+	while (list) {
+		head = list;
+		list = list->next;
+		head->func(head);
+		rdp->invoked++;
+	}
+}
+
+/* @func(@head) is called once all current readers are gone */
+void call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	struct rcu_data *rdp;
+	u32 flags;
+
+	head->func = func;
+	head->next = NULL;
+
+	flags = intr_save();
+
+	rdp = this_cpu_ptr(&rcu_datas);
+	*rdp->next_tail = head;
+	rdp->next_tail = &head->next;
+	rdp->queued++;
+
+	intr_restore(flags);
+}
+
+struct rcu_synchronize {
+	struct rcu_head head;
+	struct completion done;
+};
+
+static void wakeme_after_rcu(struct rcu_head *head)
+{
+	struct rcu_synchronize *rs =
+		container_of(head, struct rcu_synchronize, head);
+
+	complete(&rs->done);
+}
+
+/* wait until all readers which might see an unlinked object are gone */
+void synchronize_rcu(void)
+{
+	struct rcu_synchronize rs;
+
+	init_completion(&rs.done);
+	call_rcu(&rs.head, wakeme_after_rcu);
+	wait_for_completion(&rs.done);
+}
+
+static int rcu_stat_read(struct file *file, string *s)
+{
+	struct rcu_data *rdp;
+	int cpu;
+
+	ksappend(s, "gpnum:", dec(rcu_state.gpnum), " completed:",
+		 dec(rcu_state.completed), " qs_mask:", hex(rcu_state.qs_mask),
+		 "\n");
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!(rcu_state.online_mask & (1 << cpu)))
+			continue;
+
+		rdp = per_cpu_ptr(&rcu_datas, cpu);
+		ksappend(s, "cpu-", dec(cpu), " qs:", dec(rdp->qs),
+			 " queued:", dec(rdp->queued), " invoked:",
+			 dec(rdp->invoked), rdp->idle ? " idle" : "", "\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations rcu_stat_fops = {
+	.read = rcu_stat_read,
+};
+
+/* before @cpu enters any read side section */
+int rcu_init(int cpu)
+{
+	struct rcu_data *rdp = per_cpu_ptr(&rcu_datas, cpu);
+	u32 flags;
+
+	if (cpu == 0)
+		spinlock_init(&rcu_state.lock);
+
+	rdp->next_list = NULL;
+	rdp->next_tail = &rdp->next_list;
+	rdp->wait_list = NULL;
+	rdp->idle = false;
+
+	/* a running grace period started before any reader of this cpu */
+	spin_lock_irqsave(&rcu_state.lock, flags);
+	rcu_state.online_mask |= 1 << cpu;
+	spin_unlock_irqrestore(&rcu_state.lock, flags);
+
+	return 0;
+}
+
+int rcu_init_late(void)
+{
+	struct file *file;
+
+	return create_file("rcu", &rcu_stat_fops, sys, NULL, &file);
+}
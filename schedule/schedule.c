@@ -7,6 +7,11 @@
 #include <debug.h>
 #include <smp.h>
 #include <lock.h>
+#include <x86.h>
+#include <timer.h>
+#include <rcu.h>
+#include <ktime.h>
+#include <string.h>
 
 #define MODULE "schedule"
 #define MODULE_DEBUG 1
@@ -15,14 +20,17 @@ extern char bootstack[];
 
 static struct process init_proc;
 
-struct run_queue rqs[MAX_CPU];
-struct thread *current_threads[MAX_CPU];
+static DEFINE_PER_CPU(struct run_queue, runqueues);
+DEFINE_PER_CPU(struct thread *, current_task);
+DEFINE_PER_CPU(u32, __preempt_count);
 
-#define this_rq ((struct run_queue *)&rqs[cpu_id()])
+#define cpu_rq(cpu) per_cpu_ptr(&runqueues, cpu)
+#define this_rq() this_cpu_ptr(&runqueues)
 
 static uint32_t g_thread_id = 0;
 
-static spinlock_t sched_lock[MAX_CPU];
+/* serialises changes to thread groups, walkers only take rcu_read_lock() */
+static spinlock_t thread_lock;
 
 void thread_entry(void);
 void run_entrys(struct trapframe *tf);
@@ -40,45 +48,78 @@ void thread_exit(int err)
 	schedule();
 }
 
-static int thread_state_read(struct file *file, string *s)
-{
-	struct thread *t = file->priv;
+static const char *thread_state_names[] = {
+	"inactive", "sleeping", "runnable", "running", "exit",
+};
 
-	ksappend_int(s, t->state);
-	return 0;
+const char *thread_state_name(enum thread_state state)
+{
+	return thread_state_names[state];
 }
 
-static struct file_operations thread_state_fops = {
-	.read = thread_state_read,
-};
+/* rcu_read_lock() held, the thread stays valid until it is dropped */
+struct thread *find_thread(u32 tid)
+{
+	struct list_node *node;
+	struct thread *t;
+
+	list_for_each_rcu(node, &init_proc.thread_group) {
+		t = container_of(node, struct thread, node);
+		if (t->tid == tid)
+			return t;
+	}
 
-static int create_thread_procfs(struct thread *t)
+	return NULL;
+}
+
+/*
+ * rcu_read_lock() held, @fn on every thread find_thread() can return,
+ * stops at and returns the first non-zero result
+ */
+int for_each_thread(int (*fn)(struct thread *t, void *arg), void *arg)
 {
+	struct list_node *node;
 	int ret;
-	string *s;
 
-	s = ksalloc();
-	if (!s)
-		return -ENOMEM;
+	list_for_each_rcu(node, &init_proc.thread_group) {
+		ret = fn(container_of(node, struct thread, node), arg);
+		if (ret)
+			return ret;
+	}
 
-	ksappend_int(s, t->tid);
+	return 0;
+}
 
-	ret = create_directory(s->str, proc, &t->dir);
-	if (ret)
-		goto err_free_str;
+/* racy against the thread's cpu, good enough for statistics */
+u64 thread_runtime(struct thread *t)
+{
+	u64 runtime = t->runtime;
 
-	create_file("state", &thread_state_fops, t->dir, t, &t->f_state);
-	return 0;
+	if (t->state == THREAD_RUNNING)
+		runtime += ktime_ns() - t->exec_start;
 
-err_free_str:
-	ksfree(s);
-	return ret;
+	return runtime;
+}
+
+/*
+ * the deepest the stack has been, stacks start zeroed and the words
+ * never written from the bottom up are counted as unused
+ */
+u32 thread_stack_used(struct thread *t)
+{
+	u32 *p = (u32 *)t->kstack;
+	u32 *end = (u32 *)(t->kstack + KERNEL_STACK_SIZE);
+
+	while (p < end && !*p)
+		p++;
+
+	return (uintptr_t)end - (uintptr_t)p;
 }
 
 struct thread *thread_run(int (*fn)(void *), void *arg, int cpu)
 {
-	int ret;
 	struct thread *t;
+	u32 flags;
 
 	if (cpu < 0 || cpu >= MAX_CPU)
 		cpu = cpu_id();
@@ -91,6 +132,12 @@ struct thread *thread_run(int (*fn)(void *), void *arg, int cpu)
 	if (!t->kstack)
 		goto err_free_thread;
 
+	if (fpu_alloc(&t->fpu))
+		goto err_free_kstack;
+
+	/* for thread_stack_used() */
+	memset((void *)t->kstack, 0, KERNEL_STACK_SIZE);
+
 	t->tf = (struct trapframe *)(t->kstack + KERNEL_STACK_SIZE) - 1;
 	t->tf->cs = KERNEL_CS;
 	t->tf->ds = KERNEL_DS;
@@ -111,17 +158,21 @@ struct thread *thread_run(int (*fn)(void *), void *arg, int cpu)
 	t->proc = current->proc;
 	t->tid = g_thread_id++;
 	t->state = THREAD_RUNNABLE;
+	t->cpu = cpu;
+	t->runtime = 0;
+	t->exec_start = 0;
 
-	spin_lock(&sched_lock[cpu]);
-	list_insert(&current_threads[cpu]->proc->thread_group, &t->node);
-	list_insert(&rqs[cpu].head, &t->sched_node);
-	spin_unlock(&sched_lock[cpu]);
+	spin_lock(&thread_lock);
+	list_insert_tail_rcu(&t->proc->thread_group, &t->node);
+	spin_unlock(&thread_lock);
 
-	pr_debug("create thread-", dec(t->tid), " on cpu-", dec(cpu));
+	spin_lock_irqsave(&cpu_rq(cpu)->lock, flags);
+	list_insert(&cpu_rq(cpu)->head, &t->sched_node);
+	spin_unlock_irqrestore(&cpu_rq(cpu)->lock, flags);
 
-	ret = create_thread_procfs(t);
-	if (ret)
-		goto err_free_kstack;
+	smp_send_reschedule(cpu);
+
+	pr_debug("create thread-", dec(t->tid), " on cpu-", dec(cpu));
 
 	return t;
 
@@ -134,14 +185,67 @@ err_free_thread:
 
 void thread_sleep(struct thread *thread)
 {
+	int cpu = thread->cpu;
+	struct run_queue *rq = cpu_rq(cpu);
+	u32 flags;
+
+	spin_lock_irqsave(&rq->lock, flags);
+
+	/* the running thread is not on the run queue */
+	if (thread->state == THREAD_RUNNABLE &&
+	    per_cpu(current_task, cpu) != thread)
+		list_remove(&thread->sched_node);
 	thread->state = THREAD_SLEEPING;
-	list_remove(&thread->sched_node);
+
+	spin_unlock_irqrestore(&rq->lock, flags);
 }
 
+/*
+ * thread_wakeup - put a sleeping thread back on the run queue of its cpu,
+ * may be called from any cpu and from irq context
+ */
 void thread_wakeup(struct thread *thread)
 {
+	int cpu = thread->cpu;
+	struct run_queue *rq = cpu_rq(cpu);
+	u32 flags;
+
+	spin_lock_irqsave(&rq->lock, flags);
+
+	if (thread->state != THREAD_SLEEPING) {
+		spin_unlock_irqrestore(&rq->lock, flags);
+		return;
+	}
+
 	thread->state = THREAD_RUNNABLE;
-	list_insert(&thread->sched_node, &this_rq->head);
+
+	/* woken up before it was switched out, schedule() keeps it running */
+	if (per_cpu(current_task, cpu) != thread)
+		list_insert_tail(&rq->head, &thread->sched_node);
+
+	spin_unlock_irqrestore(&rq->lock, flags);
+
+	smp_send_reschedule(cpu);
+}
+
+/* the exited thread ran on its kstack until the switch away from it */
+static void thread_free_rcu(struct rcu_head *head)
+{
+	struct thread *t = container_of(head, struct thread, rcu);
+
+	fpu_free(&t->fpu);
+	kfree((void *)t->kstack);
+	kfree(t);
+}
+
+static void thread_release(struct thread *t)
+{
+	spin_lock(&thread_lock);
+	list_remove_rcu(&t->node);
+	spin_unlock(&thread_lock);
+
+	fpu_release(t);
+	call_rcu(&t->rcu, thread_free_rcu);
 }
 
 void schedule(void)
@@ -149,54 +253,100 @@ void schedule(void)
 	struct list_node *node;
 	struct thread *prev = current, *next;
 	struct thread_context context;
-	int cpu = cpu_id();
-
-	if (list_empty(&this_rq->head))
-		return;
+	struct run_queue *rq = this_rq();
+	u64 now;
+	u32 flags;
+
+	if (in_atomic())
+		pr_err("scheduling while atomic: ", hex(preempt_count()));
+
+	rcu_note_context_switch();
+
+	/* threads are woken up on this run queue from irqs and other cpus */
+	spin_lock_irqsave(&rq->lock, flags);
+
+	/* nothing else to run, wait here until sleeping prev is woken up */
+	while (list_empty(&rq->head)) {
+		if (prev->state != THREAD_SLEEPING) {
+			if (prev->state == THREAD_RUNNABLE)
+				prev->state = THREAD_RUNNING;
+			spin_unlock_irqrestore(&rq->lock, flags);
+			return;
+		}
+
+		spin_unlock(&rq->lock);
+		timer_idle();
+		spin_lock(&rq->lock);
+	}
 
-	node = list_next(&this_rq->head);
+	node = list_next(&rq->head);
 	next = container_of(node, struct thread, sched_node);
 
-	if (prev == next)
-		return;
-
 	/* pr_debug("schedule: ", dec(current->tid), " => ", dec(next->tid)); */
 
-	spin_lock(&sched_lock[cpu]);
 	list_remove(&next->sched_node);
-	spin_unlock(&sched_lock[cpu]);
 
-	current = next;
+	this_cpu_write(current_task, next);
+	fpu_switch(next);
+	next->state = THREAD_RUNNING;
 
-	if (prev->state != THREAD_EXIT) {
-		spin_lock(&sched_lock[cpu]);
-		list_insert_tail(&this_rq->head, &prev->sched_node);
-		spin_unlock(&sched_lock[cpu]);
-		prev->state = THREAD_RUNNABLE;
-		next->state = THREAD_RUNNING;
-		context_switch(&prev->context, &next->context);
-	} else {
-		spin_lock(&sched_lock[cpu]);
-		list_remove(&prev->node);
-		spin_unlock(&sched_lock[cpu]);
-		remove_directory(prev->dir);
-		kfree((void *)prev->kstack);
-		kfree(prev);
+	now = ktime_ns();
+	prev->runtime += now - prev->exec_start;
+	next->exec_start = now;
+
+	if (prev->state == THREAD_EXIT) {
+		spin_unlock(&rq->lock);
+		thread_release(prev);
 		context_switch(&context, &next->context);
+	} else {
+		/* a sleeping thread is put back by thread_wakeup() */
+		if (prev->state != THREAD_SLEEPING) {
+			list_insert_tail(&rq->head, &prev->sched_node);
+			prev->state = THREAD_RUNNABLE;
+		}
+		spin_unlock(&rq->lock);
+
+		context_switch(&prev->context, &next->context);
+	}
+
+	intr_restore(flags);
+}
+
+/* the idle loop of every cpu, run queued threads and sleep in between */
+void cpu_idle_loop(void)
+{
+	struct run_queue *rq = this_rq();
+
+	while (1) {
+		schedule();
+
+		intr_disable();
+		if (list_empty(&rq->head))
+			timer_idle();
+		intr_enable();
 	}
 }
 
+/* only to wake an idle cpu up, schedule() is called on idle exit */
+static void resched_irq_handler(void)
+{
+}
+
 int schedule_init(int cpu)
 {
-	struct run_queue *rq = &rqs[cpu];
+	struct run_queue *rq = cpu_rq(cpu);
 	struct thread *idle;
 
-	spinlock_init(&sched_lock[cpu]);
+	spinlock_init(&rq->lock);
+	rcu_init(cpu);
 
 	pr_info("init schedule on cpu-", dec(cpu));
 
-	if (cpu == 0)
+	if (cpu == 0) {
+		spinlock_init(&thread_lock);
 		list_init(&init_proc.thread_group);
+		request_irq(IRQ_RESCHED, resched_irq_handler);
+	}
 
 	list_init(&rq->head);
 
@@ -204,19 +354,28 @@ int schedule_init(int cpu)
 	if (!idle)
 		return -ENOMEM;
 
+	if (fpu_alloc(&idle->fpu)) {
+		kfree(idle);
+		return -ENOMEM;
+	}
+
 	idle->tid = g_thread_id++;
 	idle->state = THREAD_RUNNING;
+	idle->cpu = cpu;
 	idle->proc = &init_proc;
-	idle->kstack = (uint32_t)bootstack;
-	idle->tf = (struct trapframe *)(idle->kstack + KERNEL_STACK_SIZE * cpu) - 1;
+	/* the boot stack of the cpu, below the one of the next cpu */
+	idle->kstack = (uint32_t)bootstack + KERNEL_STACK_SIZE * cpu;
+	idle->tf = (struct trapframe *)idle->kstack - 1;
+	idle->runtime = 0;
+	idle->exec_start = 0;
 
 	pr_debug("create idle thread-", dec(idle->tid));
 
-	current_threads[cpu] = idle;
-
-	list_insert(&init_proc.thread_group, &idle->node);
+	per_cpu(current_task, cpu) = idle;
 
-	create_thread_procfs(idle);
+	spin_lock(&thread_lock);
+	list_insert_tail_rcu(&init_proc.thread_group, &idle->node);
+	spin_unlock(&thread_lock);
 
 	return 0;
 }
@@ -0,0 +1,133 @@
+#include <wait.h>
+#include <completion.h>
+#include <x86.h>
+#include <register.h>
+#include <kernel.h>
+
+void wait_queue_init(struct wait_queue_head *wq)
+{
+	spinlock_init(&wq->lock);
+	list_init(&wq->head);
+}
+
+void init_wait_entry(struct wait_queue_entry *wait)
+{
+	wait->thread = current;
+	list_init(&wait->node);
+}
+
+/* queue @wait if not yet and mark current sleeping, see wait_event() */
+void prepare_to_wait(struct wait_queue_head *wq, struct wait_queue_entry *wait)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if (list_empty(&wait->node))
+		list_insert_tail(&wq->head, &wait->node);
+	thread_sleep(current);
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(struct wait_queue_head *wq, struct wait_queue_entry *wait)
+{
+	u32 flags;
+
+	current->state = THREAD_RUNNING;
+
+	spin_lock_irqsave(&wq->lock, flags);
+
+	if (!list_empty(&wait->node)) {
+		list_remove(&wait->node);
+		list_init(&wait->node);
+	}
+
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/*
+ * woken entries are dequeued, a waiter whose condition is still false
+ * queues itself again in prepare_to_wait().
+ */
+static void __wake_up_locked(struct wait_queue_head *wq, int nr)
+{
+	struct wait_queue_entry *wait;
+	struct list_node *node;
+
+	while (!list_empty(&wq->head)) {
+		node = list_next(&wq->head);
+		list_remove(node);
+		list_init(node);
+
+		wait = container_of(node, struct wait_queue_entry, node);
+		thread_wakeup(wait->thread);
+
+		if (nr && !--nr)
+			break;
+	}
+}
+
+/* __wake_up - wake up @nr threads waiting on @wq, all if @nr is 0 */
+void __wake_up(struct wait_queue_head *wq, int nr)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	__wake_up_locked(wq, nr);
+	spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void init_completion(struct completion *x)
+{
+	x->done = 0;
+	wait_queue_init(&x->wait);
+}
+
+void complete(struct completion *x)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&x->wait.lock, flags);
+	x->done++;
+	/* the waiter may free @x as soon as the lock is dropped */
+	__wake_up_locked(&x->wait, 1);
+	spin_unlock_irqrestore(&x->wait.lock, flags);
+}
+
+void complete_all(struct completion *x)
+{
+	u32 flags;
+
+	spin_lock_irqsave(&x->wait.lock, flags);
+	x->done = ~0U >> 1;
+	__wake_up_locked(&x->wait, 0);
+	spin_unlock_irqrestore(&x->wait.lock, flags);
+}
+
+/* consume one completion if there is any */
+bool try_wait_for_completion(struct completion *x)
+{
+	bool ret = false;
+	u32 flags;
+
+	spin_lock_irqsave(&x->wait.lock, flags);
+	if (x->done) {
+		x->done--;
+		ret = true;
+	}
+	spin_unlock_irqrestore(&x->wait.lock, flags);
+
+	return ret;
+}
+
+void wait_for_completion(struct completion *x)
+{
+	wait_event(&x->wait, try_wait_for_completion(x));
+}
+
+long wait_for_completion_timeout(struct completion *x, long timeout)
+{
+	return wait_event_timeout(&x->wait, try_wait_for_completion(x),
+				  timeout);
+}
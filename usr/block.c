@@ -0,0 +1,271 @@
+#include <block.h>
+#include <fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ktime.h>
+#include <error.h>
+#include <usr.h>
+
+#define BLK_BENCH_MB 4
+/* blkread prints at most this much of a block */
+#define BLKREAD_MAX 256
+
+static int do_sync(struct file *file, vector *vec)
+{
+	return sync_all_blockdevs();
+}
+
+static struct file_operations sync_fops = {
+	.exec = do_sync,
+};
+
+static struct block_device *blk_arg(vector *vec, const char *cmd)
+{
+	struct block_device *bdev;
+	string *name = vector_at(vec, string *, 1);
+
+	bdev = find_block_device(name->str);
+	if (!bdev)
+		printk(cmd, ": no such device ", name->str, "\n");
+	return bdev;
+}
+
+/* a device to write to, never the boot disk which holds the kernel */
+static int blk_write_arg(vector *vec, const char *cmd,
+			 struct block_device **bdev)
+{
+	*bdev = blk_arg(vec, cmd);
+	if (!*bdev)
+		return -ENODEV;
+
+	if (!strcmp((*bdev)->name, "hda")) {
+		printk(cmd, ": refusing to overwrite hda\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* blkwrite <dev> <block> <words...>, the block holds the words after it */
+static int do_blkwrite(struct file *file, vector *vec)
+{
+	struct block_device *bdev;
+	struct buffer_head *bh;
+	string *word;
+	u32 block, off = 0;
+	int i, ret;
+
+	if (vector_size(vec) < 3) {
+		printk("blkwrite: invalid arguments ", dec(vector_size(vec)),
+		       "\n");
+		return -EINVAL;
+	}
+
+	ret = blk_write_arg(vec, "blkwrite", &bdev);
+	if (ret)
+		return ret;
+
+	block = strtol(vector_at(vec, string *, 2)->str, NULL, 10);
+	bh = bget(bdev, block);
+	if (!bh)
+		return -EINVAL;
+
+	memset(bh->data, 0, BLOCK_SIZE);
+	for (i = 3; i < vector_size(vec); i++) {
+		word = vector_at(vec, string *, i);
+		if (off + word->length + 1 >= BLOCK_SIZE)
+			break;
+
+		if (i > 3)
+			((char *)bh->data)[off++] = ' ';
+		memcpy(bh->data + off, word->str, word->length);
+		off += word->length;
+	}
+
+	mark_buffer_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+
+static struct file_operations blkwrite_fops = {
+	.exec = do_blkwrite,
+};
+
+/* blkread <dev> <block>, the start of the block as a string */
+static int do_blkread(struct file *file, vector *vec)
+{
+	struct block_device *bdev;
+	struct buffer_head *bh;
+	string *s;
+
+	if (vector_size(vec) != 3) {
+		printk("blkread: invalid arguments ", dec(vector_size(vec)),
+		       "\n");
+		return -EINVAL;
+	}
+
+	bdev = blk_arg(vec, "blkread");
+	if (!bdev)
+		return -ENODEV;
+
+	bh = bread(bdev, strtol(vector_at(vec, string *, 2)->str, NULL, 10));
+	if (!bh)
+		return -EIO;
+
+	s = ksalloc();
+	if (s) {
+		ksappend_strn(s, bh->data, BLKREAD_MAX);
+		printk(s->str, "\n");
+		ksfree(s);
+	}
+
+	brelse(bh);
+	return s ? 0 : -ENOMEM;
+}
+
+static struct file_operations blkread_fops = {
+	.exec = do_blkread,
+};
+
+/* 1 byte per us is 1 MB/s */
+static u32 blk_bench_mbps(u64 start, u32 blocks)
+{
+	u64 us = ktime_ns() - start;
+
+	do_div(us, 1000);
+	return blocks * BLOCK_SIZE / max((u32)us, 1u);
+}
+
+static inline u32 blk_bench_word(u32 block, u32 i)
+{
+	return block * 1024 + i;
+}
+
+/* each block is read once, in order or scattered */
+static int blk_bench_read(struct block_device *bdev, u32 blocks, bool random,
+			  u32 *mbps)
+{
+	struct buffer_head *bh;
+	u32 i, block, seed = 1;
+	u64 start;
+	int ret;
+
+	ret = invalidate_blockdev(bdev);
+	if (ret)
+		return ret;
+
+	start = ktime_ns();
+	for (i = 0; i < blocks; i++) {
+		block = i;
+		if (random) {
+			seed = seed * 1103515245 + 12345;
+			block = (seed >> 8) % blocks;
+		}
+
+		bh = bread(bdev, block);
+		if (!bh)
+			return -EIO;
+
+		ret = ((u32 *)bh->data)[7] != blk_bench_word(block, 7);
+		brelse(bh);
+		if (ret)
+			return -EIO;
+	}
+
+	*mbps = blk_bench_mbps(start, blocks);
+	return 0;
+}
+
+/*
+ * blk_bench <dev> [MB] - overwrites the start of @dev and prints MB/s of
+ * writing it back, of sequential and random reads and the hit rate
+ */
+static int blk_bench(struct file *file, vector *vec)
+{
+	struct block_device *bdev;
+	struct buffer_head *bh;
+	struct block_stat before;
+	u32 blocks, block, i, write, seq, random, hits, lookups, requests;
+	int mb = BLK_BENCH_MB, ret;
+	u64 start;
+
+	if (vector_size(vec) < 2) {
+		printk("blk_bench: invalid arguments ", dec(vector_size(vec)),
+		       "\n");
+		return -EINVAL;
+	}
+
+	ret = blk_write_arg(vec, "blk_bench", &bdev);
+	if (ret)
+		return ret;
+
+	if (vector_size(vec) > 2) {
+		mb = strtol(vector_at(vec, string *, 2)->str, NULL, 10);
+		if (mb <= 0)
+			mb = BLK_BENCH_MB;
+	}
+
+	blocks = min((u32)mb * 1024 * 1024 / BLOCK_SIZE, bdev->nr_blocks);
+
+	start = ktime_ns();
+	for (block = 0; block < blocks; block++) {
+		bh = bget(bdev, block);
+		if (!bh)
+			return -ENOMEM;
+
+		for (i = 0; i < BLOCK_SIZE / 4; i++)
+			((u32 *)bh->data)[i] = blk_bench_word(block, i);
+
+		mark_buffer_dirty(bh);
+		brelse(bh);
+	}
+
+	ret = sync_blockdev(bdev);
+	if (ret)
+		return ret;
+	write = blk_bench_mbps(start, blocks);
+
+	before = bdev->stat;
+	ret = blk_bench_read(bdev, blocks, false, &seq);
+	if (ret)
+		return ret;
+
+	hits = bdev->stat.hits - before.hits;
+	lookups = hits + bdev->stat.misses - before.misses;
+	requests = bdev->stat.requests - before.requests;
+
+	ret = blk_bench_read(bdev, blocks, true, &random);
+	if (ret)
+		return ret;
+
+	printk("blocks: ", dec(blocks), ", MB/s: write ", dec(write),
+	       ", seq read ", dec(seq), ", random read ", dec(random), "\n");
+	printk("seq read hits: ", dec(hits), "/", dec(lookups), ", requests: ",
+	       dec(requests), "\n");
+	return 0;
+}
+
+static struct file_operations blk_bench_fops = {
+	.exec = blk_bench,
+};
+
+int usr_block_init(void)
+{
+	struct file *file;
+	int ret;
+
+	ret = binfs_create_file("sync", &sync_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("blkwrite", &blkwrite_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("blkread", &blkread_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	return binfs_create_file("blk_bench", &blk_bench_fops, NULL, &file);
+}
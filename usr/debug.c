@@ -1,6 +1,13 @@
 #include <debug.h>
 #include <fs.h>
 #include <usr.h>
+#include <printk.h>
+#include <stdlib.h>
+#include <kmalloc.h>
+#include <error.h>
+
+/* dmesg -o copies /sys/kmsg in pieces of this size */
+#define DMESG_EXPORT_CHUNK 512
 
 static int do_bt(struct file *file, vector *vec)
 {
@@ -12,9 +19,110 @@ static struct file_operations debug_fops = {
 	.exec = do_bt,
 };
 
+/* the binary records since the last clear into @path, made if missing */
+static int dmesg_export(const char *path)
+{
+	struct directory *dir;
+	struct file *kmsg, *f;
+	const char *name;
+	u32 off = 0;
+	char *buf;
+	int ret;
+
+	buf = kmalloc(DMESG_EXPORT_CHUNK);
+	if (!buf)
+		return -ENOMEM;
+
+	/* ramfs files are freed after the readers that found them */
+	rcu_read_lock();
+
+	ret = path_lookup("/sys/kmsg", root, &dir, &kmsg);
+	if (ret)
+		goto out;
+
+	ret = path_lookup(path, current_dir, &dir, &f);
+	if (ret == -ENOENT) {
+		ret = path_lookup_parent(path, current_dir, &dir, &name);
+		if (!ret)
+			ret = vfs_create(dir, name, &f);
+	} else if (!ret && !f) {
+		ret = -EINVAL;
+	}
+	if (ret)
+		goto out;
+
+	ret = vfs_truncate(f, 0);
+	while (!ret && (ret = vfs_read(kmsg, buf, DMESG_EXPORT_CHUNK, off)) > 0) {
+		ret = vfs_write(f, buf, ret, off);
+		if (ret > 0) {
+			off += ret;
+			ret = 0;
+		}
+	}
+
+out:
+	rcu_read_unlock();
+	kfree(buf);
+	return ret;
+}
+
+/*
+ * dmesg [-c] [-l level] [-o file] - print the records since the last
+ * clear at the level or below, -c clears them after, -o writes them to
+ * file in binary instead. dmesg -n level only sets the level pr_* go to
+ * the console below.
+ */
 static int do_dmesg(struct file *file, vector *vec)
 {
-	dmesg();
+	struct dmesg_iter it;
+	const char *opt, *export = NULL;
+	bool clear = false;
+	int i, level = LOG_DEBUG;
+	string *s;
+
+	for (i = 1; i < vector_size(vec); i++) {
+		opt = vector_at(vec, string *, i)->str;
+
+		if (!strcmp(opt, "-c")) {
+			clear = true;
+			continue;
+		}
+
+		if (i + 1 == vector_size(vec) ||
+		    (strcmp(opt, "-l") && strcmp(opt, "-n") && strcmp(opt, "-o"))) {
+			printk("dmesg: invalid argument ", opt, "\n");
+			return -EINVAL;
+		}
+
+		i++;
+		if (!strcmp(opt, "-o")) {
+			export = vector_at(vec, string *, i)->str;
+		} else if (!strcmp(opt, "-l")) {
+			level = strtol(vector_at(vec, string *, i)->str, NULL, 10);
+		} else {
+			console_loglevel =
+				strtol(vector_at(vec, string *, i)->str, NULL, 10);
+			return 0;
+		}
+	}
+
+	if (export)
+		return dmesg_export(export);
+
+	s = ksalloc();
+	if (!s)
+		return -ENOMEM;
+
+	dmesg_iter_init(&it);
+	while (!dmesg_iter_next(&it, level, s)) {
+		printk(s->str);
+		s->length = 0;
+	}
+
+	if (clear)
+		dmesg_clear(&it);
+
+	ksfree(s);
 	return 0;
 }
 
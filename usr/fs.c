@@ -2,27 +2,47 @@
 #include <kernel.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <kmalloc.h>
+#include <vmalloc.h>
+#include <ktime.h>
 
 struct directory *current_dir;
 
+/* ls [path] */
 static int do_ls(struct file *file, vector *vec)
 {
-	struct directory *d;
+	struct directory *d, *dir = current_dir;
 	struct file *f;
-	struct list_node *node, *head;
+	struct list_node *node;
+	string *path;
+
+	rcu_read_lock();
+
+	if (vector_size(vec) > 1) {
+		path = vector_at(vec, string *, 1);
+		path_lookup(path->str, current_dir, &dir, &f);
+		if (!dir) {
+			rcu_read_unlock();
+			printk("ls: no such directory ", path->str, "\n");
+			return -ENOENT;
+		}
+	}
+
+	vfs_populate(dir);
 
-	head = &current_dir->dir_list;
-	for (node = head->next; node != head; node = node->next) {
+	list_for_each_rcu(node, &dir->dir_list) {
 		d = container_of(node, struct directory, node);
 		printk(d->name, " ");
 	}
 
-	head = &current_dir->file_list;
-	for (node = head->next; node != head; node = node->next) {
+	list_for_each_rcu(node, &dir->file_list) {
 		f = container_of(node, struct file, node);
 		printk(f->name, " ");
 	}
 
+	rcu_read_unlock();
+
 	printk("\n");
 
 	return 0;
@@ -35,6 +55,7 @@ static struct file_operations ls_fops = {
 static int do_cd(struct file *file, vector *vec)
 {
 	struct directory *dir;
+	struct file *f;
 	string *name;
 
 	if (vector_size(vec) > 2) {
@@ -49,21 +70,12 @@ static int do_cd(struct file *file, vector *vec)
 
 	name = vector_at(vec, string *, 1);
 
-	if (!strcmp(name->str, "..")) {
-		if (current_dir->parent)
-			current_dir = current_dir->parent;
-		return 0;
-	}
-
-	if (!strcmp(name->str, "."))
-		return 0;
-
 	if (!strcmp(name->str, "~")) {
 		current_dir = root;
 		return 0;
 	}
 
-	dir = dir_find_dir(current_dir, name->str);
+	path_lookup(name->str, current_dir, &dir, &f);
 	if (!dir) {
 		printk("cd: no such directory ", name->str, "\n");
 		return -ENOENT;
@@ -77,11 +89,17 @@ static struct file_operations cd_fops = {
 	.exec = do_cd,
 };
 
+/* cat prints the file in pieces of this size */
+#define CAT_CHUNK 512
+
 static int do_cat(struct file *file, vector *vec)
 {
 	int ret;
+	u32 off = 0;
+	struct directory *dir;
 	struct file *f;
-	string *name, *content;
+	string *name;
+	char *buf;
 
 	if (vector_size(vec) != 2) {
 		printk("cat: invalid arguments ", dec(vector_size(vec)), "\n");
@@ -89,31 +107,44 @@ static int do_cat(struct file *file, vector *vec)
 	}
 
 	name = vector_at(vec, string *, 1);
+	buf = kmalloc(CAT_CHUNK + 1);
+	if (!buf)
+		return -ENOMEM;
 
-	f = dir_find_file(current_dir, name->str);
+	/* procfs files go away with their thread */
+	rcu_read_lock();
+
+	path_lookup(name->str, current_dir, &dir, &f);
 	if (!f) {
+		rcu_read_unlock();
 		printk("cat: no such file ", name->str, "\n");
-		return -ENOENT;
+		ret = -ENOENT;
+		goto err_free_buf;
 	}
 
-	if (!f->fops->read) {
-		printk("cat: read is not supported for ", f->name, "\n");
-		return -EINVAL;
+	if (!f->fops->pread && !f->fops->read) {
+		rcu_read_unlock();
+		printk("cat: read is not supported for ", name->str, "\n");
+		ret = -EINVAL;
+		goto err_free_buf;
 	}
 
-	content = ksalloc();
-
-	ret = f->fops->read(f, content);
+	while ((ret = vfs_read(f, buf, CAT_CHUNK, off)) > 0) {
+		buf[ret] = 0;
+		printk(buf);
+		off += ret;
+	}
+	rcu_read_unlock();
 	if (ret)
-		goto err_free_content;
+		goto err_free_buf;
 
-	printk(content->str, "\n");
+	printk("\n");
 
-	ksfree(content);
+	kfree(buf);
 	return 0;
 
-err_free_content:
-	ksfree(content);
+err_free_buf:
+	kfree(buf);
 	return ret;
 }
 
@@ -121,6 +152,470 @@ static struct file_operations cat_fops = {
 	.exec = do_cat,
 };
 
+/* the file at @path, created if it does not exist, rcu_read_lock() held */
+static int open_or_create(string *path, struct file **file)
+{
+	struct directory *dir;
+	const char *name;
+	int ret;
+
+	ret = path_lookup(path->str, current_dir, &dir, file);
+	if (!ret && *file)
+		return 0;
+	if (!ret)
+		return -EINVAL;
+
+	ret = path_lookup_parent(path->str, current_dir, &dir, &name);
+	if (ret)
+		return ret;
+
+	return vfs_create(dir, name, file);
+}
+
+/* touch <file> */
+static int do_touch(struct file *file, vector *vec)
+{
+	struct file *f;
+	string *path;
+	int ret;
+
+	if (vector_size(vec) != 2) {
+		printk("touch: invalid arguments ", dec(vector_size(vec)), "\n");
+		return -EINVAL;
+	}
+
+	path = vector_at(vec, string *, 1);
+
+	rcu_read_lock();
+	ret = open_or_create(path, &f);
+	rcu_read_unlock();
+
+	if (ret)
+		printk("touch: cannot create ", path->str, "\n");
+	return ret;
+}
+
+static struct file_operations touch_fops = {
+	.exec = do_touch,
+};
+
+/* write <file> <words...>, replaces the content with the words */
+static int do_write(struct file *file, vector *vec)
+{
+	struct file *f;
+	string *path, *word;
+	u32 off = 0;
+	int i, ret;
+
+	if (vector_size(vec) < 2) {
+		printk("write: invalid arguments ", dec(vector_size(vec)), "\n");
+		return -EINVAL;
+	}
+
+	path = vector_at(vec, string *, 1);
+
+	rcu_read_lock();
+
+	ret = open_or_create(path, &f);
+	if (ret) {
+		rcu_read_unlock();
+		printk("write: cannot create ", path->str, "\n");
+		return ret;
+	}
+
+	ret = vfs_truncate(f, 0);
+
+	for (i = 2; !ret && i < vector_size(vec); i++) {
+		word = vector_at(vec, string *, i);
+		if (i > 2) {
+			ret = vfs_write(f, " ", 1, off++);
+			if (ret < 0)
+				break;
+		}
+
+		ret = vfs_write(f, word->str, word->length, off);
+		if (ret < 0)
+			break;
+
+		off += ret;
+		ret = 0;
+	}
+
+	rcu_read_unlock();
+
+	if (ret)
+		printk("write: cannot write ", path->str, "\n");
+	return ret;
+}
+
+static struct file_operations write_fops = {
+	.exec = do_write,
+};
+
+/* truncate <file> <size> */
+static int do_truncate(struct file *file, vector *vec)
+{
+	struct directory *dir;
+	struct file *f;
+	string *path, *size;
+	int ret;
+
+	if (vector_size(vec) != 3) {
+		printk("truncate: invalid arguments ", dec(vector_size(vec)),
+		       "\n");
+		return -EINVAL;
+	}
+
+	path = vector_at(vec, string *, 1);
+	size = vector_at(vec, string *, 2);
+
+	rcu_read_lock();
+
+	path_lookup(path->str, current_dir, &dir, &f);
+	if (!f) {
+		rcu_read_unlock();
+		printk("truncate: no such file ", path->str, "\n");
+		return -ENOENT;
+	}
+
+	ret = vfs_truncate(f, strtol(size->str, NULL, 10));
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static struct file_operations truncate_fops = {
+	.exec = do_truncate,
+};
+
+/* rm <file> */
+static int do_rm(struct file *file, vector *vec)
+{
+	struct directory *dir;
+	struct file *f;
+	string *path;
+	int ret;
+
+	if (vector_size(vec) != 2) {
+		printk("rm: invalid arguments ", dec(vector_size(vec)), "\n");
+		return -EINVAL;
+	}
+
+	path = vector_at(vec, string *, 1);
+
+	rcu_read_lock();
+
+	path_lookup(path->str, current_dir, &dir, &f);
+	if (!f) {
+		rcu_read_unlock();
+		printk("rm: no such file ", path->str, "\n");
+		return -ENOENT;
+	}
+
+	ret = vfs_unlink(f);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static struct file_operations rm_fops = {
+	.exec = do_rm,
+};
+
+#define RAMFS_BENCH_MB 4
+/* the file is in memory, qemu runs with 2 GB */
+#define RAMFS_BENCH_MB_MAX 512
+#define RAMFS_BENCH_BLOCK 4096
+
+/* 1 byte per us is 1 MB/s */
+static u32 ramfs_bench_mbps(u64 start, u32 bytes)
+{
+	u64 us = ktime_ns() - start;
+
+	do_div(us, 1000);
+	return bytes / max((u32)us, 1u);
+}
+
+/* one pass over the file in RAMFS_BENCH_BLOCK pieces */
+static int ramfs_bench_pass(struct file *f, char *buf, u32 blocks, bool write,
+			    bool random, u32 *mbps)
+{
+	u32 i, off, seed = 1;
+	u64 start;
+	int ret;
+
+	start = ktime_ns();
+	for (i = 0; i < blocks; i++) {
+		off = i;
+		if (random) {
+			seed = seed * 1103515245 + 12345;
+			off = (seed >> 8) % blocks;
+		}
+		off *= RAMFS_BENCH_BLOCK;
+
+		if (write)
+			ret = vfs_write(f, buf, RAMFS_BENCH_BLOCK, off);
+		else
+			ret = vfs_read(f, buf, RAMFS_BENCH_BLOCK, off);
+
+		if (ret != RAMFS_BENCH_BLOCK)
+			return ret < 0 ? ret : -EINVAL;
+	}
+
+	*mbps = ramfs_bench_mbps(start, blocks * RAMFS_BENCH_BLOCK);
+	return 0;
+}
+
+/*
+ * ramfs_bench [MB] - MB/s of sequential and random 4 KB writes and reads
+ * of a file in /tmp
+ */
+static int ramfs_bench(struct file *file, vector *vec)
+{
+	static const char *names[4] = { "seq write", "seq read",
+					"random write", "random read" };
+	int mb = RAMFS_BENCH_MB, i, ret;
+	u32 blocks, mbps[4];
+	struct file *f;
+	string *arg;
+	char *buf;
+
+	if (vector_size(vec) > 1) {
+		arg = vector_at(vec, string *, 1);
+		mb = strtol(arg->str, NULL, 10);
+		if (mb <= 0)
+			mb = RAMFS_BENCH_MB;
+	}
+
+	if (mb > RAMFS_BENCH_MB_MAX) {
+		printk("ramfs_bench: at most ", dec(RAMFS_BENCH_MB_MAX),
+		       " MB\n");
+		return -EINVAL;
+	}
+
+	blocks = ((u32)mb << 20) / RAMFS_BENCH_BLOCK;
+
+	buf = kmalloc(RAMFS_BENCH_BLOCK);
+	if (!buf)
+		return -ENOMEM;
+
+	memset(buf, 'r', RAMFS_BENCH_BLOCK);
+
+	/* only this command removes it, no rcu_read_lock() needed */
+	ret = vfs_create(tmp, "ramfs_bench", &f);
+	if (ret)
+		goto out_free_buf;
+
+	for (i = 0; i < 4; i++) {
+		ret = ramfs_bench_pass(f, buf, blocks, !(i & 1), i >= 2,
+				       &mbps[i]);
+		if (ret)
+			goto out_unlink;
+	}
+
+	printk("file: ", dec(mb), " MB, block: ", dec(RAMFS_BENCH_BLOCK), "\n");
+	for (i = 0; i < 4; i++)
+		printk(names[i], ": ", dec(mbps[i]), " MB/s\n");
+
+out_unlink:
+	vfs_unlink(f);
+out_free_buf:
+	kfree(buf);
+	return ret;
+}
+
+static struct file_operations ramfs_bench_fops = {
+	.exec = ramfs_bench,
+};
+
+#define DCACHE_BENCH_FILES 4096
+#define DCACHE_BENCH_NAME 16
+/* lookups per measurement */
+#define DCACHE_BENCH_LOOKUPS 65536
+/* the linear walk only looks up every LINEAR_STEP-th name */
+#define DCACHE_BENCH_LINEAR_STEP 16
+
+/* the files only have a name */
+static struct file_operations dcache_bench_file_fops;
+
+/* what dir_find_file() did before the name cache */
+static struct file *dcache_bench_linear(struct directory *dir,
+					const char *name)
+{
+	struct list_node *node;
+	struct file *file;
+
+	list_for_each_rcu(node, &dir->file_list) {
+		file = container_of(node, struct file, node);
+		if (!strcmp(name, file->name))
+			return file;
+	}
+
+	return NULL;
+}
+
+static u32 dcache_bench_ns(u64 start, int lookups)
+{
+	u64 ns = ktime_ns() - start;
+
+	do_div(ns, lookups);
+	return ns;
+}
+
+/*
+ * dcache_bench [files] - fill /dcache_bench with files and print ns per
+ * lookup of the name cache, of a linear walk and of path_lookup()
+ */
+static int dcache_bench(struct file *file, vector *vec)
+{
+	struct directory *dir, *d;
+	struct file *f;
+	int nr = DCACHE_BENCH_FILES, i, n, misses = 0;
+	char *names, *name, path[DCACHE_BENCH_NAME + 16];
+	u32 hashed, linear, walk;
+	u64 start;
+	string *arg;
+	int ret;
+
+	if (vector_size(vec) > 1) {
+		arg = vector_at(vec, string *, 1);
+		nr = strtol(arg->str, NULL, 10);
+		if (nr <= 0)
+			nr = DCACHE_BENCH_FILES;
+	}
+
+	names = vmalloc(round_up(nr * DCACHE_BENCH_NAME, PAGE_SIZE));
+	if (!names)
+		return -ENOMEM;
+
+	ret = create_directory("dcache_bench", root, &dir);
+	if (ret)
+		goto out_free_names;
+
+	for (i = 0; i < nr; i++) {
+		name = names + i * DCACHE_BENCH_NAME;
+		name[0] = 'f';
+		name[to_str(i, name + 1, DCACHE_BENCH_NAME - 2) + 1] = '\0';
+
+		ret = create_file(name, &dcache_bench_file_fops, dir, NULL, &f);
+		if (ret)
+			goto out_remove_dir;
+	}
+
+	rcu_read_lock();
+
+	start = ktime_ns();
+	for (n = 0; n < DCACHE_BENCH_LOOKUPS; n++) {
+		name = names + (n % nr) * DCACHE_BENCH_NAME;
+		if (!dir_find_file(dir, name))
+			misses++;
+	}
+	hashed = dcache_bench_ns(start, DCACHE_BENCH_LOOKUPS);
+
+	start = ktime_ns();
+	for (n = 0; n < nr; n += DCACHE_BENCH_LINEAR_STEP) {
+		name = names + n * DCACHE_BENCH_NAME;
+		if (!dcache_bench_linear(dir, name))
+			misses++;
+	}
+	linear = dcache_bench_ns(start,
+				 (nr + DCACHE_BENCH_LINEAR_STEP - 1) /
+					 DCACHE_BENCH_LINEAR_STEP);
+
+	memcpy(path, "/dcache_bench/", 14);
+	start = ktime_ns();
+	for (n = 0; n < DCACHE_BENCH_LOOKUPS; n++) {
+		name = names + (n % nr) * DCACHE_BENCH_NAME;
+		strcpy(path + 14, name);
+		if (path_lookup(path, current_dir, &d, &f))
+			misses++;
+	}
+	walk = dcache_bench_ns(start, DCACHE_BENCH_LOOKUPS);
+
+	rcu_read_unlock();
+
+	printk("files: ", dec(nr), ", ns per lookup: hashed ", dec(hashed),
+	       ", linear ", dec(linear), ", path_lookup ", dec(walk),
+	       misses ? ", misses!" : "", "\n");
+
+out_remove_dir:
+	remove_directory(dir);
+	/* the names are in use until the files are freed */
+	synchronize_rcu();
+out_free_names:
+	vfree(names);
+	return ret;
+}
+
+static struct file_operations dcache_bench_fops = {
+	.exec = dcache_bench,
+};
+
+/* mount lists the mounts, mount <type> <path> adds one */
+static int do_mount(struct file *file, vector *vec)
+{
+	struct directory *dir;
+	struct file *f;
+	string *type, *path;
+	char buf[CAT_CHUNK + 1];
+	u32 off = 0;
+	int ret;
+
+	if (vector_size(vec) == 1) {
+		ret = path_lookup("/sys/mounts", root, &dir, &f);
+		if (ret)
+			return ret;
+
+		while ((ret = vfs_read(f, buf, CAT_CHUNK, off)) > 0) {
+			buf[ret] = 0;
+			printk(buf);
+			off += ret;
+		}
+		return ret;
+	}
+
+	if (vector_size(vec) != 3) {
+		printk("mount: invalid arguments ", dec(vector_size(vec)), "\n");
+		return -EINVAL;
+	}
+
+	type = vector_at(vec, string *, 1);
+	path = vector_at(vec, string *, 2);
+
+	ret = vfs_mount(type->str, path->str, NULL);
+	if (ret)
+		printk("mount: cannot mount ", type->str, " at ", path->str,
+		       ", ", dec(-ret), "\n");
+	return ret;
+}
+
+static struct file_operations mount_fops = {
+	.exec = do_mount,
+};
+
+/* umount <path> */
+static int do_umount(struct file *file, vector *vec)
+{
+	string *path;
+	int ret;
+
+	if (vector_size(vec) != 2) {
+		printk("umount: invalid arguments ", dec(vector_size(vec)), "\n");
+		return -EINVAL;
+	}
+
+	path = vector_at(vec, string *, 1);
+
+	ret = vfs_umount(path->str);
+	if (ret)
+		printk("umount: cannot umount ", path->str, ", ", dec(-ret), "\n");
+	return ret;
+}
+
+static struct file_operations umount_fops = {
+	.exec = do_umount,
+};
+
 int usr_fs_init(void)
 {
 	int ret;
@@ -140,5 +635,37 @@ int usr_fs_init(void)
 	if (ret)
 		return ret;
 
+	ret = binfs_create_file("touch", &touch_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("write", &write_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("truncate", &truncate_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("rm", &rm_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("dcache_bench", &dcache_bench_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("ramfs_bench", &ramfs_bench_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("mount", &mount_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("umount", &umount_fops, NULL, &file);
+	if (ret)
+		return ret;
+
 	return 0;
 }
@@ -67,6 +67,26 @@ int usr_init(void)
 	if (ret)
 		return ret;
 
+	ret = usr_lock_init();
+	if (ret)
+		return ret;
+
+	ret = usr_ring_init();
+	if (ret)
+		return ret;
+
+	ret = usr_percpu_init();
+	if (ret)
+		return ret;
+
+	ret = usr_string_init();
+	if (ret)
+		return ret;
+
+	ret = usr_block_init();
+	if (ret)
+		return ret;
+
 	ret = mem_init();
 	if (ret)
 		return ret;
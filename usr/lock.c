@@ -0,0 +1,326 @@
+#include <fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <lock.h>
+#include <kmalloc.h>
+#include <ktime.h>
+#include <completion.h>
+#include <schedule.h>
+#include <usr.h>
+
+static int lock_stat_read(struct file *file, string *s)
+{
+	struct lock_class *class;
+	struct lock_class_stat *stat;
+	u32 acquired, contended;
+	u64 wait, max_wait;
+	int cpu;
+
+	ksappend(s, "spinlock: ", spinlock_type(), "\n");
+
+#ifndef LOCK_STAT
+	ksappend(s, "off, build with DEFS=-DLOCK_STAT\n");
+#endif
+
+	for (class = lock_classes; class; class = class->next) {
+		acquired = contended = 0;
+		wait = max_wait = 0;
+
+		for (cpu = 0; cpu < MAX_CPU; cpu++) {
+			stat = &class->stats[cpu];
+			acquired += stat->acquired;
+			contended += stat->contended;
+			wait += stat->wait_cycles;
+			if (stat->max_wait_cycles > max_wait)
+				max_wait = stat->max_wait_cycles;
+		}
+
+		if (contended)
+			do_div(wait, contended);
+
+		ksappend(s, class->name[0] == '&' ? class->name + 1 : class->name,
+			 " acquired:", dec(acquired), " contended:",
+			 dec(contended), " avg_wait:", dec(wait),
+			 " max_wait:", dec(max_wait), " cycles\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations lock_stat_fops = {
+	.read = lock_stat_read,
+};
+
+#define LOCK_BENCH_LOOPS 20000
+#define LOCK_BENCH_TABLE 8
+
+enum {
+	/* writers only, one counter under the lock */
+	BENCH_TAS,
+	BENCH_TICKET,
+	BENCH_MCS,
+	/* readers only, a small table read under the lock */
+	BENCH_READ_SPIN,
+	BENCH_READ_RW,
+	BENCH_READ_SEQ,
+	BENCH_NR
+};
+
+static const char *lock_bench_names[BENCH_NR] = {
+	"tas", "ticket", "mcs", "spinlock", "rwlock", "seqlock",
+};
+
+struct lock_bench {
+	int type;
+	int loops;
+	int nr;
+	volatile int ready;
+	volatile u32 counter;
+	u32 table[LOCK_BENCH_TABLE];
+
+	tas_lock_t tas;
+	ticket_lock_t ticket;
+	mcs_lock_t mcs;
+	spinlock_t spin;
+	rwlock_t rw;
+	seqlock_t seq;
+
+	u64 ns[MAX_CPU];
+	struct completion done;
+};
+
+static u32 lock_bench_read_table(struct lock_bench *b)
+{
+	u32 sum = 0;
+	int i;
+
+	for (i = 0; i < LOCK_BENCH_TABLE; i++)
+		sum += b->table[i];
+
+	return sum;
+}
+
+static u32 lock_bench_once(struct lock_bench *b)
+{
+	u32 ret = 0, seq;
+
+	switch (b->type) {
+	case BENCH_TAS:
+		tas_lock(&b->tas);
+		b->counter++;
+		tas_unlock(&b->tas);
+		break;
+	case BENCH_TICKET:
+		ticket_lock(&b->ticket);
+		b->counter++;
+		ticket_unlock(&b->ticket);
+		break;
+	case BENCH_MCS:
+		mcs_lock(&b->mcs);
+		b->counter++;
+		mcs_unlock(&b->mcs);
+		break;
+	case BENCH_READ_SPIN:
+		spin_lock(&b->spin);
+		ret = lock_bench_read_table(b);
+		spin_unlock(&b->spin);
+		break;
+	case BENCH_READ_RW:
+		read_lock(&b->rw);
+		ret = lock_bench_read_table(b);
+		read_unlock(&b->rw);
+		break;
+	case BENCH_READ_SEQ:
+		do {
+			seq = read_seqbegin(&b->seq);
+			ret = lock_bench_read_table(b);
+		} while (read_seqretry(&b->seq, seq));
+		break;
+	}
+
+	return ret;
+}
+
+static int lock_bench_thread(void *arg)
+{
+	struct lock_bench *b = arg;
+	u64 start;
+	int i;
+
+	xadd(&b->ready, 1);
+
+	/* start all cpus at once */
+	while (b->ready < b->nr)
+		cpu_relax();
+
+	start = ktime_ns();
+	for (i = 0; i < b->loops; i++)
+		lock_bench_once(b);
+	b->ns[cpu_id()] = ktime_ns() - start;
+
+	complete(&b->done);
+	return 0;
+}
+
+/* run @type on the first @nr online cpus, return the slowest cpu in ns */
+static u64 lock_bench_run(struct lock_bench *b, int type, int nr, u64 *fastest)
+{
+	u64 min = ~0ULL, max = 0;
+	int cpu, i, n = 0;
+
+	memset(b->ns, 0, sizeof(b->ns));
+	b->type = type;
+	b->nr = nr;
+	b->ready = 0;
+	b->counter = 0;
+	init_completion(&b->done);
+
+	for (cpu = 0; cpu < MAX_CPU && n < nr; cpu++) {
+		if (cpus[cpu].started) {
+			thread_run(lock_bench_thread, b, cpu);
+			n++;
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		wait_for_completion(&b->done);
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (!b->ns[cpu])
+			continue;
+
+		if (b->ns[cpu] < min)
+			min = b->ns[cpu];
+		if (b->ns[cpu] > max)
+			max = b->ns[cpu];
+	}
+
+	if (fastest)
+		*fastest = min;
+	return max;
+}
+
+/* -EINVAL for a loop count that is not a positive number */
+static int lock_bench_create(vector *vec, struct lock_bench **bench)
+{
+	struct lock_bench *b;
+	string *arg;
+	char *end;
+	int cpu;
+
+	b = kmalloc(sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	memset(b, 0, sizeof(*b));
+	b->loops = LOCK_BENCH_LOOPS;
+
+	if (vector_size(vec) > 1) {
+		arg = vector_at(vec, string *, 1);
+		b->loops = strtol(arg->str, &end, 10);
+		if (b->loops <= 0 || *end != '\0') {
+			printk("invalid loops ", arg->str, "\n");
+			kfree(b);
+			return -EINVAL;
+		}
+	}
+
+	spinlock_init(&b->spin);
+	rwlock_init(&b->rw);
+	seqlock_init(&b->seq);
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (cpus[cpu].started)
+			b->nr++;
+	}
+
+	*bench = b;
+	return 0;
+}
+
+/* lock_bench [loops] - all cpus hammer one lock of every implementation */
+static int lock_bench(struct file *file, vector *vec)
+{
+	struct lock_bench *b;
+	u64 min, max, op;
+	int nr, type, ret;
+
+	ret = lock_bench_create(vec, &b);
+	if (ret)
+		return ret;
+
+	nr = b->nr;
+	printk("cpus: ", dec(nr), " loops: ", dec(b->loops), "\n");
+
+	for (type = BENCH_TAS; type <= BENCH_MCS; type++) {
+		max = lock_bench_run(b, type, nr, &min);
+
+		op = max;
+		do_div(op, b->loops * nr);
+
+		printk(lock_bench_names[type], ": ", dec(op),
+		       " ns/op, fastest cpu ", dec(ktime_to_us(min)),
+		       " us, slowest cpu ", dec(ktime_to_us(max)), " us",
+		       b->counter != b->loops * nr ? ", counter mismatch!" : "",
+		       "\n");
+	}
+
+	kfree(b);
+	return 0;
+}
+
+/*
+ * rwlock_bench [loops] - read side scaling from one to all cpus, the
+ * time per read stays flat when readers do not serialise
+ */
+static int rwlock_bench(struct file *file, vector *vec)
+{
+	struct lock_bench *b;
+	u64 ns;
+	int nr, type, ret;
+
+	ret = lock_bench_create(vec, &b);
+	if (ret)
+		return ret;
+
+	printk("loops: ", dec(b->loops), ", ns per read on the slowest cpu\n");
+
+	for (nr = 1; nr <= b->nr; nr++) {
+		printk("readers ", dec(nr), ":");
+
+		for (type = BENCH_READ_SPIN; type <= BENCH_READ_SEQ; type++) {
+			ns = lock_bench_run(b, type, nr, NULL);
+			do_div(ns, b->loops);
+			printk(" ", lock_bench_names[type], " ", dec(ns));
+		}
+
+		printk("\n");
+	}
+
+	kfree(b);
+	return 0;
+}
+
+static struct file_operations rwlock_bench_fops = {
+	.exec = rwlock_bench,
+};
+
+static struct file_operations lock_bench_fops = {
+	.exec = lock_bench,
+};
+
+int usr_lock_init(void)
+{
+	int ret;
+	struct file *file;
+
+	ret = binfs_create_file("lock_bench", &lock_bench_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	ret = binfs_create_file("rwlock_bench", &rwlock_bench_fops, NULL, &file);
+	if (ret)
+		return ret;
+
+	return create_file("lock_stat", &lock_stat_fops, sys, NULL, &file);
+}
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <assert.h>
 #include <memory.h>
+#include <memcpy.h>
+#include <vmalloc.h>
+#include <ktime.h>
 
 struct directory *current_dir;
 
@@ -43,6 +46,96 @@ static struct file_operations devmem_fops = {
 	.exec = do_devmem,
 };
 
+#define MEMBENCH_MAX (2 * 1024 * 1024)
+/* bytes moved per size class and variant */
+#define MEMBENCH_BYTES (32 * 1024 * 1024)
+
+#define MEMBENCH_SIZES 5
+
+static const u32 membench_sizes[MEMBENCH_SIZES] = {
+	64, 1024, 16 * 1024, 256 * 1024, MEMBENCH_MAX,
+};
+
+/* GB/s with two decimals, bytes per us are MB/s */
+static void membench_print(u64 bytes, u64 ns)
+{
+	u64 us = ktime_to_us(ns);
+	u32 mbs;
+
+	do_div(bytes, us ? (u32)us : 1);
+	mbs = bytes;
+
+	printk(" ", dec(mbs / 1000), ".", (mbs % 1000) < 100 ? "0" : "",
+	       dec((mbs % 1000) / 10));
+}
+
+static void membench_run(const struct mem_variant *v, bool set, u8 *dst,
+			 u8 *src, u32 size)
+{
+	u32 loops = MEMBENCH_BYTES / size, i;
+	u64 start;
+
+	start = ktime_ns();
+	for (i = 0; i < loops; i++) {
+		if (set)
+			v->memset(dst, i, size);
+		else
+			v->memcpy(dst, src, size);
+	}
+
+	membench_print((u64)loops * size, ktime_ns() - start);
+}
+
+/* membench - GB/s of every memcpy and memset variant per size class */
+static int do_membench(struct file *file, vector *vec)
+{
+	const struct mem_variant *v;
+	u8 *src, *dst;
+	int i, j, set;
+
+	src = vmalloc(MEMBENCH_MAX);
+	if (!src)
+		return -ENOMEM;
+
+	dst = vmalloc(MEMBENCH_MAX);
+	if (!dst) {
+		vfree(src);
+		return -ENOMEM;
+	}
+
+	memset(src, 0x5a, MEMBENCH_MAX);
+
+	for (set = 0; set < 2; set++) {
+		printk(set ? "memset" : "memcpy", " GB/s, bytes:");
+		for (j = 0; j < MEMBENCH_SIZES; j++)
+			printk(" ", dec(membench_sizes[j]));
+		printk("\n");
+
+		for (i = 0; i < nr_mem_variants; i++) {
+			v = &mem_variants[i];
+			if (!mem_variant_usable(v))
+				continue;
+
+			printk(v->name, ":");
+			for (j = 0; j < MEMBENCH_SIZES; j++)
+				membench_run(v, set, dst, src, membench_sizes[j]);
+
+			/* the last run copied all of src */
+			if (!set && memcmp(dst, src, MEMBENCH_MAX))
+				printk(" mismatch!");
+			printk("\n");
+		}
+	}
+
+	vfree(src);
+	vfree(dst);
+	return 0;
+}
+
+static struct file_operations membench_fops = {
+	.exec = do_membench,
+};
+
 int mem_init(void)
 {
 	int ret;
@@ -54,5 +147,9 @@ int mem_init(void)
 	if (ret)
 		return ret;
 
+	ret = binfs_create_file("membench", &membench_fops, NULL, &file);
+	if (ret)
+		return ret;
+
 	return 0;
 }
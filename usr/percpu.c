@@ -0,0 +1,100 @@
+#include <fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <percpu.h>
+#include <smp.h>
+#include <x86.h>
+#include <schedule.h>
+#include <usr.h>
+
+#define CPU_BENCH_LOOPS 100000
+
+enum {
+	/* what cpu_id() and current used to cost, a lapic mmio read */
+	BENCH_LAPIC_ID,
+	BENCH_LAPIC_CURRENT,
+	/* one %fs relative load */
+	BENCH_CPU_ID,
+	BENCH_CURRENT,
+	BENCH_THIS_CPU_PTR,
+	BENCH_NR
+};
+
+static const char *cpu_bench_names[BENCH_NR] = {
+	"lapic cpu_id", "lapic current", "cpu_id", "current", "this_cpu_ptr",
+};
+
+static volatile unsigned long cpu_bench_sink;
+
+static u64 cpu_bench_run(int type, int loops)
+{
+	u64 start, cycles;
+	int i;
+
+	start = rdtsc();
+
+	for (i = 0; i < loops; i++) {
+		switch (type) {
+		case BENCH_LAPIC_ID:
+			cpu_bench_sink = hard_cpu_id();
+			break;
+		case BENCH_LAPIC_CURRENT:
+			cpu_bench_sink = (unsigned long)per_cpu(current_task,
+								hard_cpu_id());
+			break;
+		case BENCH_CPU_ID:
+			cpu_bench_sink = cpu_id();
+			break;
+		case BENCH_CURRENT:
+			cpu_bench_sink = (unsigned long)current;
+			break;
+		case BENCH_THIS_CPU_PTR:
+			cpu_bench_sink = (unsigned long)this_cpu_ptr(&cpu_number);
+			break;
+		}
+	}
+
+	cycles = rdtsc() - start;
+	do_div(cycles, loops);
+	return cycles;
+}
+
+/* cpu_bench [loops] - cycles per cpu_id() and current, old and new way */
+static int cpu_bench(struct file *file, vector *vec)
+{
+	int loops = CPU_BENCH_LOOPS;
+	string *arg;
+	u64 cycles;
+	u32 flags;
+	int type;
+
+	if (vector_size(vec) > 1) {
+		arg = vector_at(vec, string *, 1);
+		loops = strtol(arg->str, NULL, 10);
+		if (loops <= 0)
+			loops = CPU_BENCH_LOOPS;
+	}
+
+	printk("cpu-", dec(cpu_id()), " loops: ", dec(loops), "\n");
+
+	for (type = 0; type < BENCH_NR; type++) {
+		flags = intr_save();
+		cycles = cpu_bench_run(type, loops);
+		intr_restore(flags);
+
+		printk(cpu_bench_names[type], ": ", dec(cycles), " cycles\n");
+	}
+
+	return 0;
+}
+
+static struct file_operations cpu_bench_fops = {
+	.exec = cpu_bench,
+};
+
+int usr_percpu_init(void)
+{
+	struct file *file;
+
+	return binfs_create_file("cpu_bench", &cpu_bench_fops, NULL, &file);
+}
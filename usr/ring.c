@@ -0,0 +1,259 @@
+#include <fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fifo.h>
+#include <kmalloc.h>
+#include <ktime.h>
+#include <completion.h>
+#include <schedule.h>
+#include <usr.h>
+
+#define RING_BENCH_ITEMS 100000
+#define RING_BENCH_SLOTS 1024
+#define RING_BENCH_BATCH 32
+
+enum {
+	RING_SPSC,
+	RING_MPMC,
+};
+
+struct ring_bench;
+
+struct ring_bench_thread {
+	struct ring_bench *b;
+	bool producer;
+	int cpu;
+};
+
+struct ring_bench {
+	int type;
+	u32 batch;
+	u32 items;
+	int nr;
+	volatile int ready;
+	/* out of order items seen by a spsc consumer */
+	volatile u32 errors;
+	atomic64_t sum;
+
+	struct spsc_ring spsc;
+	struct mpmc_ring mpmc;
+	u32 slots[RING_BENCH_SLOTS];
+
+	struct ring_bench_thread threads[MAX_CPU];
+	u64 ns[MAX_CPU];
+	struct completion done;
+};
+
+static u32 ring_bench_enqueue(struct ring_bench *b, u32 *objs, u32 n)
+{
+	if (b->type == RING_SPSC)
+		return spsc_ring_enqueue_burst(&b->spsc, objs, n);
+
+	return mpmc_ring_enqueue_burst(&b->mpmc, objs, n);
+}
+
+static u32 ring_bench_dequeue(struct ring_bench *b, u32 *objs, u32 n)
+{
+	if (b->type == RING_SPSC)
+		return spsc_ring_dequeue_burst(&b->spsc, objs, n);
+
+	return mpmc_ring_dequeue_burst(&b->mpmc, objs, n);
+}
+
+/* every producer pushes 0 .. items - 1, every consumer pops items */
+static void ring_bench_produce(struct ring_bench *b)
+{
+	u32 objs[RING_BENCH_BATCH];
+	u32 sent = 0, n, i;
+
+	while (sent < b->items) {
+		n = min(b->batch, b->items - sent);
+		for (i = sent; i < sent + n; i++)
+			objs[i - sent] = i;
+
+		n = ring_bench_enqueue(b, objs, n);
+		if (!n)
+			cpu_relax();
+		sent += n;
+	}
+}
+
+static void ring_bench_consume(struct ring_bench *b)
+{
+	u32 objs[RING_BENCH_BATCH];
+	u32 expect = 0, received = 0, n, i;
+	u64 sum = 0;
+
+	while (received < b->items) {
+		n = ring_bench_dequeue(b, objs,
+				       min(b->batch, b->items - received));
+		if (!n) {
+			cpu_relax();
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (b->type == RING_SPSC && objs[i] != expect++)
+				b->errors++;
+			sum += objs[i];
+		}
+		received += n;
+	}
+
+	atomic64_add(&b->sum, sum);
+}
+
+static int ring_bench_thread(void *arg)
+{
+	struct ring_bench_thread *t = arg;
+	struct ring_bench *b = t->b;
+	u64 start;
+
+	xadd(&b->ready, 1);
+
+	/* start all cpus at once */
+	while (b->ready < b->nr)
+		cpu_relax();
+
+	start = ktime_ns();
+	if (t->producer)
+		ring_bench_produce(b);
+	else
+		ring_bench_consume(b);
+	b->ns[t->cpu] = ktime_ns() - start;
+
+	complete(&b->done);
+	return 0;
+}
+
+/*
+ * run @nr producer and @nr consumer cpus, producers on @run[0 .. nr - 1]
+ * and consumers after them, returns items per second through the ring
+ */
+static u32 ring_bench_run(struct ring_bench *b, int type, u32 batch,
+			  int *run, int nr)
+{
+	struct ring_bench_thread *t;
+	u64 max = 0, total, expect;
+	int i;
+
+	b->type = type;
+	b->batch = batch;
+	b->nr = nr * 2;
+	b->ready = 0;
+	b->errors = 0;
+	atomic64_set(&b->sum, 0);
+	memset(b->ns, 0, sizeof(b->ns));
+	init_completion(&b->done);
+
+	if (type == RING_SPSC)
+		spsc_ring_init(&b->spsc, b->slots, RING_BENCH_SLOTS,
+			       sizeof(u32));
+	else
+		mpmc_ring_init(&b->mpmc, b->slots, RING_BENCH_SLOTS,
+			       sizeof(u32));
+
+	for (i = 0; i < b->nr; i++) {
+		t = &b->threads[i];
+		t->b = b;
+		t->cpu = run[i];
+		t->producer = i < nr;
+		thread_run(ring_bench_thread, t, t->cpu);
+	}
+
+	for (i = 0; i < b->nr; i++)
+		wait_for_completion(&b->done);
+
+	for (i = 0; i < MAX_CPU; i++) {
+		if (b->ns[i] > max)
+			max = b->ns[i];
+	}
+
+	expect = ((u64)b->items * (b->items - 1) >> 1) * nr;
+	if (atomic64_read(&b->sum) != expect)
+		b->errors++;
+
+	total = (u64)b->items * nr * USEC_PER_SEC;
+	max = ktime_to_us(max);
+	do_div(total, max ? (u32)max : 1);
+	return total;
+}
+
+/*
+ * ring_bench [items] - items per second through a spsc ring for every
+ * cpu pair, and through a mpmc ring with the cpus split in producers and
+ * consumers, one item and RING_BENCH_BATCH items per call
+ */
+static int ring_bench(struct file *file, vector *vec)
+{
+	struct ring_bench *b;
+	int online[MAX_CPU], pair[2];
+	int nr = 0, cpu, p, c, i;
+	u32 one, bulk, errors;
+	string *arg;
+
+	b = kmalloc(sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	memset(b, 0, sizeof(*b));
+	b->items = RING_BENCH_ITEMS;
+
+	if (vector_size(vec) > 1) {
+		arg = vector_at(vec, string *, 1);
+		b->items = strtol(arg->str, NULL, 10);
+		if ((int)b->items <= 0)
+			b->items = RING_BENCH_ITEMS;
+	}
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (cpus[cpu].started)
+			online[nr++] = cpu;
+	}
+
+	printk("items: ", dec(b->items), ", slots: ", dec(RING_BENCH_SLOTS),
+	       ", items/s for batch 1 and ", dec(RING_BENCH_BATCH), "\n");
+
+	for (p = 0; p < nr; p++) {
+		for (c = 0; c < nr; c++) {
+			if (p == c)
+				continue;
+
+			pair[0] = online[p];
+			pair[1] = online[c];
+			one = ring_bench_run(b, RING_SPSC, 1, pair, 1);
+			errors = b->errors;
+			bulk = ring_bench_run(b, RING_SPSC, RING_BENCH_BATCH,
+					      pair, 1);
+			errors += b->errors;
+
+			printk("spsc cpu-", dec(pair[0]), " -> cpu-",
+			       dec(pair[1]), ": ", dec(one), " ", dec(bulk),
+			       errors ? " errors!" : "", "\n");
+		}
+	}
+
+	for (i = 1; i * 2 <= nr; i++) {
+		one = ring_bench_run(b, RING_MPMC, 1, online, i);
+		errors = b->errors;
+		bulk = ring_bench_run(b, RING_MPMC, RING_BENCH_BATCH, online, i);
+		errors += b->errors;
+
+		printk("mpmc ", dec(i), " producers ", dec(i), " consumers: ",
+		       dec(one), " ", dec(bulk), errors ? " errors!" : "", "\n");
+	}
+
+	kfree(b);
+	return 0;
+}
+
+static struct file_operations ring_bench_fops = {
+	.exec = ring_bench,
+};
+
+int usr_ring_init(void)
+{
+	struct file *file;
+
+	return binfs_create_file("ring_bench", &ring_bench_fops, NULL, &file);
+}
@@ -0,0 +1,218 @@
+#include <fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory.h>
+#include <vmalloc.h>
+#include <ktime.h>
+#include <usr.h>
+
+#define STRTEST_LEN 64
+#define STRTEST_OFFSETS 8
+#define STRTEST_BYTES (4 * 1024 * 1024)
+#define STRTEST_SPEED_LENS 3
+
+static volatile unsigned long strtest_sink;
+
+/* byte at a time references */
+static size_t ref_strlen(const char *s)
+{
+	size_t n = 0;
+
+	while (s[n] != '\0')
+		n++;
+	return n;
+}
+
+static int ref_strcmp(const char *s1, const char *s2)
+{
+	while (*s1 != '\0' && *s1 == *s2)
+		s1++, s2++;
+	return (int)((unsigned char)*s1 - (unsigned char)*s2);
+}
+
+static char *ref_strfind(const char *s, char c)
+{
+	while (*s != '\0' && *s != c)
+		s++;
+	return (char *)s;
+}
+
+static inline int sign(int v)
+{
+	return v > 0 ? 1 : v < 0 ? -1 : 0;
+}
+
+static int strtest_check(const char *name, bool ok, int off, int len)
+{
+	if (ok)
+		return 0;
+
+	printk(name, " failed, offset ", dec(off), " length ", dec(len), "\n");
+	return 1;
+}
+
+/* every length and alignment, @buf is a page, @cmp another one */
+static int strtest_correct(char *buf, char *cmp)
+{
+	int off, off2, len, i, errors = 0;
+	char *s, *s2, *p;
+
+	for (off = 0; off < STRTEST_OFFSETS; off++) {
+		for (len = 0; len <= STRTEST_LEN; len++) {
+			s = buf + off;
+			for (i = 0; i < len; i++)
+				s[i] = 'a' + i % 26;
+			s[len] = '\0';
+			/* bytes after the end must not change a result */
+			s[len + 1] = 'z';
+
+			errors += strtest_check("strlen", strlen(s) == len, off,
+						len);
+			errors += strtest_check("strnlen",
+						strnlen(s, len / 2) == len / 2 &&
+							strnlen(s, len + 8) == len,
+						off, len);
+			errors += strtest_check("strfind",
+						strfind(s, 'a' + len % 26) ==
+							ref_strfind(s, 'a' + len % 26),
+						off, len);
+			/* the 'z' after the end must not be found */
+			p = ref_strfind(s, 'z');
+			errors += strtest_check("strchr",
+						strchr(s, 'z') == (*p ? p : NULL),
+						off, len);
+
+			for (off2 = 0; off2 < STRTEST_OFFSETS; off2++) {
+				s2 = cmp + off2;
+				memcpy(s2, s, len + 1);
+				errors += strtest_check("strcmp",
+							!strcmp(s, s2), off, len);
+				if (!len)
+					continue;
+
+				s2[len - 1]++;
+				errors += strtest_check(
+					"strcmp",
+					sign(strcmp(s, s2)) ==
+						sign(ref_strcmp(s, s2)),
+					off, len);
+				s2[len / 2] = '\0';
+				errors += strtest_check(
+					"strcmp",
+					sign(strcmp(s, s2)) ==
+						sign(ref_strcmp(s, s2)),
+					off, len);
+			}
+		}
+	}
+
+	/* strings ending on the last byte of the page, nothing is read after */
+	for (len = 0; len < STRTEST_OFFSETS; len++) {
+		s = buf + PAGE_SIZE - 1 - len;
+		memset(s, 'x', len);
+		s[len] = '\0';
+		errors += strtest_check("page end", strlen(s) == len &&
+						    strfind(s, 'y') == s + len &&
+						    !strcmp(s, s),
+					PAGE_SIZE - 1 - len, len);
+	}
+
+	return errors;
+}
+
+enum {
+	STRTEST_STRLEN,
+	STRTEST_STRCMP,
+	STRTEST_STRFIND,
+	STRTEST_NR
+};
+
+static const char *strtest_names[STRTEST_NR] = {
+	"strlen", "strcmp", "strfind",
+};
+
+static u32 strtest_speed(int type, bool ref, const char *s, const char *s2,
+			 int len)
+{
+	int loops = STRTEST_BYTES / (len + 1), i;
+	u64 start, ns;
+
+	start = ktime_ns();
+	for (i = 0; i < loops; i++) {
+		switch (type) {
+		case STRTEST_STRLEN:
+			strtest_sink = ref ? ref_strlen(s) : strlen(s);
+			break;
+		case STRTEST_STRCMP:
+			strtest_sink = ref ? ref_strcmp(s, s2) : strcmp(s, s2);
+			break;
+		case STRTEST_STRFIND:
+			strtest_sink = (unsigned long)(ref ? ref_strfind(s, '!') :
+							     strfind(s, '!'));
+			break;
+		}
+	}
+
+	ns = ktime_ns() - start;
+	do_div(ns, loops);
+	return ns;
+}
+
+/*
+ * strtest - checks the word at a time string routines against byte at a
+ * time references, then prints ns per call of both
+ */
+static int strtest(struct file *file, vector *vec)
+{
+	static const int lens[STRTEST_SPEED_LENS] = { 8, 64, 1024 };
+	char *buf, *cmp;
+	int errors, type, i;
+
+	buf = vmalloc(PAGE_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	cmp = vmalloc(PAGE_SIZE);
+	if (!cmp) {
+		vfree(buf);
+		return -ENOMEM;
+	}
+
+	errors = strtest_correct(buf, cmp);
+	printk("correctness: ", errors ? "failed" : "ok", "\n");
+
+	printk("ns per call, byte / word at a time, length:");
+	for (i = 0; i < STRTEST_SPEED_LENS; i++)
+		printk(" ", dec(lens[i]));
+	printk("\n");
+
+	for (type = 0; type < STRTEST_NR; type++) {
+		printk(strtest_names[type], ":");
+
+		for (i = 0; i < STRTEST_SPEED_LENS; i++) {
+			memset(buf, 'a', lens[i]);
+			buf[lens[i]] = '\0';
+			memcpy(cmp, buf, lens[i] + 1);
+
+			printk(" ", dec(strtest_speed(type, true, buf, cmp, lens[i])),
+			       "/",
+			       dec(strtest_speed(type, false, buf, cmp, lens[i])));
+		}
+		printk("\n");
+	}
+
+	vfree(buf);
+	vfree(cmp);
+	return errors ? -EINVAL : 0;
+}
+
+static struct file_operations strtest_fops = {
+	.exec = strtest,
+};
+
+int usr_string_init(void)
+{
+	struct file *file;
+
+	return binfs_create_file("strtest", &strtest_fops, NULL, &file);
+}
@@ -4,6 +4,9 @@
 #include <kmalloc.h>
 #include <debug.h>
 #include <fifo.h>
+#include <completion.h>
+#include <smp.h>
+#include <error.h>
 
 #define MODULE "thread"
 #define MODULE_DEBUG 1
@@ -27,58 +30,101 @@ static struct file_operations thread_fops = {
 	.exec = thread_test,
 };
 
+/* ps - list the threads, walks the thread group without any lock */
+static int ps(struct file *file, vector *vec)
+{
+	struct list_node *node;
+	struct thread *t;
+
+	printk("tid\tcpu\tstate\n");
+
+	rcu_read_lock();
+	list_for_each_rcu(node, &current->proc->thread_group) {
+		t = container_of(node, struct thread, node);
+		printk(dec(t->tid), "\t", dec(t->cpu), "\t",
+		       thread_state_name(t->state), "\n");
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static struct file_operations ps_fops = {
+	.exec = ps,
+};
+
+struct fifo_test_ctx {
+	struct fifo fifo;
+	char data[64];
+	/* both sides sleep here, the fifo is either full or empty */
+	struct wait_queue_head wait;
+	struct completion done;
+};
+
 static int test_consumer(void *arg)
 {
-	struct fifo *fifo = arg;
+	struct fifo_test_ctx *ctx = arg;
 	int v;
 
-	while (1) {
-		if (!fifo_out(fifo, &v, sizeof(v)))
-			printk(dec(v), "\n");
+	do {
+		wait_event(&ctx->wait, !fifo_out(&ctx->fifo, &v, sizeof(v)));
+		wake_up(&ctx->wait);
 
-		if (v == 255)
-			break;
-	}
+		printk(dec(v), "\n");
+	} while (v != 255);
 
 	printk("consumer exit\n");
+	complete(&ctx->done);
 	return 0;
 }
 
 static int test_producer(void *arg)
 {
-	struct fifo *fifo = arg;
+	struct fifo_test_ctx *ctx = arg;
 	int i;
 
 	for (i = 0; i < 256; i++) {
-		while (fifo_in(fifo, &i, sizeof(i)) == -ENOSPC) {
-		}
+		wait_event(&ctx->wait,
+			   fifo_in(&ctx->fifo, &i, sizeof(i)) != -ENOSPC);
+		wake_up(&ctx->wait);
 	}
 
 	printk("producer exit\n");
+	complete(&ctx->done);
 	return 0;
 }
 
+/* producer and consumer on two cpus that are up, -ENODEV without them */
 static int fifo_test(struct file *file, vector *vec)
 {
-	struct fifo *fifo;
+	struct fifo_test_ctx *ctx;
+	int online[2], cpu, nr = 0;
 
-	fifo = kmalloc(sizeof(*fifo));
-	if (!fifo)
-		return -ENOMEM;
+	for (cpu = 0; cpu < MAX_CPU && nr < 2; cpu++) {
+		if (cpus[cpu].started)
+			online[nr++] = cpu;
+	}
 
-	fifo->data = kmalloc(64);
-	if (!fifo->data) {
-		kfree(fifo);
-		return -ENOMEM;
+	if (nr < 2) {
+		printk("fifo_test: needs 2 cpus, ", dec(nr), " up\n");
+		return -ENODEV;
 	}
 
-	fifo_init(fifo, fifo->data, 64);
+	ctx = kmalloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
 
-	thread_run(test_producer, fifo, 1);
-	thread_run(test_consumer, fifo, 2);
+	fifo_init(&ctx->fifo, ctx->data, sizeof(ctx->data));
+	wait_queue_init(&ctx->wait);
+	init_completion(&ctx->done);
 
-	kfree(fifo->data);
-	kfree(fifo);
+	thread_run(test_producer, ctx, online[0]);
+	thread_run(test_consumer, ctx, online[1]);
+
+	wait_for_completion(&ctx->done);
+	wait_for_completion(&ctx->done);
+
+	kfree(ctx);
 	return 0;
 }
 
@@ -99,5 +145,9 @@ int usr_thread_init(void)
 	if (ret)
 		return ret;
 
+	ret = binfs_create_file("ps", &ps_fops, NULL, &file);
+	if (ret)
+		return ret;
+
 	return 0;
 }